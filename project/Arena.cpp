@@ -0,0 +1,127 @@
+#include "Arena.hpp"
+
+#include <cstdint>
+#include <new>
+
+namespace svg
+{
+    Arena::Arena(size_t block_size)
+        : block_size_(block_size), blocks_(nullptr), spare_(nullptr), next_(nullptr), end_(nullptr),
+          destructors_(nullptr), allocated_(0)
+    {
+    }
+
+    Arena::~Arena()
+    {
+        run_destructors();
+        free_blocks(blocks_);
+        free_blocks(spare_);
+    }
+
+    void *Arena::allocate(size_t size, size_t align)
+    {
+        uintptr_t p = ((uintptr_t)next_ + align - 1) & ~(uintptr_t)(align - 1);
+        if (next_ == nullptr || p + size > (uintptr_t)end_)
+        {
+            add_block(size + align);
+            p = ((uintptr_t)next_ + align - 1) & ~(uintptr_t)(align - 1);
+        }
+        allocated_ += p + size - (uintptr_t)next_;
+        next_ = (char *)(p + size);
+        return (void *)p;
+    }
+
+    void Arena::clear()
+    {
+        run_destructors();
+        free_blocks(spare_);
+        spare_ = nullptr;
+        if (blocks_ == nullptr)
+        {
+            return;
+        }
+        // Keep the oldest block to be reused; it is at least block_size_ bytes.
+        while (blocks_->next != nullptr)
+        {
+            Block *next = blocks_->next;
+            ::operator delete(blocks_);
+            blocks_ = next;
+        }
+        next_ = (char *)(blocks_ + 1);
+        end_ = next_ + blocks_->size;
+        allocated_ = 0;
+    }
+
+    void Arena::reset()
+    {
+        run_destructors();
+        // Moved one by one, the oldest block ends up first, to be reused first.
+        while (blocks_ != nullptr)
+        {
+            Block *next = blocks_->next;
+            blocks_->next = spare_;
+            spare_ = blocks_;
+            blocks_ = next;
+        }
+        next_ = nullptr;
+        end_ = nullptr;
+        allocated_ = 0;
+    }
+
+    void Arena::add_destructor(void *object, void (*destroy)(void *))
+    {
+        Destructor *d = create<Destructor>();
+        d->destroy = destroy;
+        d->object = object;
+        d->next = destructors_;
+        destructors_ = d;
+    }
+
+    void Arena::run_destructors()
+    {
+        for (Destructor *d = destructors_; d != nullptr; d = d->next)
+        {
+            d->destroy(d->object);
+        }
+        destructors_ = nullptr;
+    }
+
+    void Arena::add_block(size_t size)
+    {
+        Block *block = nullptr;
+        for (Block **spare = &spare_; *spare != nullptr; spare = &(*spare)->next)
+        {
+            if ((*spare)->size >= size)
+            {
+                block = *spare;
+                *spare = block->next;
+                break;
+            }
+        }
+        if (block == nullptr)
+        {
+            if (size < block_size_)
+            {
+                size = block_size_;
+            }
+            // From operator new, as the other allocations of the program,
+            // so that replacements of operator new see the blocks too.
+            block = (Block *)::operator new(sizeof(Block) + size);
+            block->size = size;
+        }
+        block->next = blocks_;
+        blocks_ = block;
+        next_ = (char *)(block + 1);
+        end_ = next_ + block->size;
+    }
+
+    void Arena::free_blocks(Block *blocks)
+    {
+        while (blocks != nullptr)
+        {
+            Block *next = blocks->next;
+            ::operator delete(blocks);
+            blocks = next;
+        }
+    }
+}
@@ -0,0 +1,166 @@
+//! @file Arena.hpp
+#ifndef __svg_Arena_hpp__
+#define __svg_Arena_hpp__
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace svg
+{
+    //! Region allocator: memory is taken from large blocks by bumping a
+    //! pointer and is only given back when the arena is cleared or destroyed.
+    //! Objects created in the arena are destroyed at the same time, in
+    //! reverse order of creation.
+    class Arena
+    {
+    public:
+        //! Constructor.
+        //! @param block_size Size of the blocks requested from the heap.
+        explicit Arena(size_t block_size = 64 * 1024);
+        //! Destructor. Destroys all objects and frees all blocks.
+        ~Arena();
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+        //! Allocate uninitialized memory.
+        //! @param size Size in bytes.
+        //! @param align Alignment, a power of two.
+        //! @return Memory valid until the arena is cleared or destroyed.
+        void *allocate(size_t size, size_t align = alignof(std::max_align_t));
+        //! Construct an object in the arena.
+        //! Its destructor, if not trivial, runs when the arena is cleared or destroyed;
+        //! the object must not be deleted.
+        //! @param args Constructor arguments.
+        //! @return The new object.
+        template <typename T, typename... Args>
+        T *create(Args &&...args)
+        {
+            void *memory = allocate(sizeof(T), alignof(T));
+            T *object = new (memory) T(std::forward<Args>(args)...);
+            if (!std::is_trivially_destructible<T>::value)
+            {
+                add_destructor(object, &destroy<T>);
+            }
+            return object;
+        }
+        //! Destroy all objects and free all blocks but the first one, to be reused.
+        void clear();
+        //! Destroy all objects and keep all blocks, to be reused by the next
+        //! allocations: an arena reset between documents of similar size
+        //! doesn't allocate again.
+        void reset();
+        //! Get the number of bytes handed out since the last clear.
+        //! @return Bytes allocated, including alignment padding.
+        size_t bytes_allocated() const { return allocated_; }
+
+    private:
+        //! Header of a block of memory.
+        struct Block
+        {
+            //! Previously allocated block.
+            Block *next;
+            //! Usable size of the block.
+            size_t size;
+        };
+        //! Destructor to run when the arena is cleared, stored in the arena.
+        struct Destructor
+        {
+            //! Function destroying the object.
+            void (*destroy)(void *);
+            //! Object.
+            void *object;
+            //! Previously registered destructor.
+            Destructor *next;
+        };
+        template <typename T>
+        static void destroy(void *object)
+        {
+            static_cast<T *>(object)->~T();
+        }
+        //! Register the destructor of an object.
+        void add_destructor(void *object, void (*destroy)(void *));
+        //! Run the registered destructors.
+        void run_destructors();
+        //! Start a new block with at least size bytes.
+        void add_block(size_t size);
+
+        //! Free a list of blocks.
+        //! @param blocks First block of the list.
+        static void free_blocks(Block *blocks);
+
+        //! Default size of the blocks.
+        size_t block_size_;
+        //! Current block (head of the list of blocks).
+        Block *blocks_;
+        //! Blocks kept by reset(), not used since.
+        Block *spare_;
+        //! Next free byte of the current block.
+        char *next_;
+        //! End of the current block.
+        char *end_;
+        //! Last registered destructor.
+        Destructor *destructors_;
+        //! Bytes handed out since the last clear.
+        size_t allocated_;
+    };
+
+    //! Standard allocator taking memory from an arena; deallocation is a no-op.
+    //! A default-constructed allocator uses the heap, so containers using it
+    //! work with or without an arena.
+    template <typename T>
+    class ArenaAllocator
+    {
+    public:
+        typedef T value_type;
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type propagate_on_container_swap;
+
+        //! Constructor.
+        //! @param arena Arena to allocate from, or nullptr for the heap.
+        ArenaAllocator(Arena *arena = nullptr) : arena_(arena) {}
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena()) {}
+
+        T *allocate(size_t n)
+        {
+            if (arena_ == nullptr)
+            {
+                return static_cast<T *>(::operator new(n * sizeof(T)));
+            }
+            return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+        }
+        void deallocate(T *p, size_t)
+        {
+            if (arena_ == nullptr)
+            {
+                ::operator delete(p);
+            }
+        }
+        //! Copies of containers use the heap, so they may outlive the arena.
+        ArenaAllocator select_on_container_copy_construction() const
+        {
+            return ArenaAllocator();
+        }
+        //! Get the arena.
+        //! @return Arena allocated from, or nullptr for the heap.
+        Arena *arena() const { return arena_; }
+
+    private:
+        //! Arena allocated from, or nullptr for the heap.
+        Arena *arena_;
+    };
+
+    template <typename T, typename U>
+    bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+    {
+        return a.arena() == b.arena();
+    }
+
+    template <typename T, typename U>
+    bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+    {
+        return a.arena() != b.arena();
+    }
+}
+#endif
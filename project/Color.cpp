@@ -1,34 +1,290 @@
 #include "Color.hpp"
-#include <map>
-#include <iomanip>
-#include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 
 namespace svg
 {
-    const std::map<std::string, Color> NAMES_TO_COLORS = {
-        {"black", {0, 0, 0}},
-        {"white", {255, 255, 255}},
-        {"red", {255, 0, 0}},
-        {"green", {0, 255, 0}},
-        {"blue", {0, 0, 255}},
-        {"yellow", {255, 255, 0}}};
+    //! Entry of the table of color names.
+    struct NamedColor
+    {
+        //! Name, or "" for an empty slot.
+        const char *name;
+        //! Color.
+        Color color;
+    };
 
-    Color parse_color(const std::string &str)
+    //! Number of slots of the table of color names.
+    const uint32_t COLOR_SLOTS = 160;
+    //! Number of buckets of the hash of color names.
+    const uint32_t COLOR_BUCKETS = 48;
+
+    //! Seed of the second hash of the names of each bucket, chosen so that
+    //! no two names share a slot (hash and displace perfect hashing).
+    //! Generated offline with the table below, whose names check_color_names
+    //! in test.cpp resolves.
+    constexpr uint8_t COLOR_SEEDS[COLOR_BUCKETS] = {
+        6, 61, 4, 2, 27, 11, 2, 1, 19, 24, 1, 63, 14, 44, 0, 21,
+        3, 108, 17, 3, 0, 6, 22, 6, 58, 2, 1, 2, 3, 15, 11, 60,
+        18, 1, 0, 1, 10, 114, 10, 185, 2, 10, 58, 5, 3, 26, 31, 6
+    };
+
+    //! The 147 SVG color keywords, by slot. "green" keeps the value it has
+    //! always had in this library, {0, 255, 0}, which CSS calls "lime".
+    constexpr NamedColor COLOR_NAMES[COLOR_SLOTS] = {
+        {"springgreen", {0, 255, 127}}, {"ghostwhite", {248, 248, 255}}, {"sienna", {160, 82, 45}},
+        {"brown", {165, 42, 42}}, {"gold", {255, 215, 0}}, {"midnightblue", {25, 25, 112}},
+        {"coral", {255, 127, 80}}, {"mediumseagreen", {60, 179, 113}}, {"", {0, 0, 0}},
+        {"palegreen", {152, 251, 152}}, {"lightgray", {211, 211, 211}}, {"lightsalmon", {255, 160, 122}},
+        {"indigo", {75, 0, 130}}, {"tomato", {255, 99, 71}}, {"salmon", {250, 128, 114}},
+        {"mediumaquamarine", {102, 205, 170}}, {"mediumslateblue", {123, 104, 238}}, {"oldlace", {253, 245, 230}},
+        {"deepskyblue", {0, 191, 255}}, {"goldenrod", {218, 165, 32}}, {"lightyellow", {255, 255, 224}},
+        {"orangered", {255, 69, 0}}, {"antiquewhite", {250, 235, 215}}, {"snow", {255, 250, 250}},
+        {"lawngreen", {124, 252, 0}}, {"saddlebrown", {139, 69, 19}}, {"floralwhite", {255, 250, 240}},
+        {"", {0, 0, 0}}, {"darkslategray", {47, 79, 79}}, {"greenyellow", {173, 255, 47}},
+        {"deeppink", {255, 20, 147}}, {"slategray", {112, 128, 144}}, {"", {0, 0, 0}},
+        {"yellow", {255, 255, 0}}, {"tan", {210, 180, 140}}, {"crimson", {220, 20, 60}},
+        {"orange", {255, 165, 0}}, {"mintcream", {245, 255, 250}}, {"lightcyan", {224, 255, 255}},
+        {"pink", {255, 192, 203}}, {"darkorchid", {153, 50, 204}}, {"yellowgreen", {154, 205, 50}},
+        {"mediumpurple", {147, 112, 219}}, {"cornsilk", {255, 248, 220}}, {"navy", {0, 0, 128}},
+        {"fuchsia", {255, 0, 255}}, {"mediumorchid", {186, 85, 211}}, {"bisque", {255, 228, 196}},
+        {"ivory", {255, 255, 240}}, {"green", {0, 255, 0}}, {"royalblue", {65, 105, 225}},
+        {"cyan", {0, 255, 255}}, {"firebrick", {178, 34, 34}}, {"gainsboro", {220, 220, 220}},
+        {"cornflowerblue", {100, 149, 237}}, {"lightcoral", {240, 128, 128}}, {"aliceblue", {240, 248, 255}},
+        {"lavender", {230, 230, 250}}, {"lightslategray", {119, 136, 153}}, {"darkgoldenrod", {184, 134, 11}},
+        {"olivedrab", {107, 142, 35}}, {"teal", {0, 128, 128}}, {"darkviolet", {148, 0, 211}},
+        {"moccasin", {255, 228, 181}}, {"white", {255, 255, 255}}, {"magenta", {255, 0, 255}},
+        {"lavenderblush", {255, 240, 245}}, {"darkblue", {0, 0, 139}}, {"beige", {245, 245, 220}},
+        {"palevioletred", {219, 112, 147}}, {"", {0, 0, 0}}, {"chartreuse", {127, 255, 0}},
+        {"", {0, 0, 0}}, {"darkturquoise", {0, 206, 209}}, {"darkred", {139, 0, 0}},
+        {"palegoldenrod", {238, 232, 170}}, {"dimgray", {105, 105, 105}}, {"mistyrose", {255, 228, 225}},
+        {"mediumspringgreen", {0, 250, 154}}, {"chocolate", {210, 105, 30}}, {"grey", {128, 128, 128}},
+        {"darkslategrey", {47, 79, 79}}, {"", {0, 0, 0}}, {"slategrey", {112, 128, 144}},
+        {"limegreen", {50, 205, 50}}, {"turquoise", {64, 224, 208}}, {"", {0, 0, 0}},
+        {"lime", {0, 255, 0}}, {"blanchedalmond", {255, 235, 205}}, {"peachpuff", {255, 218, 185}},
+        {"lightgrey", {211, 211, 211}}, {"cadetblue", {95, 158, 160}}, {"plum", {221, 160, 221}},
+        {"dodgerblue", {30, 144, 255}}, {"whitesmoke", {245, 245, 245}}, {"powderblue", {176, 224, 230}},
+        {"sandybrown", {244, 164, 96}}, {"purple", {128, 0, 128}}, {"azure", {240, 255, 255}},
+        {"skyblue", {135, 206, 235}}, {"slateblue", {106, 90, 205}}, {"navajowhite", {255, 222, 173}},
+        {"darkmagenta", {139, 0, 139}}, {"indianred", {205, 92, 92}}, {"", {0, 0, 0}},
+        {"wheat", {245, 222, 179}}, {"hotpink", {255, 105, 180}}, {"gray", {128, 128, 128}},
+        {"darkcyan", {0, 139, 139}}, {"darkseagreen", {143, 188, 143}}, {"steelblue", {70, 130, 180}},
+        {"khaki", {240, 230, 140}}, {"lemonchiffon", {255, 250, 205}}, {"thistle", {216, 191, 216}},
+        {"silver", {192, 192, 192}}, {"", {0, 0, 0}}, {"", {0, 0, 0}},
+        {"lightsteelblue", {176, 196, 222}}, {"black", {0, 0, 0}}, {"darkgray", {169, 169, 169}},
+        {"lightblue", {173, 216, 230}}, {"mediumblue", {0, 0, 205}}, {"aquamarine", {127, 255, 212}},
+        {"blueviolet", {138, 43, 226}}, {"linen", {250, 240, 230}}, {"paleturquoise", {175, 238, 238}},
+        {"honeydew", {240, 255, 240}}, {"violet", {238, 130, 238}}, {"rosybrown", {188, 143, 143}},
+        {"seashell", {255, 245, 238}}, {"seagreen", {46, 139, 87}}, {"lightgoldenrodyellow", {250, 250, 210}},
+        {"forestgreen", {34, 139, 34}}, {"", {0, 0, 0}}, {"darkolivegreen", {85, 107, 47}},
+        {"", {0, 0, 0}}, {"dimgrey", {105, 105, 105}}, {"olive", {128, 128, 0}},
+        {"lightskyblue", {135, 206, 250}}, {"blue", {0, 0, 255}}, {"lightpink", {255, 182, 193}},
+        {"red", {255, 0, 0}}, {"lightseagreen", {32, 178, 170}}, {"aqua", {0, 255, 255}},
+        {"mediumturquoise", {72, 209, 204}}, {"papayawhip", {255, 239, 213}}, {"burlywood", {222, 184, 135}},
+        {"", {0, 0, 0}}, {"lightgreen", {144, 238, 144}}, {"lightslategrey", {119, 136, 153}},
+        {"darkorange", {255, 140, 0}}, {"darkkhaki", {189, 183, 107}}, {"darkgrey", {169, 169, 169}},
+        {"darksalmon", {233, 150, 122}}, {"peru", {205, 133, 63}}, {"maroon", {128, 0, 0}},
+        {"darkslateblue", {72, 61, 139}}, {"darkgreen", {0, 100, 0}}, {"mediumvioletred", {199, 21, 133}},
+        {"orchid", {218, 112, 214}}
+    };
+
+    //! FNV-1a hash of a name, ignoring the case of ASCII letters.
+    //! @param name Name.
+    //! @param length Length of the name.
+    //! @param seed Seed.
+    //! @return Hash.
+    static uint32_t hash_name(const char *name, size_t length, uint32_t seed)
+    {
+        uint32_t h = 2166136261u ^ seed;
+        for (size_t i = 0; i < length; i++)
+        {
+            h = (h ^ (unsigned char)(name[i] | 0x20)) * 16777619u;
+        }
+        return h;
+    }
+
+    //! Look up a color name.
+    //! @param name Name.
+    //! @param length Length of the name.
+    //! @param c Color found.
+    //! @return true if the name is a color keyword.
+    static bool find_color_name(const char *name, size_t length, Color &c)
+    {
+        uint32_t seed = COLOR_SEEDS[hash_name(name, length, 0) % COLOR_BUCKETS];
+        const NamedColor &entry = COLOR_NAMES[hash_name(name, length, seed) % COLOR_SLOTS];
+        if (std::strlen(entry.name) != length)
+        {
+            return false;
+        }
+        // The names are lowercase; setting bit 5 lowercases ASCII letters and
+        // can't turn any other character into a lowercase letter.
+        for (size_t i = 0; i < length; i++)
+        {
+            if ((name[i] | 0x20) != entry.name[i])
+            {
+                return false;
+            }
+        }
+        c = entry.color;
+        return true;
+    }
+
+    //! Value of a hexadecimal digit.
+    //! @param d Character.
+    //! @param valid Cleared if the character isn't a hexadecimal digit.
+    //! @return Value of the digit.
+    static int hex_digit(char d, bool &valid)
+    {
+        int lower = d | 0x20;
+        bool digit = d >= '0' && d <= '9';
+        bool letter = lower >= 'a' && lower <= 'f';
+        valid = valid && (digit || letter);
+        // '0'-'9' are 0x30-0x39 and 'a'-'f' are 0x61-0x66.
+        return (d & 0xF) + 9 * (lower >> 6);
+    }
+
+    //! Parse '#rgb' or '#rrggbb', without the '#'.
+    //! @param s Digits.
+    //! @param length Number of digits.
+    //! @param c Color found.
+    //! @return true if the digits are valid.
+    static bool parse_hex_color(const char *s, size_t length, Color &c)
+    {
+        bool valid = true;
+        if (length == 6)
+        {
+            c.red = (rgb_value)(hex_digit(s[0], valid) << 4 | hex_digit(s[1], valid));
+            c.green = (rgb_value)(hex_digit(s[2], valid) << 4 | hex_digit(s[3], valid));
+            c.blue = (rgb_value)(hex_digit(s[4], valid) << 4 | hex_digit(s[5], valid));
+            return valid;
+        }
+        if (length == 3)
+        {
+            // Each digit is repeated: #abc is #aabbcc.
+            c.red = (rgb_value)(hex_digit(s[0], valid) * 0x11);
+            c.green = (rgb_value)(hex_digit(s[1], valid) * 0x11);
+            c.blue = (rgb_value)(hex_digit(s[2], valid) * 0x11);
+            return valid;
+        }
+        return false;
+    }
+
+    //! Skip spaces.
+    static void skip_spaces(const char *&s, const char *end)
+    {
+        while (s < end && (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r'))
+        {
+            s++;
+        }
+    }
+
+    //! Parse a component of rgb(): an integer from 0 to 255, or a percentage.
+    //! Values out of range are clamped.
+    //! @param s Position, moved past the component.
+    //! @param end End of the string.
+    //! @param value Component.
+    //! @return true if a component was read.
+    static bool parse_rgb_component(const char *&s, const char *end, rgb_value &value)
+    {
+        bool negative = s < end && *s == '-';
+        if (s < end && (*s == '-' || *s == '+'))
+        {
+            s++;
+        }
+        const char *start = s;
+        long integer = 0;
+        for (; s < end && *s >= '0' && *s <= '9'; s++)
+        {
+            integer = integer < 100000 ? integer * 10 + (*s - '0') : integer;
+        }
+        double fraction = 0;
+        if (s < end && *s == '.')
+        {
+            double scale = 0.1;
+            for (s++; s < end && *s >= '0' && *s <= '9'; s++, scale /= 10)
+            {
+                fraction += (*s - '0') * scale;
+            }
+        }
+        if (s == start || (s == start + 1 && *start == '.'))
+        {
+            return false;
+        }
+        double v = integer + fraction;
+        if (s < end && *s == '%')
+        {
+            s++;
+            v = v * 255 / 100;
+        }
+        v = negative ? 0 : (v > 255 ? 255 : v);
+        value = (rgb_value)(v + 0.5);
+        return true;
+    }
+
+    //! Parse 'rgb(r, g, b)' arguments, after the '('.
+    //! @param s Arguments.
+    //! @param end End of the string.
+    //! @param c Color found.
+    //! @return true if the arguments are valid.
+    static bool parse_rgb_color(const char *s, const char *end, Color &c)
     {
-        Color c;
-        if (str.at(0) == '#')
+        rgb_value *components[] = {&c.red, &c.green, &c.blue};
+        for (int i = 0; i < 3; i++)
         {
-            int v;
-            std::istringstream ss(str.substr(1));
-            ss >> std::hex >> v;
-            c.red = (v >> 16);
-            c.green = (v >> 8) & 0xFF;
-            c.blue = v & 0xFF;
+            skip_spaces(s, end);
+            if (!parse_rgb_component(s, end, *components[i]))
+            {
+                return false;
+            }
+            skip_spaces(s, end);
+            if (i < 2)
+            {
+                if (s == end || *s != ',')
+                {
+                    return false;
+                }
+                s++;
+            }
+        }
+        return s + 1 == end && *s == ')';
+    }
+
+    Color parse_color(const char *str)
+    {
+        if (str == nullptr)
+        {
+            throw std::invalid_argument("Missing color");
+        }
+        const char *begin = str;
+        const char *end = str + std::strlen(str);
+        skip_spaces(begin, end);
+        while (end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+        {
+            end--;
+        }
+        Color c = {0, 0, 0};
+        bool valid;
+        if (begin < end && *begin == '#')
+        {
+            valid = parse_hex_color(begin + 1, end - begin - 1, c);
+        }
+        else if (end - begin >= 4 && std::strncmp(begin, "rgb(", 4) == 0)
+        {
+            valid = parse_rgb_color(begin + 4, end, c);
         }
         else
         {
-            c = NAMES_TO_COLORS.at(str);
+            valid = find_color_name(begin, end - begin, c);
+        }
+        if (!valid)
+        {
+            throw std::invalid_argument("Invalid color: " + std::string(str));
         }
         return c;
     }
-}
\ No newline at end of file
+
+    Color parse_color(const std::string &str)
+    {
+        return parse_color(str.c_str());
+    }
+}
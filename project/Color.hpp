@@ -18,12 +18,21 @@ namespace svg {
   };
 
   //! Parse a color from a string.
-  //! The string may refer to a color name or have a
-  //! '#rrggbb' format where 'rr', 'gg' and 'bb' 
-  //! are hexadecimal values for each RGB component. 
+  //! The string may refer to one of the 147 SVG color names
+  //! (in any case), have a '#rrggbb' or '#rgb' format where 'rr', 'gg'
+  //! and 'bb' (or 'r', 'g' and 'b') are hexadecimal values for each 
+  //! RGB component, or be 'rgb(r, g, b)' with each component given 
+  //! as an integer from 0 to 255 or as a percentage.
+  //! Throws std::invalid_argument for other strings.
   //! @param str String.
   //! @return A corresponding color.
   Color parse_color(const std::string& str);
+
+  //! Parse a color from a C string, as parse_color(const std::string&) does,
+  //! without allocating memory.
+  //! @param str String; nullptr is rejected like an invalid color.
+  //! @return A corresponding color.
+  Color parse_color(const char* str);
   
 }
 #endif
\ No newline at end of file
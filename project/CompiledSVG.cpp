@@ -0,0 +1,119 @@
+#include "CompiledSVG.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+namespace svg
+{
+    // The commands and points are written and mapped as they are in memory.
+    static_assert(std::is_trivially_copyable<DrawCommand>::value, "DrawCommand is saved as raw bytes");
+    static_assert(std::is_trivially_copyable<Point>::value, "Point is saved as raw bytes");
+    static_assert(sizeof(DrawCommand) == 28 && sizeof(Point) == 8 && sizeof(CompiledSVG::Header) == 28,
+                  "layout change: increase COMPILED_SVG_VERSION and update these sizes");
+    static_assert(sizeof(CompiledSVG::Header) % alignof(DrawCommand) == 0 &&
+                  sizeof(DrawCommand) % alignof(Point) == 0,
+                  "mapped commands and points must be aligned");
+
+    //! Byte order mark of the header.
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    void CompiledSVG::save(const std::string &file_name, const Point &dimensions, const DisplayList &list)
+    {
+        const std::vector<DrawCommand> &commands = list.commands();
+        const std::vector<Point> &points = list.points();
+        Header header;
+        std::memcpy(header.magic, COMPILED_SVG_MAGIC, sizeof(header.magic));
+        header.version = COMPILED_SVG_VERSION;
+        header.byte_order = BYTE_ORDER_MARK;
+        header.width = dimensions.x;
+        header.height = dimensions.y;
+        header.command_count = (uint32_t)commands.size();
+        header.point_count = (uint32_t)points.size();
+        FILE *file = std::fopen(file_name.c_str(), "wb");
+        if (file == nullptr)
+        {
+            throw std::runtime_error("Unable to write " + file_name);
+        }
+        // The data of empty vectors may be null, which fwrite doesn't accept.
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && (commands.empty() ||
+                    std::fwrite(commands.data(), sizeof(DrawCommand), commands.size(), file) == commands.size());
+        ok = ok && (points.empty() || std::fwrite(points.data(), sizeof(Point), points.size(), file) == points.size());
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok)
+        {
+            throw std::runtime_error("Unable to write " + file_name);
+        }
+    }
+
+    bool CompiledSVG::is_compiled(const std::string &file_name)
+    {
+        char magic[sizeof(COMPILED_SVG_MAGIC)];
+        FILE *file = std::fopen(file_name.c_str(), "rb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        bool compiled = std::fread(magic, sizeof(magic), 1, file) == 1 &&
+                        std::memcmp(magic, COMPILED_SVG_MAGIC, sizeof(magic)) == 0;
+        std::fclose(file);
+        return compiled;
+    }
+
+    CompiledSVG::CompiledSVG(const std::string &file_name)
+        : file_(file_name), commands_(nullptr), command_count_(0), points_(nullptr)
+    {
+        const std::string error = "Invalid compiled SVG file " + file_name;
+        if (file_.size() < sizeof(Header))
+        {
+            throw std::runtime_error(error);
+        }
+        Header header;
+        std::memcpy(&header, file_.data(), sizeof(header));
+        if (std::memcmp(header.magic, COMPILED_SVG_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != COMPILED_SVG_VERSION || header.byte_order != BYTE_ORDER_MARK ||
+            header.width <= 0 || header.height <= 0)
+        {
+            throw std::runtime_error(error);
+        }
+        uint64_t size = sizeof(Header) + (uint64_t)header.command_count * sizeof(DrawCommand) +
+                        (uint64_t)header.point_count * sizeof(Point);
+        if (size != file_.size())
+        {
+            throw std::runtime_error(error);
+        }
+        dimensions_ = {header.width, header.height};
+        commands_ = (const DrawCommand *)(file_.data() + sizeof(Header));
+        command_count_ = header.command_count;
+        points_ = (const Point *)(commands_ + command_count_);
+        // Commands must only reference points of the file.
+        for (size_t i = 0; i < command_count_; i++)
+        {
+            const DrawCommand &cmd = commands_[i];
+            if (cmd.type > DRAW_ELLIPSE || cmd.first > header.point_count ||
+                cmd.count > header.point_count - cmd.first || (cmd.type == DRAW_ELLIPSE && cmd.count != 2))
+            {
+                throw std::runtime_error(error);
+            }
+            palette_.add(cmd.color);
+        }
+    }
+
+    void CompiledSVG::draw(PNGImage &img) const
+    {
+        draw_commands(img, commands_, command_count_, points_);
+    }
+
+    void CompiledSVG::draw(PNGImage &img, ThreadPool &pool) const
+    {
+        draw_commands_tiled(img, commands_, command_count_, points_, pool);
+    }
+
+    void CompiledSVG::draw_banded(int band_rows, ThreadPool *pool,
+                                  const std::function<void(const PNGImage &)> &band_done) const
+    {
+        draw_commands_banded(dimensions_, band_rows, commands_, command_count_, points_, pool, band_done);
+    }
+}
@@ -0,0 +1,112 @@
+//! @file CompiledSVG.hpp
+#ifndef __svg_CompiledSVG_hpp__
+#define __svg_CompiledSVG_hpp__
+
+#include "DisplayList.hpp"
+#include "MappedFile.hpp"
+#include "PNGImage.hpp"
+#include "Point.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace svg
+{
+    //! Display list of a SVG file saved in a binary file ("compiled SVG"),
+    //! with transforms applied and <use> references resolved. Loading maps
+    //! the file and draws from the mapped commands and points, without parsing.
+    //!
+    //! The file holds a header (CompiledSVG::Header), then the commands as
+    //! DrawCommand structures, then the points as Point structures, in the
+    //! byte order of the machine that wrote it.
+    class CompiledSVG
+    {
+    public:
+        //! Header of compiled SVG files.
+        struct Header
+        {
+            //! COMPILED_SVG_MAGIC.
+            char magic[4];
+            //! COMPILED_SVG_VERSION.
+            uint32_t version;
+            //! 0x01020304, as written by the machine that saved the file.
+            uint32_t byte_order;
+            //! Image width.
+            int32_t width;
+            //! Image height.
+            int32_t height;
+            //! Number of commands.
+            uint32_t command_count;
+            //! Number of points.
+            uint32_t point_count;
+        };
+
+        //! Save a display list.
+        //! Throws std::runtime_error if the file can't be written.
+        //! @param file_name Name of the file.
+        //! @param dimensions Image width and height.
+        //! @param list Display list.
+        static void save(const std::string &file_name, const Point &dimensions, const DisplayList &list);
+        //! Check if a file is a compiled SVG file, from its first bytes.
+        //! @param file_name Name of the file.
+        //! @return true if the file starts with COMPILED_SVG_MAGIC.
+        static bool is_compiled(const std::string &file_name);
+
+        //! Constructor. Maps a compiled SVG file and checks that it is valid.
+        //! Throws std::runtime_error for invalid files.
+        //! @param file_name Name of the file.
+        explicit CompiledSVG(const std::string &file_name);
+        //! Get the image dimensions.
+        //! @return Image width and height.
+        Point dimensions() const { return dimensions_; }
+        //! Get the colors of the commands.
+        //! @return Palette of the command colors (which overflows past 256 colors).
+        const Palette &palette() const { return palette_; }
+        //! Get the commands.
+        //! @return Commands, in the mapped file.
+        const DrawCommand *commands() const { return commands_; }
+        //! Get the number of commands.
+        //! @return Number of commands.
+        size_t command_count() const { return command_count_; }
+        //! Get the point pool.
+        //! @return Points referenced by the commands, in the mapped file.
+        const Point *points() const { return points_; }
+        //! Draw the display list on an image.
+        //! @param img Destination image.
+        void draw(PNGImage &img) const;
+        //! Draw the display list on an image, splitting it in tiles drawn concurrently.
+        //! @param img Destination image.
+        //! @param pool Threads drawing the tiles.
+        void draw(PNGImage &img, ThreadPool &pool) const;
+        //! Draw the display list one band of rows at a time (see draw_commands_banded).
+        //! @param band_rows Number of rows of a band.
+        //! @param pool Threads drawing the tiles of each band, or nullptr.
+        //! @param band_done Function called with the band image once each band is drawn.
+        void draw_banded(int band_rows, ThreadPool *pool,
+                         const std::function<void(const PNGImage &)> &band_done) const;
+
+    private:
+        //! Mapped file.
+        MappedFile file_;
+        //! Image width and height.
+        Point dimensions_;
+        //! Commands, in the mapped file.
+        const DrawCommand *commands_;
+        //! Number of commands.
+        size_t command_count_;
+        //! Points, in the mapped file.
+        const Point *points_;
+        //! Colors of the commands.
+        Palette palette_;
+    };
+
+    //! First bytes of compiled SVG files.
+    const char COMPILED_SVG_MAGIC[4] = {'S', 'V', 'G', 'C'};
+    //! Version of the compiled SVG format, increased when the layout of the
+    //! header, DrawCommand or Point changes.
+    const uint32_t COMPILED_SVG_VERSION = 1;
+}
+#endif
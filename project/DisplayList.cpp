@@ -0,0 +1,208 @@
+#include "DisplayList.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace svg
+{
+    //! Side of the square tiles used by draw_commands_tiled.
+    const int TILE_SIZE = 128;
+
+    void DisplayList::add(DrawCommandType type, const Point *points, size_t count, const Color &color,
+                          const Transform &transform)
+    {
+        DrawCommand cmd;
+        cmd.type = (uint8_t)type;
+        cmd.color = color;
+        cmd.first = (uint32_t)points_.size();
+        cmd.count = (uint32_t)count;
+        if (transform.is_identity())
+        {
+            points_.insert(points_.end(), points, points + count);
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                points_.push_back(transform.apply(points[i]));
+            }
+        }
+        const Point *p = points_.data() + cmd.first;
+        if (type == DRAW_ELLIPSE)
+        {
+            // The bounds are clamped to the int range, like the coordinates.
+            double extent_x = std::fabs((double)p[1].x), extent_y = std::fabs((double)p[1].y);
+            cmd.min = {to_coordinate(p[0].x - extent_x), to_coordinate(p[0].y - extent_y)};
+            cmd.max = {to_coordinate(p[0].x + extent_x), to_coordinate(p[0].y + extent_y)};
+        }
+        else
+        {
+            cmd.min = {INT_MAX, INT_MAX};
+            cmd.max = {INT_MIN, INT_MIN};
+            for (size_t i = 0; i < count; i++)
+            {
+                cmd.min.x = std::min(cmd.min.x, p[i].x);
+                cmd.min.y = std::min(cmd.min.y, p[i].y);
+                cmd.max.x = std::max(cmd.max.x, p[i].x);
+                cmd.max.y = std::max(cmd.max.y, p[i].y);
+            }
+        }
+        commands_.push_back(cmd);
+        palette_.add(color);
+    }
+
+    void DisplayList::clear()
+    {
+        commands_.clear();
+        points_.clear();
+        palette_.clear();
+    }
+
+    void DisplayList::draw(PNGImage &img) const
+    {
+        draw_commands(img, commands_.data(), commands_.size(), points_.data());
+    }
+
+    void DisplayList::draw(PNGImage &img, ThreadPool &pool) const
+    {
+        draw_commands_tiled(img, commands_.data(), commands_.size(), points_.data(), pool);
+    }
+
+    void DisplayList::draw_banded(const Point &dimensions, int band_rows, ThreadPool *pool,
+                                  const std::function<void(const PNGImage &)> &band_done) const
+    {
+        draw_commands_banded(dimensions, band_rows, commands_.data(), commands_.size(), points_.data(),
+                             pool, band_done);
+    }
+
+    void draw_commands(PNGImage &img, const DrawCommand *commands, size_t count,
+                       const Point *points)
+    {
+        for (const DrawCommand *cmd = commands; cmd != commands + count; cmd++)
+        {
+            if (!img.is_visible(cmd->min, cmd->max))
+            {
+                continue;
+            }
+            const Point *p = points + cmd->first;
+            switch (cmd->type)
+            {
+            case DRAW_POLYLINE:
+                for (uint32_t i = 1; i < cmd->count; i++)
+                {
+                    img.draw_line(p[i - 1], p[i], cmd->color);
+                }
+                break;
+            case DRAW_POLYGON:
+                img.draw_polygon(p, cmd->count, cmd->color);
+                break;
+            case DRAW_ELLIPSE:
+                img.draw_ellipse(p[0], p[1], cmd->color);
+                break;
+            }
+        }
+    }
+
+    //! Draw commands on some rows of an image, in tiles drawn concurrently.
+    //! @param img Destination image.
+    //! @param first_row First row to draw.
+    //! @param end_row Row after the last row to draw.
+    //! @param commands Commands.
+    //! @param indices Indices of the commands to draw, or nullptr for all of them.
+    //! @param count Number of commands to draw.
+    //! @param points Point pool.
+    //! @param pool Threads drawing the tiles.
+    static void draw_tiled(PNGImage &img, int first_row, int end_row, const DrawCommand *commands,
+                           const uint32_t *indices, size_t count, const Point *points, ThreadPool &pool)
+    {
+        int tiles_x = (img.width() + TILE_SIZE - 1) / TILE_SIZE;
+        int tiles_y = (end_row - first_row + TILE_SIZE - 1) / TILE_SIZE;
+        // Bin commands into the tiles their bounding box touches, in order.
+        std::vector<std::vector<uint32_t>> tiles(tiles_x * tiles_y);
+        for (size_t k = 0; k < count; k++)
+        {
+            uint32_t i = indices != nullptr ? indices[k] : (uint32_t)k;
+            const DrawCommand &cmd = commands[i];
+            if (!img.is_visible(cmd.min, cmd.max))
+            {
+                continue;
+            }
+            int tx_min = std::max(cmd.min.x, 0) / TILE_SIZE;
+            int tx_max = std::min(cmd.max.x, img.width() - 1) / TILE_SIZE;
+            int ty_min = (std::max(cmd.min.y, first_row) - first_row) / TILE_SIZE;
+            int ty_max = (std::min(cmd.max.y, end_row - 1) - first_row) / TILE_SIZE;
+            for (int ty = ty_min; ty <= ty_max; ty++)
+            {
+                for (int tx = tx_min; tx <= tx_max; tx++)
+                {
+                    tiles[ty * tiles_x + tx].push_back(i);
+                }
+            }
+        }
+        pool.run(tiles.size(), [&](size_t tile, int)
+        {
+            Point tile_min = {(int)(tile % tiles_x) * TILE_SIZE,
+                              first_row + (int)(tile / tiles_x) * TILE_SIZE};
+            PNGImage view(img, tile_min, tile_min.translate({TILE_SIZE - 1, TILE_SIZE - 1}));
+            for (uint32_t i : tiles[tile])
+            {
+                draw_commands(view, commands + i, 1, points);
+            }
+        });
+    }
+
+    void draw_commands_tiled(PNGImage &img, const DrawCommand *commands, size_t count,
+                             const Point *points, ThreadPool &pool)
+    {
+        draw_tiled(img, 0, img.height(), commands, nullptr, count, points, pool);
+    }
+
+    void draw_commands_banded(const Point &dimensions, int band_rows, const DrawCommand *commands,
+                              size_t count, const Point *points, ThreadPool *pool,
+                              const std::function<void(const PNGImage &)> &band_done)
+    {
+        int width = dimensions.x, height = dimensions.y;
+        int band_count = (height + band_rows - 1) / band_rows;
+        std::vector<std::vector<uint32_t>> bands(band_count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const DrawCommand &cmd = commands[i];
+            if (cmd.min.x > cmd.max.x || cmd.min.y > cmd.max.y || cmd.max.x < 0 || cmd.min.x >= width ||
+                cmd.max.y < 0 || cmd.min.y >= height)
+            {
+                continue;
+            }
+            int last = std::min(cmd.max.y, height - 1) / band_rows;
+            for (int b = std::max(cmd.min.y, 0) / band_rows; b <= last; b++)
+            {
+                bands[b].push_back((uint32_t)i);
+            }
+        }
+        PNGImage img(width, height, band_rows);
+        for (int b = 0; b < band_count; b++)
+        {
+            int first_row = b * band_rows;
+            if (b > 0)
+            {
+                img.set_band(first_row);
+            }
+            const std::vector<uint32_t> &band = bands[b];
+            if (pool != nullptr)
+            {
+                draw_tiled(img, first_row, std::min(first_row + band_rows, height), commands,
+                           band.data(), band.size(), points, *pool);
+            }
+            else
+            {
+                for (uint32_t i : band)
+                {
+                    draw_commands(img, commands + i, 1, points);
+                }
+            }
+            band_done(img);
+            // The band is done: free its bin now.
+            std::vector<uint32_t>().swap(bands[b]);
+        }
+    }
+}
@@ -0,0 +1,130 @@
+//! @file DisplayList.hpp
+#ifndef __svg_DisplayList_hpp__
+#define __svg_DisplayList_hpp__
+
+#include "Color.hpp"
+#include "Palette.hpp"
+#include "Point.hpp"
+#include "PNGImage.hpp"
+#include "ThreadPool.hpp"
+#include "Transform.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace svg
+{
+    //! Kinds of draw commands.
+    enum DrawCommandType
+    {
+        //! Lines joining consecutive points.
+        DRAW_POLYLINE = 0,
+        //! Filled polygon.
+        DRAW_POLYGON = 1,
+        //! Filled ellipse, given by its center and radius points.
+        DRAW_ELLIPSE = 2
+    };
+
+    //! Draw command of a display list.
+    struct DrawCommand
+    {
+        //! Command type (a DrawCommandType value).
+        uint8_t type;
+        //! Color.
+        Color color;
+        //! Index of the first point of the command in the point pool.
+        uint32_t first;
+        //! Number of points of the command.
+        uint32_t count;
+        //! Top-left corner of the bounding box.
+        Point min;
+        //! Bottom-right corner of the bounding box (inclusive).
+        Point max;
+    };
+
+    //! Flat list of draw commands, sharing one pool of points.
+    //! Drawing a display list gives the same image as drawing the
+    //! elements it was compiled from.
+    class DisplayList
+    {
+    public:
+        //! Append a command.
+        //! @param type Command type.
+        //! @param points Points of the command.
+        //! @param count Number of points.
+        //! @param color Command color.
+        //! @param transform Transform applied to the points as they are stored.
+        void add(DrawCommandType type, const Point *points, size_t count, const Color &color,
+                 const Transform &transform = Transform());
+        //! Remove all commands.
+        void clear();
+        //! Get the commands.
+        //! @return The commands, in drawing order.
+        const std::vector<DrawCommand> &commands() const { return commands_; }
+        //! Get the point pool.
+        //! @return Points referenced by the commands.
+        const std::vector<Point> &points() const { return points_; }
+        //! Get the colors of the commands.
+        //! @return Palette of the command colors (which overflows past 256 colors).
+        const Palette &palette() const { return palette_; }
+        //! Draw all commands on an image.
+        //! @param img Destination image.
+        void draw(PNGImage &img) const;
+        //! Draw all commands on an image, splitting it in tiles drawn concurrently.
+        //! @param img Destination image.
+        //! @param pool Threads drawing the tiles.
+        void draw(PNGImage &img, ThreadPool &pool) const;
+        //! Draw all commands one band of rows at a time (see draw_commands_banded).
+        //! @param dimensions Image width and height.
+        //! @param band_rows Number of rows of a band.
+        //! @param pool Threads drawing the tiles of each band, or nullptr.
+        //! @param band_done Function called with the band image once each band is drawn.
+        void draw_banded(const Point &dimensions, int band_rows, ThreadPool *pool,
+                         const std::function<void(const PNGImage &)> &band_done) const;
+
+    private:
+        //! Commands.
+        std::vector<DrawCommand> commands_;
+        //! Point pool.
+        std::vector<Point> points_;
+        //! Colors of the commands.
+        Palette palette_;
+    };
+
+    //! Draw a sequence of commands on an image.
+    //! @param img Destination image.
+    //! @param commands Commands.
+    //! @param count Number of commands.
+    //! @param points Point pool.
+    void draw_commands(PNGImage &img, const DrawCommand *commands, size_t count,
+                       const Point *points);
+
+    //! Draw a sequence of commands on an image, splitting it in tiles.
+    //! Each tile draws the commands touching it in order, clipped to the
+    //! tile, so the result is the same as with draw_commands.
+    //! @param img Destination image.
+    //! @param commands Commands.
+    //! @param count Number of commands.
+    //! @param points Point pool.
+    //! @param pool Threads drawing the tiles.
+    void draw_commands_tiled(PNGImage &img, const DrawCommand *commands, size_t count,
+                             const Point *points, ThreadPool &pool);
+
+    //! Draw a sequence of commands one band of rows at a time, from top
+    //! to bottom, reusing a single band image (see PNGImage(int, int, int)).
+    //! Commands are first binned into the bands their bounding box touches,
+    //! so each band only draws the commands touching it, clipped to the band.
+    //! @param dimensions Image width and height.
+    //! @param band_rows Number of rows of a band.
+    //! @param commands Commands.
+    //! @param count Number of commands.
+    //! @param points Point pool.
+    //! @param pool Threads drawing the tiles of each band, or nullptr to draw bands serially.
+    //! @param band_done Function called with the band image once each band is drawn.
+    void draw_commands_banded(const Point &dimensions, int band_rows, const DrawCommand *commands,
+                              size_t count, const Point *points, ThreadPool *pool,
+                              const std::function<void(const PNGImage &)> &band_done);
+}
+#endif
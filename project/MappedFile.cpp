@@ -0,0 +1,48 @@
+#include "MappedFile.hpp"
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace svg
+{
+    MappedFile::MappedFile(const std::string &file_name) : data_(""), size_(0)
+    {
+        int fd = ::open(file_name.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Unable to load " + file_name);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Unable to load " + file_name);
+        }
+        size_ = (size_t)st.st_size;
+        if (size_ > 0)
+        {
+            void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("Unable to load " + file_name);
+            }
+            // Files are parsed from start to end.
+            ::madvise(p, size_, MADV_SEQUENTIAL);
+            data_ = (const char *)p;
+        }
+        // The mapping stays valid after the file is closed.
+        ::close(fd);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (size_ > 0)
+        {
+            ::munmap((void *)data_, size_);
+        }
+    }
+}
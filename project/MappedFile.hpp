@@ -0,0 +1,35 @@
+//! @file MappedFile.hpp
+#ifndef __svg_MappedFile_hpp__
+#define __svg_MappedFile_hpp__
+
+#include <cstddef>
+#include <string>
+
+namespace svg
+{
+    //! Read-only memory mapping of a whole file.
+    class MappedFile
+    {
+    public:
+        //! Constructor. Throws std::runtime_error if the file can't be mapped.
+        //! @param file_name Name of the file.
+        explicit MappedFile(const std::string &file_name);
+        //! Destructor. Unmaps the file.
+        ~MappedFile();
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        //! Get the contents of the file.
+        //! @return Mapped bytes, not followed by a '\0' (never nullptr, even for an empty file).
+        const char *data() const { return data_; }
+        //! Get the size of the file.
+        //! @return Size in bytes.
+        size_t size() const { return size_; }
+
+    private:
+        //! Mapped bytes.
+        const char *data_;
+        //! Size of the mapping.
+        size_t size_;
+    };
+}
+#endif
@@ -2,15 +2,17 @@
 
 #include <stdexcept>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstdint>
+#include <new>
 
 #define STBI_ONLY_PNG
 #define STB_IMAGE_IMPLEMENTATION
 #include "external/stb/stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "external/stb/stb_image_write.h"
 
 namespace svg
 {
@@ -24,29 +26,93 @@ namespace svg
         {
             throw std::runtime_error(png_file_name + ": could not load image!");
         }
+        owns_pixels_ = true;
+        capacity_ = (size_t)width_ * (size_t)height_;
+        first_row_ = 0;
+        rows_ = height_;
+        clip_min_ = {0, 0};
+        clip_max_ = {width_ - 1, height_ - 1};
     }
-    PNGImage::PNGImage(int w, int h)
+    PNGImage::PNGImage(int w, int h) : PNGImage(w, h, h)
     {
-        assert(w > 0 && h > 0);
-        size_t sz = w * h * sizeof(Color);
+    }
+    PNGImage::PNGImage(int w, int h, int rows)
+    {
+        assert(w > 0 && h > 0 && rows > 0);
+        rows = std::min(rows, h);
+        // Widen before multiplying: large images overflow int.
+        size_t sz = (size_t)w * (size_t)rows * sizeof(Color);
         pixels_ = (Color *)::stbi__malloc(sz);
+        if (pixels_ == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        width_ = w;
+        height_ = h;
+        owns_pixels_ = true;
+        capacity_ = (size_t)w * (size_t)rows;
+        rows_ = rows;
+        set_band(0);
+    }
+    PNGImage::PNGImage(PNGImage &target, const Point &clip_min, const Point &clip_max)
+        : width_(target.width_), height_(target.height_),
+          pixels_(target.pixels_), owns_pixels_(false), capacity_(0),
+          first_row_(target.first_row_), rows_(target.rows_)
+    {
+        clip_min_ = {std::max(clip_min.x, target.clip_min_.x),
+                     std::max(clip_min.y, target.clip_min_.y)};
+        clip_max_ = {std::min(clip_max.x, target.clip_max_.x),
+                     std::min(clip_max.y, target.clip_max_.y)};
+    }
+    void PNGImage::reset(int w, int h)
+    {
+        assert(owns_pixels_ && w > 0 && h > 0);
+        size_t pixels = (size_t)w * (size_t)h;
+        if (pixels > capacity_)
+        {
+            Color *grown = (Color *)::stbi__malloc(pixels * sizeof(Color));
+            if (grown == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            stbi_image_free(pixels_);
+            pixels_ = grown;
+            capacity_ = pixels;
+        }
         width_ = w;
         height_ = h;
-        ::memset(pixels_, 0xFF, sz);
+        rows_ = h;
+        set_band(0);
+    }
+    void PNGImage::set_band(int first_row)
+    {
+        assert(owns_pixels_ && first_row >= 0 && first_row < height_);
+        first_row_ = first_row;
+        clip_min_ = {0, first_row};
+        clip_max_ = {width_ - 1, std::min(first_row + rows_, height_) - 1};
+        ::memset(pixels_, 0xFF, (size_t)width_ * rows_ * sizeof(Color));
+    }
+    void PNGImage::write(PNGWriter &writer) const
+    {
+        writer.write_rows(row(first_row_), std::min(rows_, height_ - first_row_));
     }
-    void PNGImage::save(const std::string &png_file_name) const
+    void PNGImage::save(const std::string &png_file_name, const PNGOptions &options, ThreadPool *pool,
+                        const Palette *palette) const
     {
-        ::stbi_write_png(png_file_name.c_str(),
-                         width_,
-                         height_,
-                         3,
-                         pixels_,
-                         width_ * 3);
+        if (rows_ != height_)
+        {
+            throw std::logic_error("Band images can't be saved");
+        }
+        write_png_file(png_file_name, width_, height_, options, pool, palette,
+                       [this](PNGWriter &writer) { write(writer); });
     }
 
     PNGImage::~PNGImage()
     {
-        stbi_image_free(pixels_);
+        if (owns_pixels_)
+        {
+            stbi_image_free(pixels_);
+        }
     }
 
     int PNGImage::width() const
@@ -57,27 +123,84 @@ namespace svg
     {
         return height_;
     }
+    Color *PNGImage::row(int y) const
+    {
+        return pixels_ + (size_t)(y - first_row_) * width_;
+    }
     Color &PNGImage::at(int x, int y)
     {
         assert(x >= 0 && x < width_);
-        assert(y >= 0 && y < height_);
-        return pixels_[y * width_ + x];
+        assert(y >= first_row_ && y < first_row_ + rows_ && y < height_);
+        return row(y)[x];
     }
     Color PNGImage::at(int x, int y) const
     {
         assert(x >= 0 && x < width_);
-        assert(y >= 0 && y < height_);
-        return pixels_[y * width_ + x];
+        assert(y >= first_row_ && y < first_row_ + rows_ && y < height_);
+        return row(y)[x];
+    }
+    //! Outcode bits.
+    enum
+    {
+        CLIP_LEFT = 1,
+        CLIP_RIGHT = 2,
+        CLIP_TOP = 4,
+        CLIP_BOTTOM = 8
+    };
+
+    int PNGImage::outcode(const Point &p) const
+    {
+        int code = 0;
+        if (p.x < clip_min_.x)
+            code |= CLIP_LEFT;
+        else if (p.x > clip_max_.x)
+            code |= CLIP_RIGHT;
+        if (p.y < clip_min_.y)
+            code |= CLIP_TOP;
+        else if (p.y > clip_max_.y)
+            code |= CLIP_BOTTOM;
+        return code;
+    }
+
+    bool PNGImage::is_visible(const Point &min, const Point &max) const
+    {
+        return min.x <= clip_max_.x && max.x >= clip_min_.x &&
+               min.y <= clip_max_.y && max.y >= clip_min_.y &&
+               min.x <= max.x && min.y <= max.y;
     }
+
+    //! 128-bit integer, for the products of coordinates that overflow 64 bits
+    //! near the int range: the fixed-point terms of lines and polygon edges,
+    //! which multiply two coordinates by a difference of coordinates, and the
+    //! error terms of ellipses, which hold products of four coordinates.
+    __extension__ typedef __int128 wide_int;
+
+    static wide_int floor_div(wide_int a, wide_int b)
+    {
+        wide_int d = a / b;
+        return (a % b != 0 && (a < 0) != (b < 0)) ? d - 1 : d;
+    }
+
+    static wide_int ceil_div(wide_int a, wide_int b)
+    {
+        return -floor_div(-a, b);
+    }
+
     void PNGImage::draw_line(const Point &a, const Point &b, const Color &c)
     {
-        //  Bresenham Algorithm.
-        int x_from = a.x;
-        int y_from = a.y;
-        int x_to = b.x;
-        int y_to = b.y;
-        int dy = y_to - y_from;
-        int dx = x_to - x_from;
+        // Cohen-Sutherland trivial reject: both end points lie beyond
+        // the same side of the clip rectangle.
+        if (outcode(a) & outcode(b))
+        {
+            return;
+        }
+        //  Bresenham Algorithm, along a major axis u and a minor axis v.
+        //  After k steps along u, with A = 2|dv| and B = 2|du|, the fraction
+        //  term A - B/2 has been corrected m_k = floor((k*A - B/2) / B) + 1
+        //  times, i.e., v has moved m_k steps. This gives the range of steps
+        //  k inside the clip rectangle without walking the hidden pixels.
+        long long dx = (long long)b.x - a.x;
+        long long dy = (long long)b.y - a.y;
         int step_x = 1, step_y = 1;
         if (dy < 0)
         {
@@ -89,123 +212,354 @@ namespace svg
             dx = -dx;
             step_x = -1;
         }
-        dy *= 2;
-        dx *= 2;
-        at(x_from, y_from) = c;
-        if (dx > dy)
+        bool x_major = dx > dy;
+        long long u0 = x_major ? a.x : a.y;
+        long long v0 = x_major ? a.y : a.x;
+        int step_u = x_major ? step_x : step_y;
+        int step_v = x_major ? step_y : step_x;
+        long long u_min = x_major ? clip_min_.x : clip_min_.y;
+        long long u_max = x_major ? clip_max_.x : clip_max_.y;
+        long long v_min = x_major ? clip_min_.y : clip_min_.x;
+        long long v_max = x_major ? clip_max_.y : clip_max_.x;
+        long long steps = x_major ? dx : dy;
+        long long A = 2 * (x_major ? dy : dx);
+        long long B = 2 * steps;
+
+        long long k_min = 0, k_max = steps;
+        if (step_u > 0)
+        {
+            k_min = std::max(k_min, u_min - u0);
+            k_max = std::min(k_max, u_max - u0);
+        }
+        else
+        {
+            k_min = std::max(k_min, u0 - u_max);
+            k_max = std::min(k_max, u0 - u_min);
+        }
+        long long m_min = step_v > 0 ? v_min - v0 : v0 - v_max;
+        long long m_max = step_v > 0 ? v_max - v0 : v0 - v_min;
+        if (A == 0)
         {
-            int fraction = dy - (dx / 2);
-            while (x_from != x_to)
+            if (m_min > 0 || m_max < 0)
             {
-                if (fraction >= 0)
-                {
-                    y_from += step_y;
-                    fraction -= dx;
-                }
-                x_from += step_x;
-                fraction += dy;
-                at(x_from, y_from) = c;
+                return;
             }
         }
         else
         {
-            int fraction = dx - (dy >> 1);
-            while (y_from != y_to)
+            // With coordinates near the int range, these products overflow 64 bits.
+            k_min = std::max(k_min, (long long)ceil_div((wide_int)(m_min - 1) * B + B / 2, A));
+            k_max = std::min(k_max, (long long)ceil_div((wide_int)m_max * B + B / 2, A) - 1);
+        }
+        if (k_min > k_max)
+        {
+            return;
+        }
+
+        long long m = B == 0 ? 0 : (long long)floor_div((wide_int)k_min * A - B / 2, B) + 1;
+        long long fraction = (long long)(A - B / 2 + (wide_int)k_min * A - (wide_int)m * B);
+        long long u = u0 + step_u * k_min;
+        long long v = v0 + step_v * m;
+        long long x = x_major ? u : v;
+        long long y = x_major ? v : u;
+        long long stride_u = x_major ? step_u : (long long)step_u * width_;
+        long long stride_v = x_major ? (long long)step_v * width_ : step_v;
+        Color *p = row((int)y) + x;
+        *p = c;
+        for (long long k = k_min; k < k_max; k++)
+        {
+            if (fraction >= 0)
             {
-                if (fraction >= 0)
-                {
-                    x_from += step_x;
-                    fraction -= dy;
-                }
-                y_from += step_y;
-                fraction += dx;
-                at(x_from, y_from) = c;
+                p += stride_v;
+                fraction -= B;
             }
+            p += stride_u;
+            fraction += A;
+            *p = c;
         }
     }
 
+    void PNGImage::fill_span(int y, int x0, int x1, const Color &c)
+    {
+        if (x0 > x1)
+        {
+            std::swap(x0, x1);
+        }
+        if (y < clip_min_.y || y > clip_max_.y)
+        {
+            return;
+        }
+        x0 = std::max(x0, clip_min_.x);
+        x1 = std::min(x1, clip_max_.x);
+        if (x0 > x1)
+        {
+            return;
+        }
+        Color *dst = row(y) + x0;
+        int n = x1 - x0 + 1;
+        if (n >= 8)
+        {
+            // 8 packed pixels make up exactly three 64-bit words.
+            Color pattern[8];
+            std::fill(pattern, pattern + 8, c);
+            uint64_t words[3];
+            ::memcpy(words, pattern, sizeof(words));
+            for (; n >= 8; n -= 8, dst += 8)
+            {
+                ::memcpy((unsigned char *)dst, &words[0], 8);
+                ::memcpy((unsigned char *)dst + 8, &words[1], 8);
+                ::memcpy((unsigned char *)dst + 16, &words[2], 8);
+            }
+        }
+        for (; n > 0; n--)
+        {
+            *dst++ = c;
+        }
+    }
+
+    //! Polygon edge, as stored in the edge table used by draw_polygon.
+    //! The edge's X intersection with the current scanline is tracked exactly
+    //! in fixed point: for an edge starting at (x_top, y_top) with slope dx/dy
+    //! (dy > 0), after t scanlines the intersection is x_top + t * dx / dy.
+    //! Doubling numerator and denominator, 2 * x_top * dy + 2 * t * dx + dy
+    //! is kept as q * (2 * dy) + r with 0 <= r < 2 * dy, so that q is the
+    //! intersection rounded half up and r is the (scaled) fractional part.
+    struct PolygonEdge
+    {
+        //! First scanline crossed by the edge.
+        int y_top;
+        //! Last scanline crossed by the edge (inclusive).
+        int y_bottom;
+        //! Intersection with the current scanline, rounded like std::round.
+        int x;
+        //! Integer part of the fixed-point intersection.
+        long long q;
+        //! Integer increment of q per scanline, which may exceed the int
+        //! range for nearly horizontal edges.
+        long long step_q;
+        //! Fractional part of the fixed-point intersection.
+        long long r;
+        //! Fractional increment of r per scanline.
+        long long step_r;
+        //! Fixed-point denominator (2 * dy).
+        long long two_dy;
+
+        //! Constructor.
+        //! @param top End point with the lowest Y.
+        //! @param bottom End point with the highest Y.
+        //! @param first_row First scanline to be drawn.
+        PolygonEdge(const Point &top, const Point &bottom, int first_row)
+            : y_top(std::max(top.y, first_row)), y_bottom(bottom.y)
+        {
+            long long dx = (long long)bottom.x - top.x;
+            long long dy = (long long)bottom.y - top.y;
+            two_dy = 2 * dy;
+            // 2 * x_top * dy and 2 * t * dx may overflow 64 bits near the int range.
+            wide_int start = (wide_int)2 * top.x * dy + dy + (wide_int)2 * ((long long)y_top - top.y) * dx;
+            q = (long long)floor_div(start, two_dy);
+            r = (long long)(start - (wide_int)q * two_dy);
+            step_q = (long long)floor_div(2 * dx, two_dy);
+            step_r = 2 * dx - step_q * two_dy;
+            update_x();
+        }
+
+        //! Move on to the next scanline.
+        void advance()
+        {
+            q += step_q;
+            r += step_r;
+            if (r >= two_dy)
+            {
+                r -= two_dy;
+                q++;
+            }
+            update_x();
+        }
+
+        //! Round half away from zero, i.e., down on exact ties below 0.5.
+        void update_x()
+        {
+            x = (int)((r == 0 && q <= 0) ? q - 1 : q);
+        }
+    };
+
+    //! Edge tables of draw_polygon, kept by the image so that drawing
+    //! polygons doesn't allocate once they are large enough.
+    struct PolygonScratch
+    {
+        //! Non-horizontal edges ordered by their first scanline.
+        std::vector<PolygonEdge> edges;
+        //! Edges crossing the current scanline, ordered by intersection.
+        std::vector<PolygonEdge *> active;
+    };
+
+    void PNGImage::PolygonScratchDeleter::operator()(PolygonScratch *scratch) const
+    {
+        delete scratch;
+    }
+
     void PNGImage::draw_polygon(const std::vector<Point> &points, const Color &c)
     {
-        int x_min = width(), x_max = 0, y_min = height(), y_max = 0;
-        for (const Point &p : points)
+        draw_polygon(points.data(), points.size(), c);
+    }
+
+    void PNGImage::draw_polygon(const Point *points, size_t count, const Color &c)
+    {
+        int y_min = height(), y_max = 0;
+        for (size_t i = 0; i < count; i++)
         {
-            x_min = std::min(x_min, p.x);
-            x_max = std::max(x_max, p.x);
-            y_min = std::min(y_min, p.y);
-            y_max = std::max(y_max, p.y);
+            y_min = std::min(y_min, points[i].y);
+            y_max = std::max(y_max, points[i].y);
         }
 
-        std::vector<double> seg;
-        for (int y = y_min; y < y_max; y++)
+        // Only scanlines within the clip rectangle are filled.
+        int y_first = std::max(y_min, clip_min_.y);
+        int y_end = std::min(y_max, clip_max_.y + 1);
+
+        if (polygon_scratch_ == nullptr)
+        {
+            polygon_scratch_.reset(new PolygonScratch());
+        }
+        // Edge table: non-horizontal edges ordered by their first scanline.
+        std::vector<PolygonEdge> &edges = polygon_scratch_->edges;
+        edges.clear();
+        edges.reserve(count);
+        for (size_t i = 0; i < count; i++)
         {
-            for (size_t i = 0; i < points.size(); i++)
+            const Point *a = &points[i];
+            const Point *b = &points[(i + 1) % count];
+            if (a->y > b->y)
             {
-                Point a = points[i];
-                Point b = points[(i + 1) % points.size()];
-                if (y < std::min(a.y, b.y) || y > std::max(a.y, b.y))
-                {
-                    continue;
-                }
-                if (a.y != b.y)
+                std::swap(a, b);
+            }
+            if (a->y != b->y && b->y >= y_first && a->y < y_end)
+            {
+                edges.push_back(PolygonEdge(*a, *b, y_first));
+            }
+        }
+        std::sort(edges.begin(), edges.end(),
+                  [](const PolygonEdge &e1, const PolygonEdge &e2)
+                  { return e1.y_top < e2.y_top; });
+
+        // Active edge list, kept sorted by intersection across scanlines.
+        std::vector<PolygonEdge *> &active = polygon_scratch_->active;
+        active.clear();
+        size_t next_edge = 0;
+        for (int y = y_first; y < y_end; y++)
+        {
+            while (next_edge < edges.size() && edges[next_edge].y_top <= y)
+            {
+                active.push_back(&edges[next_edge]);
+                next_edge++;
+            }
+            active.erase(std::remove_if(active.begin(), active.end(),
+                                        [y](const PolygonEdge *e)
+                                        { return e->y_bottom < y; }),
+                         active.end());
+            // Insertion sort: the order rarely changes from one scanline to the next.
+            for (size_t i = 1; i < active.size(); i++)
+            {
+                PolygonEdge *e = active[i];
+                size_t j = i;
+                for (; j > 0 && active[j - 1]->x > e->x; j--)
                 {
-                    double x_inters = (double)(y - a.y) * (b.x - a.x) / (double)(b.y - a.y) + a.x;
-                    seg.push_back(x_inters);
+                    active[j] = active[j - 1];
                 }
+                active[j] = e;
             }
-            std::sort(seg.begin(), seg.end());
             size_t i_s = 0;
-            while ((i_s + 1) < seg.size())
+            while ((i_s + 1) < active.size())
             {
-                Point a = {(int)round(seg.at(i_s)), y};
-                Point b = {(int)round(seg.at(i_s + 1)), y};
-                if (a.x == b.x)
+                int x_a = active[i_s]->x;
+                int x_b = active[i_s + 1]->x;
+                if (x_a == x_b)
                 {
                     i_s++;
                 }
                 else
                 {
-                    draw_line(a, b, c);
+                    fill_span(y, x_a, x_b, c);
                     i_s += 2;
                 }
             }
-            seg.clear();
+            for (PolygonEdge *e : active)
+            {
+                e->advance();
+            }
         }
-        for (size_t i = 0; i < points.size(); i++)
+        for (size_t i = 0; i < count; i++)
         {
-            draw_line(points[i], points[(i + 1) % points.size()], c);
+            draw_line(points[i], points[(i + 1) % count], c);
         }
     }
 
+    //! Tell if (x, y) lies within an ellipse centered at the origin.
+    //! @param f Value of x^2 * ry^2 + y^2 * rx^2 - rx^2 * ry^2.
+    //! Points exactly on the border are decided with the floating point
+    //! test (x/rx)^2 + (y/ry)^2 <= 1 that the expected images were drawn
+    //! with, since rounding makes it reject some of them.
+    static bool ellipse_contains(wide_int f, int x, int y, const Point &radius)
+    {
+        if (f != 0)
+        {
+            return f < 0;
+        }
+        double vx = (double)x / (double)radius.x;
+        double vy = (double)y / (double)radius.y;
+        return vx * vx + vy * vy <= 1;
+    }
+
+    //! Half width of a row of an ellipse centered at the origin: the largest
+    //! x such that (x, y) lies within the ellipse, or 0. The floating point
+    //! estimate is corrected with the exact test, so the cost doesn't depend
+    //! on the radii.
+    //! @param y Row, with 0 < y <= radius.y.
+    //! @param radius Radii, not negative.
+    static int ellipse_half_width(int y, const Point &radius)
+    {
+        wide_int rx2 = (wide_int)radius.x * radius.x;
+        wide_int ry2 = (wide_int)radius.y * radius.y;
+        wide_int y_term = (wide_int)y * y * rx2 - rx2 * ry2; // y^2 * rx^2 - rx^2 * ry^2
+        // rx * sqrt(1 - (y/ry)^2), without the cancellation of 1 - (y/ry)^2 near ry.
+        double estimate = radius.x * std::sqrt((double)(radius.y - y) * ((double)radius.y + y)) / radius.y;
+        int x = (int)std::min(estimate, (double)radius.x);
+        while (x < radius.x && ellipse_contains((wide_int)(x + 1) * (x + 1) * ry2 + y_term, x + 1, y, radius))
+        {
+            x++;
+        }
+        while (x > 0 && !ellipse_contains((wide_int)x * x * ry2 + y_term, x, y, radius))
+        {
+            x--;
+        }
+        return x;
+    }
+
     void PNGImage::draw_ellipse(const Point &center, const Point &radius, const Color &fill)
     {
-        draw_line(center.translate({-radius.x, 0}),
-                  center.translate({+radius.x, 0}),
-                  fill);
-        int x0 = radius.x;
-        int dx = 0;
-        for (int y = 1; y <= radius.y; y++)
-        {
-            double vy = (double)y / (double)radius.y;
-            vy *= vy;
-            int x1 = x0 - (dx - 1);
-            for (; x1 > 0; x1--)
+        // The center and the radii may each reach the int range, so the
+        // bounds of the rows and spans are computed in 64 bits.
+        Point extent = {(int)std::min<long long>(std::llabs(radius.x), INT_MAX),
+                        (int)std::min<long long>(std::llabs(radius.y), INT_MAX)};
+        // Rows outside the clip rectangle are skipped.
+        long long y_first = std::max<long long>(-extent.y, (long long)clip_min_.y - center.y);
+        long long y_last = std::min<long long>(extent.y, (long long)clip_max_.y - center.y);
+        for (long long y = y_first; y <= y_last; y++)
+        {
+            long long half = y == 0 ? extent.x : ellipse_half_width((int)std::llabs(y), extent);
+            long long x0 = std::max<long long>((long long)center.x - half, clip_min_.x);
+            long long x1 = std::min<long long>((long long)center.x + half, clip_max_.x);
+            if (x0 <= x1)
             {
-                double vx = (double)x1 / (double)radius.x;
-                vx *= vx;
-                if (vx + vy <= 1)
-                {
-                    break;
-                }
+                fill_span((int)(center.y + y), (int)x0, (int)x1, fill);
             }
-            dx = x0 - x1;
-            x0 = x1;
-            draw_line(center.translate({-x0, -y}),
-                      center.translate({+x0, -y}),
-                      fill);
-            draw_line(center.translate({-x0, +y}),
-                      center.translate({+x0, +y}),
-                      fill);
         }
     }
 
+    void PNGImage::draw_circle(const Point &center, int radius, const Color &fill)
+    {
+        // Each visible row is looked up on its own, like the rows of an
+        // ellipse, so the cost depends on the clip rows and not on the radius.
+        draw_ellipse(center, {radius, radius}, fill);
+    }
+
 }
@@ -3,13 +3,18 @@
 #define __svg_png_image_hpp__
 
 #include "Color.hpp"
+#include "PNGWriter.hpp"
 #include "Point.hpp"
+#include "ThreadPool.hpp"
 
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace svg
 {
+    struct PolygonScratch;
+
     //! PNG image.
     class PNGImage
     {
@@ -22,6 +27,25 @@ namespace svg
         //! @param w Image width.
         //! @param h Image height.
         PNGImage(int w, int h);
+        //! Constructor of a band image: an image of which only some
+        //! consecutive rows are stored, and drawn. Drawing uses image
+        //! coordinates and is clipped to the stored rows, so the same
+        //! drawing may be repeated band after band over the whole image.
+        //! Initially, rows 0 to rows - 1 are stored, and white.
+        //! @param w Image width.
+        //! @param h Image height.
+        //! @param rows Number of rows stored.
+        PNGImage(int w, int h, int rows);
+        //! Constructor of a view drawing into the pixels of another image.
+        //! Drawing through the view is restricted to a clip rectangle,
+        //! so views with disjoint rectangles may be drawn concurrently.
+        //! The target image must outlive the view.
+        //! @param target Image owning the pixels.
+        //! @param clip_min Top-left corner of the clip rectangle.
+        //! @param clip_max Bottom-right corner of the clip rectangle (inclusive).
+        PNGImage(PNGImage &target, const Point &clip_min, const Point &clip_max);
+        PNGImage(const PNGImage &) = delete;
+        PNGImage &operator=(const PNGImage &) = delete;
         //! Destructor.
         ~PNGImage();
         //! Get image width.
@@ -40,32 +64,102 @@ namespace svg
         //! @param y Y position.
         //! @return Reference to pixel.
         Color at(int x, int y) const;
+        //! Tell if any pixel of a rectangular area may be drawn.
+        //! @param min Top-left corner of the area.
+        //! @param max Bottom-right corner of the area (inclusive).
+        //! @return true if the area intersects the clip rectangle.
+        bool is_visible(const Point &min, const Point &max) const;
+        //! Make the image a blank image of other dimensions, keeping its pixel
+        //! memory when it is large enough, so that an image may be reused
+        //! for successive drawings. The image must not be a view.
+        //! @param w Image width.
+        //! @param h Image height.
+        void reset(int w, int h);
+        //! Move a band image to other rows, and make them white.
+        //! @param first_row First row stored; the band ends at the image bottom.
+        void set_band(int first_row);
+        //! Write the stored rows to a PNG writer, following the rows written before.
+        //! @param writer PNG writer.
+        void write(PNGWriter &writer) const;
         //! Save to output file.
+        //! Throws std::runtime_error if the file can't be written,
+        //! and std::logic_error for band images.
         //! @param png_file_name Output file name.
-        void save(const std::string &png_file_name) const;
+        //! @param options Encoding options.
+        //! @param pool Threads encoding row bands concurrently, or nullptr.
+        //! @param palette Colors of the image, if known, to save it as a palette image.
+        void save(const std::string &png_file_name, const PNGOptions &options = PNGOptions(),
+                  ThreadPool *pool = nullptr, const Palette *palette = nullptr) const;
         //! Draw a line defined by 2 points.
         //! @param a First point.
         //! @param b Second point.
         //! @param c Color to use for the line.
         void draw_line(const Point &a, const Point &b, const Color &c);
+        //! Fill a horizontal run of pixels, clipped to the image.
+        //! @param y Row of the span.
+        //! @param x0 X coordinate of one end of the span.
+        //! @param x1 X coordinate of the other end of the span (inclusive).
+        //! @param c Color to use for the span.
+        void fill_span(int y, int x0, int x1, const Color &c);
         //! Draw a polygon.
         //! @param points Vector of points defining the polygon.
         //! @param fill Color to use for the polygon fill.
         void draw_polygon(const std::vector<Point> &points, const Color &fill);
+        //! Draw a polygon.
+        //! @param points Array of points defining the polygon.
+        //! @param count Number of points.
+        //! @param fill Color to use for the polygon fill.
+        void draw_polygon(const Point *points, size_t count, const Color &fill);
         //! Draw an ellipse.
         //! @param center Coordinates for the ellipse center.
         //! @param radius Radius in X and Y axis.
         //! @param fill Color to use for the ellipse fill.
         //! @param orientation ellipse orientation.
         void draw_ellipse(const Point &center, const Point &radius, const Color &fill);
+        //! Draw a circle.
+        //! Same as draw_ellipse with equal radii.
+        //! @param center Coordinates for the circle center.
+        //! @param radius Circle radius.
+        //! @param fill Color to use for the circle fill.
+        void draw_circle(const Point &center, int radius, const Color &fill);
 
     private:
+        //! Deletes the edge tables of draw_polygon, whose type is only known by PNGImage.cpp.
+        struct PolygonScratchDeleter
+        {
+            void operator()(PolygonScratch *scratch) const;
+        };
+
+        //! Cohen-Sutherland outcode of a point.
+        //! @param p Point.
+        //! @return Bit mask of the sides of the clip rectangle p lies beyond.
+        int outcode(const Point &p) const;
+        //! Get a stored row.
+        //! @param y Row.
+        //! @return Pixels of the row.
+        Color *row(int y) const;
+
         //! Width.
         int width_;
         //! Height.
         int height_;
         //! Pixels.
         Color *pixels_;
+        //! Tell if pixels_ belongs to this image (false for views).
+        bool owns_pixels_;
+        //! Number of pixels allocated in pixels_ (0 for views).
+        size_t capacity_;
+        //! First row stored in pixels_ (0 except for band images).
+        int first_row_;
+        //! Number of rows stored in pixels_.
+        int rows_;
+        //! Top-left corner of the clip rectangle.
+        Point clip_min_;
+        //! Bottom-right corner of the clip rectangle (inclusive).
+        Point clip_max_;
+        //! Edge tables of draw_polygon, reused by the next polygons
+        //! (nullptr until the first polygon is drawn).
+        std::unique_ptr<PolygonScratch, PolygonScratchDeleter> polygon_scratch_;
     };
 }
 
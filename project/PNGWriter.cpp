@@ -0,0 +1,1187 @@
+#include "PNGWriter.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace svg
+{
+    static_assert(sizeof(Color) == 3, "rows are written as 8-bit RGB pixels");
+
+    //! Size of the deflate window; matches are looked up to WINDOW_SIZE - 1 bytes back.
+    const size_t WINDOW_SIZE = 1 << 15;
+    //! Shortest match.
+    const size_t MIN_MATCH = 3;
+    //! Longest match.
+    const size_t MAX_MATCH = 258;
+    //! Number of bits of the hash of the next MIN_MATCH bytes.
+    const int HASH_BITS = 15;
+    //! Number of symbols after which a deflate block is written.
+    const size_t BLOCK_SYMBOLS = 1 << 15;
+    //! Largest stored block.
+    const size_t MAX_STORED = 65535;
+    //! Minimum number of filtered bytes in a band of parallel encoding.
+    const size_t MIN_BAND_SIZE = 1 << 17;
+    //! Largest IDAT chunk written.
+    const size_t MAX_CHUNK = 1 << 30;
+    //! Bytes per pixel of truecolor images.
+    const size_t PIXEL_SIZE = 3;
+
+    //! Match search parameters of a compression level.
+    struct LevelParams
+    {
+        //! Maximum number of candidates compared at each position.
+        int max_chain;
+        //! Match length that stops the search.
+        size_t nice_length;
+        //! Tell if a match is deferred when the next position has a longer one.
+        bool lazy;
+    };
+
+    //! Parameters of compression levels 0 to 9 (level 0 stores the data).
+    const LevelParams LEVELS[10] = {
+        {0, 0, false}, {4, 16, false}, {8, 32, false}, {16, 64, false}, {16, 32, true},
+        {32, 64, true}, {128, 128, true}, {256, 128, true}, {512, 258, true}, {1024, 258, true}};
+
+    //! Base lengths of length codes 257 to 285.
+    const uint16_t LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    //! Extra bits of length codes 257 to 285.
+    const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    //! Base distances of distance codes 0 to 29.
+    const uint16_t DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                    8193, 12289, 16385, 24577};
+    //! Extra bits of distance codes 0 to 29.
+    const uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    //! Order of code length code lengths in dynamic block headers.
+    const uint8_t CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    //! Number of literal/length codes.
+    const int LITLEN_CODES = 286;
+    //! Number of distance codes.
+    const int DIST_CODES = 30;
+    //! Number of code length codes.
+    const int CODE_LENGTH_CODES = 19;
+    //! End of block code.
+    const int END_OF_BLOCK = 256;
+    //! Maximum length of deflate codes.
+    const int MAX_CODE_LENGTH = 15;
+
+    PNGOptions PNGOptions::fast()
+    {
+        PNGOptions options;
+        options.level = 1;
+        options.filter = PNG_FILTER_SUB;
+        return options;
+    }
+
+    PNGOptions PNGOptions::small()
+    {
+        PNGOptions options;
+        options.level = 9;
+        options.filter = PNG_FILTER_ADAPTIVE;
+        return options;
+    }
+
+    //! Lookup tables computed once.
+    struct Tables
+    {
+        //! CRC-32 of each byte.
+        uint32_t crc[256];
+        //! Length code index (0 to 28) of lengths 0 to MAX_MATCH.
+        uint8_t length_code[MAX_MATCH + 1];
+        //! Distance code of distances 1 to 256, at distance - 1.
+        uint8_t near_dist_code[256];
+        //! Distance code of distances 257 to 32768, at (distance - 1) >> 7.
+        uint8_t far_dist_code[256];
+        //! Fixed literal/length code lengths.
+        uint8_t fixed_litlen_lengths[288];
+        //! Fixed literal/length codes.
+        uint16_t fixed_litlen_codes[288];
+        //! Fixed distance code lengths.
+        uint8_t fixed_dist_lengths[DIST_CODES];
+        //! Fixed distance codes.
+        uint16_t fixed_dist_codes[DIST_CODES];
+
+        Tables();
+
+        //! Get the code of a distance.
+        //! @param dist Distance, from 1 to WINDOW_SIZE.
+        //! @return Distance code.
+        int dist_code(size_t dist) const
+        {
+            return dist <= 256 ? near_dist_code[dist - 1] : far_dist_code[(dist - 1) >> 7];
+        }
+    };
+
+    //! Reverse the bits of a code, as deflate writes Huffman codes from their first bit.
+    //! @param code Code.
+    //! @param length Number of bits.
+    //! @return Reversed code.
+    static uint16_t reverse_bits(unsigned code, int length)
+    {
+        unsigned reversed = 0;
+        for (int i = 0; i < length; i++)
+        {
+            reversed = (reversed << 1) | (code & 1);
+            code >>= 1;
+        }
+        return (uint16_t)reversed;
+    }
+
+    //! Compute the canonical Huffman codes of code lengths.
+    //! @param lengths Code lengths (0 for unused symbols), at most 15.
+    //! @param count Number of symbols.
+    //! @param codes Destination codes, bit-reversed.
+    static void build_codes(const uint8_t *lengths, int count, uint16_t *codes)
+    {
+        unsigned length_count[16] = {0};
+        for (int i = 0; i < count; i++)
+        {
+            length_count[lengths[i]]++;
+        }
+        length_count[0] = 0;
+        unsigned next_code[16] = {0};
+        unsigned code = 0;
+        for (int bits = 1; bits < 16; bits++)
+        {
+            code = (code + length_count[bits - 1]) << 1;
+            next_code[bits] = code;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            codes[i] = lengths[i] != 0 ? reverse_bits(next_code[lengths[i]]++, lengths[i]) : 0;
+        }
+    }
+
+    Tables::Tables()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            crc[i] = c;
+        }
+        for (int code = 0; code < 29; code++)
+        {
+            int end = code < 28 ? LENGTH_BASE[code + 1] : (int)MAX_MATCH + 1;
+            for (int length = LENGTH_BASE[code]; length < end; length++)
+            {
+                length_code[length] = (uint8_t)code;
+            }
+        }
+        length_code[0] = length_code[1] = length_code[2] = 0;
+        for (int code = 0; code < DIST_CODES; code++)
+        {
+            int end = DIST_BASE[code] + (1 << DIST_EXTRA[code]);
+            for (int dist = DIST_BASE[code]; dist < end; dist++)
+            {
+                if (dist <= 256)
+                {
+                    near_dist_code[dist - 1] = (uint8_t)code;
+                }
+                else
+                {
+                    far_dist_code[(dist - 1) >> 7] = (uint8_t)code;
+                }
+            }
+        }
+        for (int i = 0; i < 288; i++)
+        {
+            fixed_litlen_lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+        }
+        build_codes(fixed_litlen_lengths, 288, fixed_litlen_codes);
+        std::fill(fixed_dist_lengths, fixed_dist_lengths + DIST_CODES, 5);
+        build_codes(fixed_dist_lengths, DIST_CODES, fixed_dist_codes);
+    }
+
+    //! Get the lookup tables.
+    //! @return Tables, computed on first use.
+    static const Tables &tables()
+    {
+        static const Tables instance;
+        return instance;
+    }
+
+    //! Update a CRC-32.
+    //! @param crc CRC of the preceding data (0 initially).
+    //! @param data Data.
+    //! @param size Size of the data.
+    //! @return CRC of the preceding data followed by data.
+    static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size)
+    {
+        const uint32_t *table = tables().crc;
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    //! Modulus of Adler-32 sums.
+    const uint32_t ADLER_BASE = 65521;
+
+    //! Update an Adler-32 checksum.
+    //! @param adler Checksum of the preceding data (1 initially).
+    //! @param data Data.
+    //! @param size Size of the data.
+    //! @return Checksum of the preceding data followed by data.
+    static uint32_t adler32(uint32_t adler, const uint8_t *data, size_t size)
+    {
+        uint32_t a = adler & 0xFFFF;
+        uint32_t b = adler >> 16;
+        while (size > 0)
+        {
+            // Largest run of bytes that can't overflow b.
+            size_t n = std::min(size, (size_t)5552);
+            size -= n;
+            for (size_t i = 0; i < n; i++)
+            {
+                a += data[i];
+                b += a;
+            }
+            data += n;
+            a %= ADLER_BASE;
+            b %= ADLER_BASE;
+        }
+        return (b << 16) | a;
+    }
+
+    //! Combine the Adler-32 checksums of two consecutive pieces of data.
+    //! @param adler1 Checksum of the first piece.
+    //! @param adler2 Checksum of the second piece.
+    //! @param size2 Size of the second piece.
+    //! @return Checksum of both pieces.
+    static uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t size2)
+    {
+        uint32_t rem = (uint32_t)(size2 % ADLER_BASE);
+        uint32_t sum1 = adler1 & 0xFFFF;
+        uint32_t sum2 = rem * sum1 % ADLER_BASE;
+        sum1 += (adler2 & 0xFFFF) + ADLER_BASE - 1;
+        sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+        if (sum1 >= ADLER_BASE)
+            sum1 -= ADLER_BASE;
+        if (sum1 >= ADLER_BASE)
+            sum1 -= ADLER_BASE;
+        if (sum2 >= 2 * ADLER_BASE)
+            sum2 -= 2 * ADLER_BASE;
+        if (sum2 >= ADLER_BASE)
+            sum2 -= ADLER_BASE;
+        return (sum2 << 16) | sum1;
+    }
+
+    //! Compute length-limited Huffman code lengths.
+    //! The work arrays are on the stack: blocks are compressed without allocating.
+    //! @param freq Symbol frequencies.
+    //! @param count Number of symbols, at most LITLEN_CODES.
+    //! @param limit Maximum code length, at most MAX_CODE_LENGTH.
+    //! @param lengths Destination code lengths (0 for unused symbols).
+    static void build_lengths(const uint32_t *freq, int count, int limit, uint8_t *lengths)
+    {
+        std::fill(lengths, lengths + count, 0);
+        std::pair<uint32_t, int> leaves[LITLEN_CODES];
+        size_t n = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (freq[i] != 0)
+            {
+                leaves[n++] = std::make_pair(freq[i], i);
+            }
+        }
+        if (n == 0)
+        {
+            return;
+        }
+        if (n == 1)
+        {
+            // A single code of one bit is incomplete, which decoders may
+            // reject: pair it with an unused symbol.
+            lengths[leaves[0].second] = 1;
+            lengths[leaves[0].second == 0 ? 1 : 0] = 1;
+            return;
+        }
+        std::sort(leaves, leaves + n);
+        // Huffman tree with two queues: the sorted leaves, then the internal
+        // nodes, which are created in order of weight.
+        uint64_t weight[2 * LITLEN_CODES - 1];
+        size_t parent[2 * LITLEN_CODES - 1];
+        for (size_t i = 0; i < n; i++)
+        {
+            weight[i] = leaves[i].first;
+        }
+        size_t next_leaf = 0, next_node = n;
+        for (size_t node = n; node < 2 * n - 1; node++)
+        {
+            size_t children[2];
+            for (size_t &child : children)
+            {
+                if (next_leaf < n && (next_node >= node || weight[next_leaf] <= weight[next_node]))
+                {
+                    child = next_leaf++;
+                }
+                else
+                {
+                    child = next_node++;
+                }
+                parent[child] = node;
+            }
+            weight[node] = weight[children[0]] + weight[children[1]];
+        }
+        // Depths, from the root down; parents follow their children.
+        size_t depth[2 * LITLEN_CODES - 1];
+        depth[2 * n - 2] = 0;
+        unsigned length_count[LITLEN_CODES + 1] = {0};
+        for (size_t i = 2 * n - 1; i-- > 0;)
+        {
+            if (i != 2 * n - 2)
+            {
+                depth[i] = depth[parent[i]] + 1;
+            }
+            if (i < n)
+            {
+                length_count[depth[i]]++;
+            }
+        }
+        // Limit the lengths: move deeper leaves to the limit, then lengthen
+        // shorter codes until the code is complete again.
+        unsigned limited[MAX_CODE_LENGTH + 1] = {0};
+        for (size_t l = 1; l <= n; l++)
+        {
+            limited[std::min(l, (size_t)limit)] += length_count[l];
+        }
+        uint64_t total = 0;
+        for (int l = 1; l <= limit; l++)
+        {
+            total += (uint64_t)limited[l] << (limit - l);
+        }
+        while (total > ((uint64_t)1 << limit))
+        {
+            limited[limit]--;
+            for (int l = limit - 1; l > 0; l--)
+            {
+                if (limited[l] != 0)
+                {
+                    limited[l]--;
+                    limited[l + 1] += 2;
+                    break;
+                }
+            }
+            total--;
+        }
+        // The least frequent symbols get the longest codes.
+        size_t leaf = 0;
+        for (int l = limit; l > 0; l--)
+        {
+            for (unsigned k = 0; k < limited[l]; k++)
+            {
+                lengths[leaves[leaf++].second] = (uint8_t)l;
+            }
+        }
+    }
+
+    //! Deflate symbol: a literal byte, or a match.
+    struct Symbol
+    {
+        //! Literal byte, or match length.
+        uint16_t value;
+        //! Match distance, or 0 for literals.
+        uint16_t dist;
+    };
+
+    //! Raw deflate compressor, with its buffers, reused for all bands a worker compresses.
+    struct PNGDeflater
+    {
+        //! Last position + 1 with each hash, or 0.
+        std::vector<uint32_t> head;
+        //! Previous position + 1 with the same hash, by position in the window.
+        std::vector<uint32_t> prev;
+        //! Symbols of the current block.
+        std::vector<Symbol> symbols;
+        //! Filtered row candidates of the adaptive filter.
+        std::vector<uint8_t> scratch;
+        //! Palette indices of the current and previous rows, by row parity.
+        std::vector<uint8_t> indices[2];
+        //! Destination of the compressed data.
+        std::vector<uint8_t> *out;
+        //! Bits not written yet.
+        uint64_t bits;
+        //! Number of bits not written yet.
+        int bit_count;
+
+        PNGDeflater() : head((size_t)1 << HASH_BITS), prev(WINDOW_SIZE), out(nullptr), bits(0), bit_count(0)
+        {
+            symbols.reserve(BLOCK_SYMBOLS);
+        }
+
+        //! Write bits, first bit first.
+        //! @param value Bits.
+        //! @param count Number of bits, at most 32.
+        void put_bits(uint32_t value, int count)
+        {
+            bits |= (uint64_t)value << bit_count;
+            bit_count += count;
+            while (bit_count >= 8)
+            {
+                out->push_back((uint8_t)bits);
+                bits >>= 8;
+                bit_count -= 8;
+            }
+        }
+
+        //! Pad the bits written to a byte boundary.
+        void align()
+        {
+            if (bit_count > 0)
+            {
+                put_bits(0, 8 - bit_count);
+            }
+        }
+
+        //! Write non-final stored blocks.
+        //! @param data Data.
+        //! @param size Size of the data.
+        void put_stored(const uint8_t *data, size_t size)
+        {
+            do
+            {
+                size_t n = std::min(size, MAX_STORED);
+                put_bits(0, 3);
+                align();
+                put_bits((uint32_t)n, 16);
+                put_bits((uint32_t)n ^ 0xFFFF, 16);
+                out->insert(out->end(), data, data + n);
+                data += n;
+                size -= n;
+            } while (size > 0);
+        }
+
+        //! Hash of the MIN_MATCH bytes at a position.
+        //! @param p Position.
+        //! @return Hash.
+        static uint32_t hash(const uint8_t *p)
+        {
+            return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (((uint32_t)1 << HASH_BITS) - 1);
+        }
+
+        //! Add a position to the hash chains.
+        //! @param data Data.
+        //! @param pos Position, with MIN_MATCH bytes available.
+        void insert(const uint8_t *data, size_t pos)
+        {
+            uint32_t h = hash(data + pos);
+            prev[pos & (WINDOW_SIZE - 1)] = head[h];
+            head[h] = (uint32_t)pos + 1;
+        }
+
+        //! Find the longest match of a position with the positions before it.
+        //! @param data Data.
+        //! @param pos Position.
+        //! @param end End of the data.
+        //! @param params Search parameters.
+        //! @param dist Set to the match distance.
+        //! @return Match length, less than MIN_MATCH if none was found.
+        size_t find_match(const uint8_t *data, size_t pos, size_t end, const LevelParams &params, size_t &dist) const
+        {
+            if (end - pos < MIN_MATCH)
+            {
+                return 0;
+            }
+            size_t max_length = std::min(MAX_MATCH, end - pos);
+            size_t nice_length = std::min(params.nice_length, max_length);
+            size_t best = MIN_MATCH - 1;
+            const uint8_t *p = data + pos;
+            uint32_t candidate = head[hash(p)];
+            for (int chain = params.max_chain; candidate != 0 && chain > 0; chain--)
+            {
+                size_t c = candidate - 1;
+                if (pos - c >= WINDOW_SIZE)
+                {
+                    break;
+                }
+                const uint8_t *q = data + c;
+                if (q[best] == p[best] && q[0] == p[0] && q[1] == p[1])
+                {
+                    size_t length = 2;
+                    while (length < max_length && q[length] == p[length])
+                    {
+                        length++;
+                    }
+                    if (length > best)
+                    {
+                        best = length;
+                        dist = pos - c;
+                        if (length >= nice_length)
+                        {
+                            break;
+                        }
+                    }
+                }
+                candidate = prev[c & (WINDOW_SIZE - 1)];
+            }
+            return best >= MIN_MATCH ? best : 0;
+        }
+
+        //! Write the current symbols as a block, with the cheapest of
+        //! dynamic codes, fixed codes and stored data.
+        //! @param data Data of the block.
+        //! @param size Size of the data.
+        void flush_block(const uint8_t *data, size_t size)
+        {
+            const Tables &t = tables();
+            uint32_t litlen_freq[LITLEN_CODES] = {0};
+            uint32_t dist_freq[DIST_CODES] = {0};
+            uint64_t extra_bits = 0;
+            for (const Symbol &s : symbols)
+            {
+                if (s.dist == 0)
+                {
+                    litlen_freq[s.value]++;
+                }
+                else
+                {
+                    int lc = t.length_code[s.value];
+                    int dc = t.dist_code(s.dist);
+                    litlen_freq[257 + lc]++;
+                    dist_freq[dc]++;
+                    extra_bits += LENGTH_EXTRA[lc] + DIST_EXTRA[dc];
+                }
+            }
+            litlen_freq[END_OF_BLOCK]++;
+
+            uint8_t litlen_lengths[LITLEN_CODES], dist_lengths[DIST_CODES];
+            build_lengths(litlen_freq, LITLEN_CODES, MAX_CODE_LENGTH, litlen_lengths);
+            build_lengths(dist_freq, DIST_CODES, MAX_CODE_LENGTH, dist_lengths);
+            int litlen_count = LITLEN_CODES;
+            while (litlen_lengths[litlen_count - 1] == 0)
+            {
+                litlen_count--;
+            }
+            int dist_count = DIST_CODES;
+            while (dist_count > 1 && dist_lengths[dist_count - 1] == 0)
+            {
+                dist_count--;
+            }
+            // Run-length encoded code lengths: symbols 0 to 18, with repeat counts.
+            uint8_t all_lengths[LITLEN_CODES + DIST_CODES];
+            std::memcpy(all_lengths, litlen_lengths, litlen_count);
+            std::memcpy(all_lengths + litlen_count, dist_lengths, dist_count);
+            int total = litlen_count + dist_count;
+            // At most one run per code length.
+            std::pair<uint8_t, uint8_t> runs[LITLEN_CODES + DIST_CODES];
+            int run_count = 0;
+            for (int i = 0; i < total;)
+            {
+                uint8_t value = all_lengths[i];
+                int run = 1;
+                while (i + run < total && all_lengths[i + run] == value)
+                {
+                    run++;
+                }
+                i += run;
+                if (value == 0)
+                {
+                    while (run >= 11)
+                    {
+                        int n = std::min(run, 138);
+                        runs[run_count++] = std::make_pair(18, n - 11);
+                        run -= n;
+                    }
+                    if (run >= 3)
+                    {
+                        runs[run_count++] = std::make_pair(17, run - 3);
+                        run = 0;
+                    }
+                }
+                else
+                {
+                    runs[run_count++] = std::make_pair(value, 0);
+                    run--;
+                    while (run >= 3)
+                    {
+                        int n = std::min(run, 6);
+                        runs[run_count++] = std::make_pair(16, n - 3);
+                        run -= n;
+                    }
+                }
+                for (; run > 0; run--)
+                {
+                    runs[run_count++] = std::make_pair(value, 0);
+                }
+            }
+            uint32_t code_length_freq[CODE_LENGTH_CODES] = {0};
+            for (int i = 0; i < run_count; i++)
+            {
+                code_length_freq[runs[i].first]++;
+            }
+            uint8_t code_length_lengths[CODE_LENGTH_CODES];
+            build_lengths(code_length_freq, CODE_LENGTH_CODES, 7, code_length_lengths);
+            int code_length_count = CODE_LENGTH_CODES;
+            while (code_length_count > 4 && code_length_lengths[CODE_LENGTH_ORDER[code_length_count - 1]] == 0)
+            {
+                code_length_count--;
+            }
+
+            // Sizes of the three encodings, in bits.
+            uint64_t dynamic_bits = 3 + 5 + 5 + 4 + 3 * code_length_count + extra_bits;
+            for (int i = 0; i < run_count; i++)
+            {
+                const std::pair<uint8_t, uint8_t> &r = runs[i];
+                dynamic_bits += code_length_lengths[r.first] + (r.first == 16 ? 2 : r.first == 17 ? 3 : r.first == 18 ? 7 : 0);
+            }
+            uint64_t fixed_bits = 3 + extra_bits;
+            for (int i = 0; i < LITLEN_CODES; i++)
+            {
+                dynamic_bits += (uint64_t)litlen_freq[i] * litlen_lengths[i];
+                fixed_bits += (uint64_t)litlen_freq[i] * t.fixed_litlen_lengths[i];
+            }
+            for (int i = 0; i < DIST_CODES; i++)
+            {
+                dynamic_bits += (uint64_t)dist_freq[i] * dist_lengths[i];
+                fixed_bits += (uint64_t)dist_freq[i] * 5;
+            }
+            uint64_t stored_bits = ((size + MAX_STORED - 1) / MAX_STORED) * (3 + 7 + 32) + 8 * (uint64_t)size;
+
+            if (stored_bits <= dynamic_bits && stored_bits <= fixed_bits)
+            {
+                put_stored(data, size);
+            }
+            else if (fixed_bits <= dynamic_bits)
+            {
+                put_bits(1 << 1, 3);
+                put_symbols(t.fixed_litlen_lengths, t.fixed_litlen_codes, t.fixed_dist_lengths, t.fixed_dist_codes);
+            }
+            else
+            {
+                uint16_t litlen_codes[LITLEN_CODES], dist_codes[DIST_CODES], code_length_codes[CODE_LENGTH_CODES];
+                build_codes(litlen_lengths, LITLEN_CODES, litlen_codes);
+                build_codes(dist_lengths, DIST_CODES, dist_codes);
+                build_codes(code_length_lengths, CODE_LENGTH_CODES, code_length_codes);
+                put_bits(2 << 1, 3);
+                put_bits(litlen_count - 257, 5);
+                put_bits(dist_count - 1, 5);
+                put_bits(code_length_count - 4, 4);
+                for (int i = 0; i < code_length_count; i++)
+                {
+                    put_bits(code_length_lengths[CODE_LENGTH_ORDER[i]], 3);
+                }
+                for (int i = 0; i < run_count; i++)
+                {
+                    const std::pair<uint8_t, uint8_t> &r = runs[i];
+                    put_bits(code_length_codes[r.first], code_length_lengths[r.first]);
+                    if (r.first >= 16)
+                    {
+                        put_bits(r.second, r.first == 16 ? 2 : r.first == 17 ? 3 : 7);
+                    }
+                }
+                put_symbols(litlen_lengths, litlen_codes, dist_lengths, dist_codes);
+            }
+            symbols.clear();
+        }
+
+        //! Write the current symbols and the end of block code.
+        //! @param litlen_lengths Literal/length code lengths.
+        //! @param litlen_codes Literal/length codes.
+        //! @param dist_lengths Distance code lengths.
+        //! @param dist_codes Distance codes.
+        void put_symbols(const uint8_t *litlen_lengths, const uint16_t *litlen_codes,
+                         const uint8_t *dist_lengths, const uint16_t *dist_codes)
+        {
+            const Tables &t = tables();
+            for (const Symbol &s : symbols)
+            {
+                if (s.dist == 0)
+                {
+                    put_bits(litlen_codes[s.value], litlen_lengths[s.value]);
+                }
+                else
+                {
+                    int lc = t.length_code[s.value];
+                    put_bits(litlen_codes[257 + lc], litlen_lengths[257 + lc]);
+                    put_bits(s.value - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+                    int dc = t.dist_code(s.dist);
+                    put_bits(dist_codes[dc], dist_lengths[dc]);
+                    put_bits(s.dist - DIST_BASE[dc], DIST_EXTRA[dc]);
+                }
+            }
+            put_bits(litlen_codes[END_OF_BLOCK], litlen_lengths[END_OF_BLOCK]);
+        }
+
+        //! Compress data as non-final deflate blocks, ending at a byte
+        //! boundary with an empty stored block, so that the output can be
+        //! followed by other compressed data.
+        //! @param data Dictionary, then the data to compress.
+        //! @param start Size of the dictionary, at most WINDOW_SIZE.
+        //! @param end End of the data to compress.
+        //! @param level Compression level.
+        //! @param output Destination of the compressed data.
+        void compress(const uint8_t *data, size_t start, size_t end, int level, std::vector<uint8_t> &output)
+        {
+            out = &output;
+            bits = 0;
+            bit_count = 0;
+            const LevelParams &params = LEVELS[level];
+            if (level == 0)
+            {
+                if (end > start)
+                {
+                    put_stored(data + start, end - start);
+                }
+            }
+            else
+            {
+                std::fill(head.begin(), head.end(), 0);
+                for (size_t pos = 0; pos < start && end - pos >= MIN_MATCH; pos++)
+                {
+                    insert(data, pos);
+                }
+                size_t block_start = start;
+                size_t pos = start;
+                size_t length = 0, dist = 0;
+                bool found = false;
+                while (pos < end)
+                {
+                    if (!found)
+                    {
+                        length = find_match(data, pos, end, params, dist);
+                        if (end - pos >= MIN_MATCH)
+                        {
+                            insert(data, pos);
+                        }
+                    }
+                    found = false;
+                    size_t inserted = pos + 1;
+                    if (length != 0 && params.lazy && length < params.nice_length && end - pos > MIN_MATCH)
+                    {
+                        // Defer the match if the next position has a longer one.
+                        size_t next_dist = 0;
+                        size_t next_length = find_match(data, pos + 1, end, params, next_dist);
+                        insert(data, pos + 1);
+                        inserted = pos + 2;
+                        if (next_length > length)
+                        {
+                            symbols.push_back({data[pos], 0});
+                            pos++;
+                            length = next_length;
+                            dist = next_dist;
+                            found = true;
+                            continue;
+                        }
+                    }
+                    if (length != 0)
+                    {
+                        symbols.push_back({(uint16_t)length, (uint16_t)dist});
+                        for (size_t p = inserted; p < pos + length && end - p >= MIN_MATCH; p++)
+                        {
+                            insert(data, p);
+                        }
+                        pos += length;
+                    }
+                    else
+                    {
+                        symbols.push_back({data[pos], 0});
+                        pos++;
+                    }
+                    if (symbols.size() >= BLOCK_SYMBOLS)
+                    {
+                        flush_block(data + block_start, pos - block_start);
+                        block_start = pos;
+                    }
+                }
+                if (!symbols.empty())
+                {
+                    flush_block(data + block_start, pos - block_start);
+                }
+            }
+            // Empty stored block ("sync flush").
+            put_bits(0, 3);
+            align();
+            put_bits(0xFFFF0000, 32);
+            out = nullptr;
+        }
+    };
+
+    //! Predictor of the Paeth filter.
+    //! @param a Byte on the left.
+    //! @param b Byte above.
+    //! @param c Byte above on the left.
+    //! @return The byte closest to a + b - c.
+    static uint8_t paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc)
+        {
+            return (uint8_t)a;
+        }
+        return (uint8_t)(pb <= pc ? b : c);
+    }
+
+    //! Filter a row with one of the five PNG filters.
+    //! @param type Filter type, from 0 to 4.
+    //! @param row Row bytes.
+    //! @param prev Bytes of the row above (zeros for the first row).
+    //! @param size Number of bytes in a row.
+    //! @param bpp Bytes per pixel, rounded up to 1.
+    //! @param out Destination: filter type, then the filtered bytes.
+    static void filter_row(int type, const uint8_t *row, const uint8_t *prev, size_t size, size_t bpp, uint8_t *out)
+    {
+        out[0] = (uint8_t)type;
+        out++;
+        switch (type)
+        {
+        case 0:
+            std::memcpy(out, row, size);
+            break;
+        case 1:
+            for (size_t i = 0; i < size; i++)
+            {
+                out[i] = row[i] - (i >= bpp ? row[i - bpp] : 0);
+            }
+            break;
+        case 2:
+            for (size_t i = 0; i < size; i++)
+            {
+                out[i] = row[i] - prev[i];
+            }
+            break;
+        case 3:
+            for (size_t i = 0; i < size; i++)
+            {
+                int left = i >= bpp ? row[i - bpp] : 0;
+                out[i] = row[i] - (uint8_t)((left + prev[i]) >> 1);
+            }
+            break;
+        default:
+            for (size_t i = 0; i < size; i++)
+            {
+                int left = i >= bpp ? row[i - bpp] : 0;
+                int upper_left = i >= bpp ? prev[i - bpp] : 0;
+                out[i] = row[i] - paeth(left, prev[i], upper_left);
+            }
+            break;
+        }
+    }
+
+    //! Write the palette indices of a row of pixels.
+    //! @param row Pixels.
+    //! @param width Number of pixels.
+    //! @param palette Palette holding the colors of the pixels.
+    //! @param depth Bits per index (1, 2, 4 or 8).
+    //! @param out Destination: indices packed from the high bits of each byte.
+    static void index_row(const Color *row, int width, const Palette &palette, int depth, uint8_t *out)
+    {
+        std::memset(out, 0, ((size_t)width * depth + 7) / 8);
+        // Rows are mostly runs of the same color: look each run up once.
+        Color last = row[0];
+        int index = palette.index(last);
+        for (int x = 0; x < width; x++)
+        {
+            const Color &c = row[x];
+            if (c.red != last.red || c.green != last.green || c.blue != last.blue)
+            {
+                last = c;
+                index = palette.index(c);
+            }
+            if (index < 0)
+            {
+                throw std::invalid_argument("PNG image color missing from its palette");
+            }
+            size_t bit = (size_t)x * depth;
+            out[bit / 8] |= (uint8_t)(index << (8 - depth - bit % 8));
+        }
+    }
+
+    PNGWriter::PNGWriter(const Sink &sink, int width, int height, const PNGOptions &options, ThreadPool *pool,
+                         const Palette *palette)
+        : PNGWriter()
+    {
+        start(sink, width, height, options, pool, palette);
+    }
+
+    PNGWriter::PNGWriter()
+        : width_(0), height_(0), pool_(nullptr), indexed_(false), depth_(8), row_bytes_(0), pixel_bytes_(0),
+          rows_written_(0), dictionary_size_(0), adler_(1), crc_(0)
+    {
+    }
+
+    void PNGWriter::start(const Sink &sink, int width, int height, const PNGOptions &options, ThreadPool *pool,
+                          const Palette *palette)
+    {
+        if (width <= 0 || height <= 0)
+        {
+            throw std::invalid_argument("Invalid PNG image dimensions");
+        }
+        if (options.level < 0 || options.level > 9)
+        {
+            throw std::invalid_argument("Invalid PNG compression level");
+        }
+        sink_ = sink;
+        width_ = width;
+        height_ = height;
+        options_ = options;
+        pool_ = pool;
+        rows_written_ = 0;
+        filtered_.clear();
+        dictionary_size_ = 0;
+        adler_ = 1;
+        crc_ = 0;
+        indexed_ = options.palette && palette != nullptr && !palette->overflow() && palette->size() > 0;
+        if (indexed_)
+        {
+            palette_ = *palette;
+            int colors = palette->size();
+            depth_ = colors <= 2 ? 1 : colors <= 4 ? 2 : colors <= 16 ? 4 : 8;
+            row_bytes_ = ((size_t)width * depth_ + 7) / 8;
+            pixel_bytes_ = 1;
+        }
+        else
+        {
+            depth_ = 8;
+            row_bytes_ = (size_t)width * PIXEL_SIZE;
+            pixel_bytes_ = PIXEL_SIZE;
+        }
+        previous_row_.assign(row_bytes_, 0);
+        // Compressors of the previous images are kept: they only hold buffers.
+        deflaters_.resize(std::max(deflaters_.size(), (size_t)(pool != nullptr ? pool->size() : 1)));
+        for (std::unique_ptr<PNGDeflater> &deflater : deflaters_)
+        {
+            if (deflater == nullptr)
+            {
+                deflater.reset(new PNGDeflater());
+            }
+        }
+        static const uint8_t SIGNATURE[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+        sink_(SIGNATURE, sizeof(SIGNATURE));
+        // Palette indices or 8-bit RGB, no interlacing.
+        uint8_t header[13] = {(uint8_t)(width >> 24), (uint8_t)(width >> 16), (uint8_t)(width >> 8), (uint8_t)width,
+                              (uint8_t)(height >> 24), (uint8_t)(height >> 16), (uint8_t)(height >> 8), (uint8_t)height,
+                              (uint8_t)depth_, (uint8_t)(indexed_ ? 3 : 2), 0, 0, 0};
+        begin_chunk("IHDR", sizeof(header));
+        chunk_data(header, sizeof(header));
+        end_chunk();
+        if (indexed_)
+        {
+            begin_chunk("PLTE", palette_.size() * sizeof(Color));
+            chunk_data((const uint8_t *)palette_.colors(), palette_.size() * sizeof(Color));
+            end_chunk();
+        }
+    }
+
+    PNGWriter::~PNGWriter()
+    {
+    }
+
+    void PNGWriter::begin_chunk(const char *type, size_t size)
+    {
+        uint8_t start[8] = {(uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size,
+                            (uint8_t)type[0], (uint8_t)type[1], (uint8_t)type[2], (uint8_t)type[3]};
+        sink_(start, sizeof(start));
+        crc_ = crc32(0, start + 4, 4);
+    }
+
+    void PNGWriter::chunk_data(const uint8_t *data, size_t size)
+    {
+        crc_ = crc32(crc_, data, size);
+        sink_(data, size);
+    }
+
+    void PNGWriter::end_chunk()
+    {
+        uint8_t crc[4] = {(uint8_t)(crc_ >> 24), (uint8_t)(crc_ >> 16), (uint8_t)(crc_ >> 8), (uint8_t)crc_};
+        sink_(crc, sizeof(crc));
+    }
+
+    void PNGWriter::write_rows(const Color *rows, int count)
+    {
+        if (count <= 0)
+        {
+            return;
+        }
+        if (count > height_ - rows_written_)
+        {
+            throw std::logic_error("Too many PNG image rows");
+        }
+        const size_t row_bytes = row_bytes_;
+        const size_t filtered_bytes = row_bytes + 1;
+        filtered_.resize(dictionary_size_ + (size_t)count * filtered_bytes);
+        uint8_t *filtered = filtered_.data() + dictionary_size_;
+
+        // Rows per band: one band without threads, otherwise enough bands
+        // to balance the workers, each large enough to compress well.
+        size_t band_rows = count;
+        if (pool_ != nullptr)
+        {
+            size_t bands = std::min((size_t)count * filtered_bytes / MIN_BAND_SIZE, (size_t)pool_->size() * 4);
+            bands = std::max(bands, (size_t)1);
+            band_rows = (count + bands - 1) / bands;
+        }
+        size_t band_count = (count + band_rows - 1) / band_rows;
+
+        // Filter the bands, then compress them with the filtered data
+        // before each band as dictionary.
+        run(band_count, [&](size_t band, int worker) {
+            PNGDeflater &deflater = *deflaters_[worker];
+            std::vector<uint8_t> &scratch = deflater.scratch;
+            // Bytes of a row: the pixels, or their indices for palette images.
+            auto row_data = [&](size_t r) -> const uint8_t * {
+                if (!indexed_)
+                {
+                    return (const uint8_t *)(rows + r * width_);
+                }
+                std::vector<uint8_t> &indices = deflater.indices[r % 2];
+                indices.resize(row_bytes);
+                index_row(rows + r * width_, width_, palette_, depth_, indices.data());
+                return indices.data();
+            };
+            size_t end = std::min((band + 1) * band_rows, (size_t)count);
+            const uint8_t *prev = band > 0 ? row_data(band * band_rows - 1) : previous_row_.data();
+            for (size_t r = band * band_rows; r < end; r++)
+            {
+                const uint8_t *row = row_data(r);
+                uint8_t *out = filtered + r * filtered_bytes;
+                if (options_.filter != PNG_FILTER_ADAPTIVE)
+                {
+                    filter_row(options_.filter, row, prev, row_bytes, pixel_bytes_, out);
+                }
+                else
+                {
+                    scratch.resize(filtered_bytes);
+                    uint64_t best_cost = UINT64_MAX;
+                    for (int type = 0; type < 5; type++)
+                    {
+                        uint8_t *candidate = type == 0 ? out : scratch.data();
+                        filter_row(type, row, prev, row_bytes, pixel_bytes_, candidate);
+                        uint64_t cost = 0;
+                        for (size_t i = 1; i < filtered_bytes; i++)
+                        {
+                            cost += std::abs((int)(int8_t)candidate[i]);
+                        }
+                        if (cost < best_cost)
+                        {
+                            best_cost = cost;
+                            if (type != 0)
+                            {
+                                std::memcpy(out, candidate, filtered_bytes);
+                            }
+                        }
+                    }
+                }
+                prev = row;
+            }
+        });
+        bands_.resize(band_count);
+        band_adler_.resize(band_count);
+        run(band_count, [&](size_t band, int worker) {
+            size_t start = dictionary_size_ + band * band_rows * filtered_bytes;
+            size_t end = dictionary_size_ + std::min((band + 1) * band_rows, (size_t)count) * filtered_bytes;
+            size_t dictionary = std::min(start, WINDOW_SIZE);
+            const uint8_t *data = filtered_.data() + start - dictionary;
+            bands_[band].clear();
+            deflaters_[worker]->compress(data, dictionary, end - start + dictionary, options_.level, bands_[band]);
+            band_adler_[band] = adler32(1, filtered_.data() + start, end - start);
+        });
+
+        for (size_t band = 0; band < band_count; band++)
+        {
+            size_t size = std::min((size_t)count - band * band_rows, band_rows) * filtered_bytes;
+            adler_ = adler32_combine(adler_, band_adler_[band], size);
+            const std::vector<uint8_t> &data = bands_[band];
+            for (size_t offset = 0; offset < data.size(); offset += MAX_CHUNK)
+            {
+                size_t n = std::min(data.size() - offset, MAX_CHUNK);
+                if (rows_written_ == 0 && band == 0 && offset == 0)
+                {
+                    // zlib header: deflate with a 32 KiB window, level hint.
+                    int level = options_.level;
+                    uint8_t flags = level <= 1 ? 0x01 : level <= 5 ? 0x5E : level == 6 ? 0x9C : 0xDA;
+                    uint8_t header[2] = {0x78, flags};
+                    begin_chunk("IDAT", n + sizeof(header));
+                    chunk_data(header, sizeof(header));
+                }
+                else
+                {
+                    begin_chunk("IDAT", n);
+                }
+                chunk_data(data.data() + offset, n);
+                end_chunk();
+            }
+        }
+
+        if (indexed_)
+        {
+            index_row(rows + (size_t)(count - 1) * width_, width_, palette_, depth_, previous_row_.data());
+        }
+        else
+        {
+            std::memcpy(previous_row_.data(), rows + (size_t)(count - 1) * width_, row_bytes);
+        }
+        // Keep the end of the filtered data as dictionary of the next rows.
+        size_t keep = std::min(filtered_.size(), WINDOW_SIZE);
+        std::memmove(filtered_.data(), filtered_.data() + filtered_.size() - keep, keep);
+        dictionary_size_ = keep;
+        rows_written_ += count;
+    }
+
+    void PNGWriter::finish()
+    {
+        if (rows_written_ != height_)
+        {
+            throw std::logic_error("Missing PNG image rows");
+        }
+        // Final empty stored block, then the Adler-32 of the filtered rows.
+        uint8_t end[9] = {0x01, 0x00, 0x00, 0xFF, 0xFF,
+                          (uint8_t)(adler_ >> 24), (uint8_t)(adler_ >> 16), (uint8_t)(adler_ >> 8), (uint8_t)adler_};
+        begin_chunk("IDAT", sizeof(end));
+        chunk_data(end, sizeof(end));
+        end_chunk();
+        begin_chunk("IEND", 0);
+        end_chunk();
+    }
+
+    void write_png(const PNGWriter::Sink &sink, int width, int height, const PNGOptions &options,
+                   ThreadPool *pool, const Palette *palette,
+                   const std::function<void(PNGWriter &)> &write_rows)
+    {
+        PNGWriter writer(sink, width, height, options, pool, palette);
+        write_rows(writer);
+        writer.finish();
+    }
+
+    void write_png_file(const std::string &file_name, int width, int height, const PNGOptions &options,
+                        ThreadPool *pool, const Palette *palette,
+                        const std::function<void(PNGWriter &)> &write_rows)
+    {
+        FILE *file = std::fopen(file_name.c_str(), "wb");
+        if (file == nullptr)
+        {
+            throw std::runtime_error("Unable to write " + file_name);
+        }
+        bool ok = true;
+        try
+        {
+            write_png([file, &ok](const uint8_t *data, size_t size) {
+                ok = ok && std::fwrite(data, 1, size, file) == size;
+            }, width, height, options, pool, palette, write_rows);
+        }
+        catch (...)
+        {
+            std::fclose(file);
+            throw;
+        }
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok)
+        {
+            throw std::runtime_error("Unable to write " + file_name);
+        }
+    }
+}
@@ -0,0 +1,193 @@
+//! @file PNGWriter.hpp
+#ifndef __svg_PNGWriter_hpp__
+#define __svg_PNGWriter_hpp__
+
+#include "Color.hpp"
+#include "Palette.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace svg
+{
+    //! Row filters of PNG encoding.
+    enum PNGFilter
+    {
+        //! Rows are stored as they are.
+        PNG_FILTER_NONE = 0,
+        //! Difference with the pixel on the left.
+        PNG_FILTER_SUB = 1,
+        //! Difference with the pixel above.
+        PNG_FILTER_UP = 2,
+        //! Best of the five PNG filters for each row, by the usual
+        //! minimum sum of absolute differences heuristic.
+        PNG_FILTER_ADAPTIVE = 5
+    };
+
+    //! Options of PNG encoding.
+    struct PNGOptions
+    {
+        //! Compression level, from 0 (no compression) to 9 (smallest output).
+        int level;
+        //! Row filter.
+        PNGFilter filter;
+        //! Write palette images when the colors of the image are known to fit in a palette.
+        bool palette;
+
+        //! Constructor of the default options: level 6, adaptive filter, palette images.
+        PNGOptions() : level(6), filter(PNG_FILTER_ADAPTIVE), palette(true) {}
+        //! Options for low latency: level 1, sub filter.
+        //! @return The options.
+        static PNGOptions fast();
+        //! Options for small files: level 9, adaptive filter.
+        //! @return The options.
+        static PNGOptions small();
+    };
+
+    struct PNGDeflater;
+
+    //! Writes a PNG image, given its rows in order. Images are written as
+    //! 8-bit RGB, or as 1, 2, 4 or 8-bit palette images when given a
+    //! palette holding all their colors.
+    //! With a thread pool, each call to write_rows splits its rows in bands
+    //! that are filtered and compressed concurrently; the compressed bands
+    //! are joined in one zlib stream, each band starting with the last 32 KiB
+    //! of the previous one as dictionary, as pigz does.
+    class PNGWriter
+    {
+    public:
+        //! Function receiving the bytes of the PNG file, in order.
+        typedef std::function<void(const uint8_t *data, size_t size)> Sink;
+
+        //! Constructor. Writes the PNG signature and header to the sink.
+        //! @param sink Destination of the PNG file.
+        //! @param width Image width.
+        //! @param height Image height.
+        //! @param options Encoding options.
+        //! @param pool Threads encoding row bands, or nullptr to encode in the calling thread.
+        //! @param palette Colors of the image, or nullptr if they aren't known.
+        //! Ignored if it overflowed or if options.palette is false.
+        PNGWriter(const Sink &sink, int width, int height, const PNGOptions &options = PNGOptions(),
+                  ThreadPool *pool = nullptr, const Palette *palette = nullptr);
+        //! Constructor of a writer to be started by start().
+        PNGWriter();
+        //! Start writing another image, reusing the buffers of the previous
+        //! ones: once they are large enough, writing images of the same size
+        //! doesn't allocate, provided that the sink is small enough for
+        //! std::function to store it in place (a lambda capturing a pointer).
+        //! Writes the PNG signature and header to the sink.
+        //! The parameters are those of the constructor.
+        void start(const Sink &sink, int width, int height, const PNGOptions &options = PNGOptions(),
+                   ThreadPool *pool = nullptr, const Palette *palette = nullptr);
+        //! Destructor.
+        ~PNGWriter();
+        PNGWriter(const PNGWriter &) = delete;
+        PNGWriter &operator=(const PNGWriter &) = delete;
+        //! Encode rows, following the rows written before.
+        //! Throws std::invalid_argument if a pixel isn't in the palette of a palette image.
+        //! @param rows Pixels of the rows, row by row.
+        //! @param count Number of rows.
+        void write_rows(const Color *rows, int count);
+        //! Finish the file, once all rows have been written.
+        void finish();
+
+    private:
+        //! Start writing a PNG chunk to the sink.
+        //! @param type Chunk type.
+        //! @param size Size of the chunk data.
+        void begin_chunk(const char *type, size_t size);
+        //! Write data of the current chunk.
+        //! @param data Data.
+        //! @param size Size of the data.
+        void chunk_data(const uint8_t *data, size_t size);
+        //! Finish the current chunk.
+        void end_chunk();
+        //! Run tasks in the pool, or in the calling thread without a pool;
+        //! the task is only made a ThreadPool::Task, which may allocate, for the pool.
+        //! @param count Number of tasks.
+        //! @param task Task function, called with the task index and the worker.
+        template <typename Task>
+        void run(size_t count, const Task &task)
+        {
+            if (pool_ != nullptr && count > 1)
+            {
+                pool_->run(count, task);
+                return;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                task(i, 0);
+            }
+        }
+
+        //! Destination.
+        Sink sink_;
+        //! Image width.
+        int width_;
+        //! Image height.
+        int height_;
+        //! Encoding options.
+        PNGOptions options_;
+        //! Threads, or nullptr.
+        ThreadPool *pool_;
+        //! Tell if the image is written as a palette image.
+        bool indexed_;
+        //! Palette of palette images.
+        Palette palette_;
+        //! Bits per sample or palette index.
+        int depth_;
+        //! Bytes of an unfiltered row.
+        size_t row_bytes_;
+        //! Bytes per pixel, rounded up to 1, used by the filters.
+        size_t pixel_bytes_;
+        //! Number of rows written.
+        int rows_written_;
+        //! Last row written, used by the filters of the next row.
+        std::vector<uint8_t> previous_row_;
+        //! Filtered rows of the current call, after the dictionary kept from the previous calls.
+        std::vector<uint8_t> filtered_;
+        //! Bytes of the dictionary at the start of filtered_.
+        size_t dictionary_size_;
+        //! Adler-32 checksum of the filtered rows written.
+        uint32_t adler_;
+        //! CRC-32 of the current chunk.
+        uint32_t crc_;
+        //! Compressors, one per worker.
+        std::vector<std::unique_ptr<PNGDeflater>> deflaters_;
+        //! Compressed bands of the current call.
+        std::vector<std::vector<uint8_t>> bands_;
+        //! Adler-32 checksums of the filtered rows of the bands of the current call.
+        std::vector<uint32_t> band_adler_;
+    };
+
+    //! Write a PNG image to a sink.
+    //! @param sink Destination of the PNG file.
+    //! @param width Image width.
+    //! @param height Image height.
+    //! @param options Encoding options.
+    //! @param pool Threads encoding row bands, or nullptr.
+    //! @param palette Colors of the image, or nullptr if they aren't known.
+    //! @param write_rows Function writing all rows of the image to the writer.
+    void write_png(const PNGWriter::Sink &sink, int width, int height, const PNGOptions &options,
+                   ThreadPool *pool, const Palette *palette,
+                   const std::function<void(PNGWriter &)> &write_rows);
+
+    //! Write a PNG file.
+    //! Throws std::runtime_error if the file can't be written.
+    //! @param file_name Name of the file.
+    //! @param width Image width.
+    //! @param height Image height.
+    //! @param options Encoding options.
+    //! @param pool Threads encoding row bands, or nullptr.
+    //! @param palette Colors of the image, or nullptr if they aren't known.
+    //! @param write_rows Function writing all rows of the image to the writer.
+    void write_png_file(const std::string &file_name, int width, int height, const PNGOptions &options,
+                        ThreadPool *pool, const Palette *palette,
+                        const std::function<void(PNGWriter &)> &write_rows);
+}
+#endif
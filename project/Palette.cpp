@@ -0,0 +1,54 @@
+#include "Palette.hpp"
+
+#include <algorithm>
+
+namespace svg
+{
+    Palette::Palette()
+    {
+        clear();
+    }
+
+    void Palette::add(const Color &c)
+    {
+        if (overflow_)
+        {
+            return;
+        }
+        uint32_t slot = hash(c);
+        for (; table_[slot] >= 0; slot = (slot + 1) % TABLE_SIZE)
+        {
+            const Color &other = colors_[table_[slot]];
+            if (other.red == c.red && other.green == c.green && other.blue == c.blue)
+            {
+                return;
+            }
+        }
+        if (size_ == MAX_COLORS)
+        {
+            overflow_ = true;
+            return;
+        }
+        table_[slot] = (int16_t)size_;
+        colors_[size_++] = c;
+    }
+
+    void Palette::add(const Palette &other)
+    {
+        if (other.overflow_)
+        {
+            overflow_ = true;
+        }
+        for (int i = 0; i < other.size_ && !overflow_; i++)
+        {
+            add(other.colors_[i]);
+        }
+    }
+
+    void Palette::clear()
+    {
+        size_ = 0;
+        overflow_ = false;
+        std::fill(table_, table_ + TABLE_SIZE, -1);
+    }
+}
@@ -0,0 +1,77 @@
+//! @file Palette.hpp
+#ifndef __svg_Palette_hpp__
+#define __svg_Palette_hpp__
+
+#include "Color.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace svg
+{
+    //! Set of up to MAX_COLORS colors, numbered in the order they were added.
+    //! Adding more colors marks the palette as overflowed.
+    class Palette
+    {
+    public:
+        //! Maximum number of colors (those of an 8-bit PNG palette).
+        static const int MAX_COLORS = 256;
+
+        //! Constructor of an empty palette.
+        Palette();
+        //! Add a color, if it isn't in the palette yet.
+        //! @param c Color.
+        void add(const Color &c);
+        //! Add the colors of another palette.
+        //! @param other Palette.
+        void add(const Palette &other);
+        //! Remove all colors.
+        void clear();
+        //! Tell if more than MAX_COLORS different colors were added.
+        //! @return true if the palette overflowed.
+        bool overflow() const { return overflow_; }
+        //! Get the number of colors.
+        //! @return Number of colors.
+        int size() const { return size_; }
+        //! Get the colors.
+        //! @return Colors, by index.
+        const Color *colors() const { return colors_; }
+        //! Get the index of a color.
+        //! @param c Color.
+        //! @return Index of the color, or -1 if it isn't in the palette.
+        int index(const Color &c) const
+        {
+            for (uint32_t slot = hash(c);; slot = (slot + 1) % TABLE_SIZE)
+            {
+                int i = table_[slot];
+                if (i < 0 || (colors_[i].red == c.red && colors_[i].green == c.green && colors_[i].blue == c.blue))
+                {
+                    return i;
+                }
+            }
+        }
+
+    private:
+        //! Number of slots of the hash table, twice MAX_COLORS so that it never fills up.
+        static const int TABLE_SIZE = 2 * MAX_COLORS;
+
+        //! Hash table slot of a color.
+        //! @param c Color.
+        //! @return Slot.
+        static uint32_t hash(const Color &c)
+        {
+            uint32_t rgb = ((uint32_t)c.red << 16) | ((uint32_t)c.green << 8) | c.blue;
+            return (rgb * 2654435761u >> 16) % TABLE_SIZE;
+        }
+
+        //! Colors.
+        Color colors_[MAX_COLORS];
+        //! Number of colors.
+        int size_;
+        //! Set once more than MAX_COLORS colors were added.
+        bool overflow_;
+        //! Open addressing hash table of color indices, -1 for empty slots.
+        int16_t table_[TABLE_SIZE];
+    };
+}
+#endif
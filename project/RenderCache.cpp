@@ -0,0 +1,302 @@
+#include "RenderCache.hpp"
+#include "RenderContext.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+namespace svg
+{
+    //! Version of the cache keys, changed when the same document and
+    //! options may give another image, so that old files aren't used.
+    const uint64_t CACHE_KEY_VERSION = 2;
+
+    //! Multipliers of the hash, from xxHash64.
+    const uint64_t HASH_PRIME_1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t HASH_PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+
+    //! Length of the file names of the cache directory: 16 hex digits and ".png".
+    const size_t CACHE_FILE_NAME_SIZE = 16 + 4;
+
+    //! Mix a 64-bit word into a hash, as a round of xxHash64.
+    //! @param hash Hash.
+    //! @param word Word.
+    //! @return New hash.
+    static uint64_t hash_word(uint64_t hash, uint64_t word)
+    {
+        hash += word * HASH_PRIME_2;
+        hash = (hash << 31) | (hash >> 33);
+        return hash * HASH_PRIME_1;
+    }
+
+    //! Read a file into memory.
+    //! @param file_name File name.
+    //! @param data Set to the content of the file.
+    //! @return false if the file can't be read.
+    static bool read_file(const std::string &file_name, std::vector<uint8_t> &data)
+    {
+        FILE *file = std::fopen(file_name.c_str(), "rb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        struct stat st;
+        bool ok = ::fstat(::fileno(file), &st) == 0;
+        if (ok)
+        {
+            data.resize((size_t)st.st_size);
+            ok = data.empty() || std::fread(data.data(), 1, data.size(), file) == data.size();
+        }
+        std::fclose(file);
+        return ok;
+    }
+
+    RenderCache::RenderCache(const std::string &directory, size_t memory_limit, size_t disk_limit)
+        : directory_(directory), memory_limit_(memory_limit), disk_limit_(disk_limit), stats_()
+    {
+        if (directory_.empty())
+        {
+            return;
+        }
+        if (::mkdir(directory_.c_str(), 0777) != 0 && errno != EEXIST)
+        {
+            throw std::runtime_error("Unable to create cache directory " + directory_);
+        }
+        DIR *dir = ::opendir(directory_.c_str());
+        if (dir == nullptr)
+        {
+            throw std::runtime_error("Unable to read cache directory " + directory_);
+        }
+        // Files of previous runs, ordered by their last use.
+        std::vector<std::pair<time_t, DiskEntry>> files;
+        while (dirent *entry = ::readdir(dir))
+        {
+            std::string name = entry->d_name;
+            std::string path = directory_ + "/" + name;
+            struct stat st;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0)
+            {
+                // Left by a process stopped while writing it.
+                ::unlink(path.c_str());
+                continue;
+            }
+            if (name.size() != CACHE_FILE_NAME_SIZE || name.compare(16, 4, ".png") != 0 ||
+                name.find_first_not_of("0123456789abcdef") != 16 || ::stat(path.c_str(), &st) != 0)
+            {
+                continue;
+            }
+            files.push_back({st.st_mtime, {std::stoull(name.substr(0, 16), nullptr, 16), (size_t)st.st_size}});
+        }
+        ::closedir(dir);
+        std::sort(files.begin(), files.end(),
+                  [](const std::pair<time_t, DiskEntry> &a, const std::pair<time_t, DiskEntry> &b) {
+                      return a.first < b.first;
+                  });
+        for (const std::pair<time_t, DiskEntry> &file : files)
+        {
+            insert_disk(file.second.key, file.second.size);
+        }
+    }
+
+    uint64_t RenderCache::key(const char *svg_data, size_t svg_size, const ConvertOptions &options)
+    {
+        uint64_t hash = hash_word(HASH_PRIME_1, CACHE_KEY_VERSION);
+        hash = hash_word(hash, svg_size);
+        size_t i = 0;
+        for (; i + 8 <= svg_size; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, svg_data + i, 8);
+            hash = hash_word(hash, word);
+        }
+        uint64_t tail = 0;
+        if (i < svg_size)
+        {
+            std::memcpy(&tail, svg_data + i, svg_size - i);
+        }
+        hash = hash_word(hash, tail);
+        // The options changing the PNG image; the others only change how it is made.
+        hash = hash_word(hash, (uint64_t)options.png.level);
+        hash = hash_word(hash, (uint64_t)options.png.filter);
+        hash = hash_word(hash, options.png.palette ? 1 : 0);
+        uint64_t scale_bits;
+        std::memcpy(&scale_bits, &options.scale, sizeof(scale_bits));
+        hash = hash_word(hash, (uint64_t)options.width);
+        hash = hash_word(hash, (uint64_t)options.height);
+        hash = hash_word(hash, scale_bits);
+        // Final avalanche of xxHash64.
+        hash ^= hash >> 33;
+        hash *= HASH_PRIME_2;
+        hash ^= hash >> 29;
+        hash *= 0x165667B19E3779F9ULL;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    std::string RenderCache::file_name(uint64_t key) const
+    {
+        char name[CACHE_FILE_NAME_SIZE + 1];
+        std::snprintf(name, sizeof(name), "%016llx.png", (unsigned long long)key);
+        return directory_ + "/" + name;
+    }
+
+    bool RenderCache::find(uint64_t key, std::vector<uint8_t> &png)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = memory_index_.find(key);
+            if (found != memory_index_.end())
+            {
+                memory_.splice(memory_.begin(), memory_, found->second);
+                png = found->second->png;
+                stats_.memory_hits++;
+                return true;
+            }
+            if (disk_index_.find(key) == disk_index_.end())
+            {
+                stats_.misses++;
+                return false;
+            }
+        }
+        // Files are read without the lock; the file may be removed meanwhile.
+        std::string name = file_name(key);
+        bool read = read_file(name, png);
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = disk_index_.find(key);
+        if (!read)
+        {
+            if (found != disk_index_.end())
+            {
+                stats_.disk_bytes -= found->second->size;
+                disk_.erase(found->second);
+                disk_index_.erase(found);
+            }
+            stats_.misses++;
+            return false;
+        }
+        if (found != disk_index_.end())
+        {
+            disk_.splice(disk_.begin(), disk_, found->second);
+        }
+        // The modification time keeps the order of use for the next runs.
+        ::utime(name.c_str(), nullptr);
+        insert_memory(key, png);
+        stats_.disk_hits++;
+        return true;
+    }
+
+    void RenderCache::insert(uint64_t key, const std::vector<uint8_t> &png)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            insert_memory(key, png);
+        }
+        if (directory_.empty() || png.size() > disk_limit_)
+        {
+            return;
+        }
+        // Files are written under a temporary name, then renamed, so that
+        // no process reads a partial file.
+        static std::atomic<unsigned long> temporary_files(0);
+        std::string name = file_name(key);
+        std::string temporary_name = name + "." + std::to_string(::getpid()) + "." +
+                                     std::to_string(temporary_files++) + ".tmp";
+        FILE *file = std::fopen(temporary_name.c_str(), "wb");
+        if (file == nullptr)
+        {
+            return;
+        }
+        bool ok = png.empty() || std::fwrite(png.data(), 1, png.size(), file) == png.size();
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok || std::rename(temporary_name.c_str(), name.c_str()) != 0)
+        {
+            // The cache directory is an optimization: failing to fill it isn't an error.
+            ::unlink(temporary_name.c_str());
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        insert_disk(key, png.size());
+    }
+
+    void RenderCache::convert(const char *svg_data, size_t svg_size, const ConvertOptions &options,
+                              std::vector<uint8_t> &png, RenderContext *context)
+    {
+        uint64_t k = key(svg_data, svg_size, options);
+        if (find(k, png))
+        {
+            return;
+        }
+        png.clear();
+        PNGWriter::Sink sink = [&png](const uint8_t *data, size_t size) {
+            png.insert(png.end(), data, data + size);
+        };
+        if (context != nullptr)
+        {
+            svg::convert(svg_data, svg_size, sink, options, *context);
+        }
+        else
+        {
+            svg::convert(svg_data, svg_size, sink, options);
+        }
+        insert(k, png);
+    }
+
+    RenderCacheStats RenderCache::stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    void RenderCache::insert_memory(uint64_t key, const std::vector<uint8_t> &png)
+    {
+        auto found = memory_index_.find(key);
+        if (found != memory_index_.end())
+        {
+            stats_.memory_bytes -= found->second->png.size();
+            memory_.erase(found->second);
+            memory_index_.erase(found);
+        }
+        if (png.size() > memory_limit_)
+        {
+            return;
+        }
+        while (stats_.memory_bytes + png.size() > memory_limit_)
+        {
+            stats_.memory_bytes -= memory_.back().png.size();
+            memory_index_.erase(memory_.back().key);
+            memory_.pop_back();
+            stats_.memory_evictions++;
+        }
+        memory_.push_front({key, png});
+        memory_index_[key] = memory_.begin();
+        stats_.memory_bytes += png.size();
+    }
+
+    void RenderCache::insert_disk(uint64_t key, size_t size)
+    {
+        auto found = disk_index_.find(key);
+        if (found != disk_index_.end())
+        {
+            stats_.disk_bytes -= found->second->size;
+            disk_.erase(found->second);
+        }
+        disk_.push_front({key, size});
+        disk_index_[key] = disk_.begin();
+        stats_.disk_bytes += size;
+        while (stats_.disk_bytes > disk_limit_)
+        {
+            ::unlink(file_name(disk_.back().key).c_str());
+            stats_.disk_bytes -= disk_.back().size;
+            disk_index_.erase(disk_.back().key);
+            disk_.pop_back();
+            stats_.disk_evictions++;
+        }
+    }
+}
@@ -0,0 +1,133 @@
+//! @file RenderCache.hpp
+#ifndef __svg_RenderCache_hpp__
+#define __svg_RenderCache_hpp__
+
+#include "SVGElements.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace svg
+{
+    struct RenderContext;
+
+    //! Counters of a render cache.
+    struct RenderCacheStats
+    {
+        //! Conversions answered from memory.
+        uint64_t memory_hits;
+        //! Conversions answered from the cache directory.
+        uint64_t disk_hits;
+        //! Conversions that had to be rendered.
+        uint64_t misses;
+        //! Images removed from memory to respect the memory limit.
+        uint64_t memory_evictions;
+        //! Files removed from the cache directory to respect the disk limit.
+        uint64_t disk_evictions;
+        //! Bytes of the images in memory.
+        size_t memory_bytes;
+        //! Bytes of the files in the cache directory.
+        size_t disk_bytes;
+    };
+
+    //! Cache of PNG images converted from SVG text, keyed by a hash of the
+    //! text and of the options changing the PNG file. Images are kept in
+    //! memory and, optionally, in a directory that outlives the process;
+    //! both are limited in size, and evict their least recently used images.
+    //! The hash is 64 bits and isn't cryptographic: the cache must not be
+    //! shared by clients that could forge colliding documents.
+    //! All methods may be called concurrently.
+    class RenderCache
+    {
+    public:
+        //! Constructor. Throws std::runtime_error if the directory can't be created.
+        //! @param directory Cache directory, created if needed, or "" to keep images in memory only.
+        //! @param memory_limit Maximum bytes of the images kept in memory.
+        //! @param disk_limit Maximum bytes of the files in the cache directory.
+        RenderCache(const std::string &directory, size_t memory_limit, size_t disk_limit);
+        RenderCache(const RenderCache &) = delete;
+        RenderCache &operator=(const RenderCache &) = delete;
+        //! Hash SVG text and conversion options into a cache key.
+        //! @param svg_data SVG text.
+        //! @param svg_size Size of the text.
+        //! @param options Conversion options.
+        //! @return Key.
+        static uint64_t key(const char *svg_data, size_t svg_size, const ConvertOptions &options);
+        //! Get a cached image, moving it to the front of the LRU lists.
+        //! @param key Cache key.
+        //! @param png Set to the PNG file if found.
+        //! @return true if found.
+        bool find(uint64_t key, std::vector<uint8_t> &png);
+        //! Add an image.
+        //! @param key Cache key.
+        //! @param png PNG file.
+        void insert(uint64_t key, const std::vector<uint8_t> &png);
+        //! Convert SVG text to a PNG image, as convert does, unless it is cached.
+        //! @param svg_data SVG text.
+        //! @param svg_size Size of the text.
+        //! @param options Conversion options.
+        //! @param png Set to the PNG file.
+        //! @param context Memory of the conversion, or nullptr to use new memory.
+        void convert(const char *svg_data, size_t svg_size, const ConvertOptions &options,
+                     std::vector<uint8_t> &png, RenderContext *context = nullptr);
+        //! Get the counters.
+        //! @return Counters.
+        RenderCacheStats stats() const;
+
+    private:
+        //! Image in memory.
+        struct MemoryEntry
+        {
+            //! Cache key.
+            uint64_t key;
+            //! PNG file.
+            std::vector<uint8_t> png;
+        };
+        //! File of the cache directory.
+        struct DiskEntry
+        {
+            //! Cache key.
+            uint64_t key;
+            //! File size.
+            size_t size;
+        };
+
+        //! Get the name of the file of an image.
+        //! @param key Cache key.
+        //! @return File name.
+        std::string file_name(uint64_t key) const;
+        //! Add an image to memory, evicting others past the memory limit.
+        //! @param key Cache key.
+        //! @param png PNG file.
+        void insert_memory(uint64_t key, const std::vector<uint8_t> &png);
+        //! Record a file of the cache directory, evicting others past the disk limit.
+        //! @param key Cache key.
+        //! @param size File size.
+        void insert_disk(uint64_t key, size_t size);
+
+        //! Cache directory, or "".
+        std::string directory_;
+        //! Maximum bytes of the images in memory.
+        size_t memory_limit_;
+        //! Maximum bytes of the files in the cache directory.
+        size_t disk_limit_;
+        //! Protects the state below.
+        mutable std::mutex mutex_;
+        //! Images in memory, most recently used first.
+        std::list<MemoryEntry> memory_;
+        //! Images in memory, by key.
+        std::unordered_map<uint64_t, std::list<MemoryEntry>::iterator> memory_index_;
+        //! Files of the cache directory, most recently used first.
+        std::list<DiskEntry> disk_;
+        //! Files of the cache directory, by key.
+        std::unordered_map<uint64_t, std::list<DiskEntry>::iterator> disk_index_;
+        //! Counters.
+        RenderCacheStats stats_;
+    };
+}
+#endif
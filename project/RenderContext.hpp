@@ -0,0 +1,68 @@
+//! @file RenderContext.hpp
+#ifndef __svg_RenderContext_hpp__
+#define __svg_RenderContext_hpp__
+
+#include "SVGElements.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace svg
+{
+    //! Memory reused by successive conversions: the framebuffer, which only
+    //! grows when an image is larger than the previous ones and is cleared
+    //! with a fill, the scratch buffers of the rasterizers and of the PNG
+    //! encoder, and the arenas of the parsers. Once a context has converted
+    //! a document, converting documents of the same size with it doesn't
+    //! allocate (see convert).
+    //! A context may only be used by one conversion at a time.
+    struct RenderContext
+    {
+        //! Arena of the elements of a document read whole.
+        Arena arena;
+        //! Elements of a document read whole.
+        std::vector<SVGElement *> elements;
+        //! Display list of a document.
+        DisplayList list;
+        //! Framebuffer; the polygon edge tables are kept with it.
+        PNGImage image;
+        //! Parser and arenas of streamed documents.
+        SVGStreamBuffers stream;
+        //! PNG encoder, with its compressors.
+        PNGWriter writer;
+        //! Threads of multithreaded conversions, kept while their number doesn't change.
+        std::unique_ptr<ThreadPool> pool;
+
+        RenderContext() : image(1, 1) {}
+        RenderContext(const RenderContext &) = delete;
+        RenderContext &operator=(const RenderContext &) = delete;
+        //! Forget the document converted last, keeping the memory.
+        void clear()
+        {
+            elements.clear();
+            arena.reset();
+            list.clear();
+        }
+    };
+
+    //! Convert SVG text in memory to a PNG image written to a sink, as
+    //! convert does, with the memory of a context.
+    //! With options.streaming, a single thread and no bands, the conversion
+    //! doesn't allocate once the context has converted a document of the
+    //! same size, provided that the sink doesn't (a lambda capturing a
+    //! pointer, appending to a buffer with enough capacity); only ids too
+    //! long for short strings may still allocate.
+    //! Without options.streaming, the XML parser allocates the tree of the
+    //! document on each conversion, and the ids of its elements are indexed
+    //! in a map allocated on each conversion; the framebuffer, the display
+    //! list and the encoder are still reused.
+    //! @param svg_data SVG text.
+    //! @param svg_size Size of the text.
+    //! @param sink Function receiving the bytes of the PNG image, in order.
+    //! @param options Conversion options.
+    //! @param context Memory of the conversion, reused by the next conversions.
+    void convert(const char *svg_data, size_t svg_size, const PNGWriter::Sink &sink,
+                 const ConvertOptions &options, RenderContext &context);
+}
+#endif
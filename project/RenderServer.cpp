@@ -0,0 +1,503 @@
+#include "RenderServer.hpp"
+#include "RenderCache.hpp"
+#include "RenderContext.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace svg
+{
+    //! Size of the request header, in bytes.
+    const size_t REQUEST_HEADER_SIZE = 10 * 4;
+
+    //! Size of the PNG data frames of responses, except the last one.
+    const size_t RESPONSE_FRAME_SIZE = 64 * 1024;
+
+    //! Store a 32-bit little-endian integer.
+    //! @param p Destination.
+    //! @param value Integer.
+    static void put_u32(uint8_t *p, uint32_t value)
+    {
+        p[0] = (uint8_t)value;
+        p[1] = (uint8_t)(value >> 8);
+        p[2] = (uint8_t)(value >> 16);
+        p[3] = (uint8_t)(value >> 24);
+    }
+
+    //! Load a 32-bit little-endian integer.
+    //! @param p Source.
+    //! @return Integer.
+    static uint32_t get_u32(const uint8_t *p)
+    {
+        return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    //! Read exactly size bytes from a socket.
+    //! @param socket Socket.
+    //! @param data Destination.
+    //! @param size Number of bytes.
+    //! @return false at the end of the stream, or on errors.
+    static bool read_all(int socket, void *data, size_t size)
+    {
+        char *p = (char *)data;
+        while (size > 0)
+        {
+            ssize_t n = ::recv(socket, p, size, 0);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    //! Write exactly size bytes to a socket.
+    //! @param socket Socket.
+    //! @param data Source.
+    //! @param size Number of bytes.
+    //! @return false on errors, such as a peer closing the connection.
+    static bool write_all(int socket, const void *data, size_t size)
+    {
+        const char *p = (const char *)data;
+        while (size > 0)
+        {
+            // No SIGPIPE when the peer is gone: the error is returned instead.
+            ssize_t n = ::send(socket, p, size, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                return false;
+            }
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    //! Get the address of a Unix domain socket.
+    //! Throws std::invalid_argument if the path is too long.
+    //! @param path Path of the socket.
+    //! @return Address.
+    static sockaddr_un socket_address(const std::string &path)
+    {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            throw std::invalid_argument("Invalid socket path " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size());
+        return address;
+    }
+
+    //! Connect to a Unix domain socket.
+    //! @param path Path of the socket.
+    //! @return Connected socket, or -1.
+    static int connect_socket(const std::string &path)
+    {
+        sockaddr_un address = socket_address(path);
+        int s = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (s >= 0 && ::connect(s, (const sockaddr *)&address, sizeof(address)) != 0)
+        {
+            ::close(s);
+            s = -1;
+        }
+        return s;
+    }
+
+    //! Get the conversion options of a request header.
+    //! @param header Request header.
+    //! @param options Set to the options.
+    //! @return Error message, empty if the options are valid.
+    static std::string decode_options(const uint8_t *header, ConvertOptions &options)
+    {
+        options = ConvertOptions();
+        options.png.level = (int)get_u32(header + 8);
+        uint32_t filter = get_u32(header + 12);
+        uint32_t flags = get_u32(header + 16);
+        uint32_t band_rows = get_u32(header + 20);
+        uint32_t width = get_u32(header + 24), height = get_u32(header + 28);
+        uint64_t scale_bits = (uint64_t)get_u32(header + 32) | (uint64_t)get_u32(header + 36) << 32;
+        double scale;
+        std::memcpy(&scale, &scale_bits, sizeof(scale));
+        if (filter != PNG_FILTER_NONE && filter != PNG_FILTER_SUB && filter != PNG_FILTER_UP &&
+            filter != PNG_FILTER_ADAPTIVE)
+        {
+            return "Invalid PNG filter";
+        }
+        if (band_rows > (uint32_t)INT32_MAX)
+        {
+            return "Invalid band rows";
+        }
+        if (width > (uint32_t)INT32_MAX || height > (uint32_t)INT32_MAX || !(scale > 0))
+        {
+            return "Invalid output size";
+        }
+        if ((uint64_t)width * height > RENDER_MAX_PIXELS)
+        {
+            return "Image too large";
+        }
+        options.png.filter = (PNGFilter)filter;
+        options.png.palette = (flags & RENDER_TRUECOLOR) == 0;
+        options.streaming = (flags & RENDER_STREAMING) != 0;
+        options.band_rows = (int)band_rows;
+        options.width = (int)width;
+        options.height = (int)height;
+        options.scale = scale;
+        // Sizes from the document or the scale are checked once the document is read.
+        options.max_pixels = RENDER_MAX_PIXELS;
+        return "";
+    }
+
+    //! Write the end of a response.
+    //! @param socket Connection socket.
+    //! @param error Error message, empty on success.
+    //! @return false if the response couldn't be written.
+    static bool end_response(int socket, const std::string &error)
+    {
+        uint8_t end[8];
+        put_u32(end, 0);
+        put_u32(end + 4, (uint32_t)error.size());
+        return write_all(socket, end, sizeof(end)) && write_all(socket, error.data(), error.size());
+    }
+
+    RenderServer::RenderServer(const std::string &socket_path, int threads, size_t queue_size,
+                               RenderCache *cache)
+        : socket_path_(socket_path), listener_(-1), queue_size_(std::max<size_t>(queue_size, 1)),
+          cache_(cache), stopping_(false)
+    {
+        sockaddr_un address = socket_address(socket_path);
+        listener_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener_ < 0)
+        {
+            throw std::runtime_error("Unable to create socket " + socket_path);
+        }
+        bool bound = ::bind(listener_, (const sockaddr *)&address, sizeof(address)) == 0;
+        if (!bound && errno == EADDRINUSE)
+        {
+            // Replace the socket file unless a server still accepts connections on it.
+            int other = connect_socket(socket_path);
+            if (other >= 0)
+            {
+                ::close(other);
+            }
+            else
+            {
+                ::unlink(socket_path.c_str());
+                bound = ::bind(listener_, (const sockaddr *)&address, sizeof(address)) == 0;
+            }
+        }
+        if (!bound || ::listen(listener_, SOMAXCONN) != 0)
+        {
+            ::close(listener_);
+            throw std::runtime_error("Unable to listen on socket " + socket_path);
+        }
+        for (int i = 0; i < std::max(threads, 1); i++)
+        {
+            workers_.emplace_back(&RenderServer::work, this);
+        }
+    }
+
+    RenderServer::~RenderServer()
+    {
+        stop();
+        for (std::thread &t : workers_)
+        {
+            t.join();
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [this] { return connections_.empty(); });
+        }
+        ::close(listener_);
+        ::unlink(socket_path_.c_str());
+    }
+
+    void RenderServer::run()
+    {
+        while (true)
+        {
+            int socket = ::accept4(listener_, nullptr, nullptr, SOCK_CLOEXEC);
+            int error = errno;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stopping_)
+                {
+                    if (socket >= 0)
+                    {
+                        ::close(socket);
+                    }
+                    return;
+                }
+                if (socket >= 0)
+                {
+                    connections_.insert(socket);
+                    std::thread(&RenderServer::serve, this, socket).detach();
+                    continue;
+                }
+            }
+            if (error == EINTR || error == ECONNABORTED)
+            {
+                continue;
+            }
+            if (error != EMFILE && error != ENFILE && error != ENOBUFS && error != ENOMEM)
+            {
+                throw std::runtime_error("Unable to accept connections on socket " + socket_path_);
+            }
+            // Out of file descriptors or memory: wait for connections to close.
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    void RenderServer::stop()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_)
+        {
+            return;
+        }
+        stopping_ = true;
+        // Wake the threads blocked on the sockets.
+        ::shutdown(listener_, SHUT_RDWR);
+        for (int socket : connections_)
+        {
+            ::shutdown(socket, SHUT_RDWR);
+        }
+        queued_.notify_all();
+        dequeued_.notify_all();
+        done_.notify_all();
+    }
+
+    void RenderServer::serve(int socket)
+    {
+        Job job;
+        job.socket = socket;
+        uint8_t header[REQUEST_HEADER_SIZE];
+        while (read_all(socket, header, sizeof(header)))
+        {
+            uint32_t svg_size = get_u32(header + 4);
+            if (get_u32(header) != RENDER_PROTOCOL_VERSION || svg_size > RENDER_MAX_SVG_SIZE)
+            {
+                // The rest of the stream can't be read.
+                end_response(socket, "Unsupported request");
+                break;
+            }
+            job.svg.resize(svg_size);
+            if (!read_all(socket, job.svg.data(), svg_size))
+            {
+                break;
+            }
+            std::string error = decode_options(header, job.options);
+            if (!error.empty())
+            {
+                if (!end_response(socket, error))
+                {
+                    break;
+                }
+                continue;
+            }
+            job.done = false;
+            job.broken = false;
+            std::unique_lock<std::mutex> lock(mutex_);
+            dequeued_.wait(lock, [this] { return stopping_ || queue_.size() < queue_size_; });
+            if (stopping_)
+            {
+                break;
+            }
+            queue_.push_back(&job);
+            queued_.notify_one();
+            done_.wait(lock, [&job] { return job.done; });
+            if (job.broken)
+            {
+                break;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections_.erase(socket);
+        ::close(socket);
+        done_.notify_all();
+    }
+
+    void RenderServer::work()
+    {
+        std::vector<uint8_t> frame;
+        std::vector<uint8_t> png;
+        // Memory of the conversions, reused from one request to the next.
+        RenderContext context;
+        while (true)
+        {
+            Job *job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                queued_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                // Requests queued before the stop are still answered,
+                // so that their connection threads stop waiting.
+                if (queue_.empty())
+                {
+                    return;
+                }
+                job = queue_.front();
+                queue_.pop_front();
+                dequeued_.notify_one();
+            }
+            render(*job, frame, png, context);
+            std::lock_guard<std::mutex> lock(mutex_);
+            job->done = true;
+            done_.notify_all();
+        }
+    }
+
+    void RenderServer::render(Job &job, std::vector<uint8_t> &frame, std::vector<uint8_t> &png,
+                              RenderContext &context)
+    {
+        // Frames are built after room for their size.
+        frame.resize(4);
+        bool sent = true;
+        auto send_frame = [&] {
+            if (frame.size() > 4)
+            {
+                put_u32(frame.data(), (uint32_t)(frame.size() - 4));
+                sent = write_all(job.socket, frame.data(), frame.size());
+                frame.resize(4);
+                if (!sent)
+                {
+                    throw std::runtime_error("Connection closed");
+                }
+            }
+        };
+        auto sink = [&](const uint8_t *data, size_t size) {
+            while (size > 0)
+            {
+                size_t n = std::min(size, RESPONSE_FRAME_SIZE + 4 - frame.size());
+                frame.insert(frame.end(), data, data + n);
+                data += n;
+                size -= n;
+                if (frame.size() == RESPONSE_FRAME_SIZE + 4)
+                {
+                    send_frame();
+                }
+            }
+        };
+        std::string error;
+        try
+        {
+            if (cache_ != nullptr)
+            {
+                // Cached images are sent once complete.
+                cache_->convert(job.svg.data(), job.svg.size(), job.options, png, &context);
+                sink(png.data(), png.size());
+            }
+            else
+            {
+                convert(job.svg.data(), job.svg.size(), sink, job.options, context);
+            }
+            send_frame();
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+            if (error.empty())
+            {
+                error = "Conversion failed";
+            }
+        }
+        job.broken = !sent || !end_response(job.socket, error);
+    }
+
+    //! Throw the error of a client whose connection failed.
+    [[noreturn]] static void connection_lost()
+    {
+        throw std::runtime_error("Connection to the render server lost");
+    }
+
+    RenderClient::RenderClient(const std::string &socket_path) : socket_(connect_socket(socket_path))
+    {
+        if (socket_ < 0)
+        {
+            throw std::runtime_error("Unable to connect to " + socket_path);
+        }
+    }
+
+    RenderClient::~RenderClient()
+    {
+        ::close(socket_);
+    }
+
+    void RenderClient::render(const char *svg_data, size_t svg_size, const ConvertOptions &options,
+                              std::vector<uint8_t> &png)
+    {
+        if (svg_size > RENDER_MAX_SVG_SIZE)
+        {
+            throw std::invalid_argument("SVG text too large to render");
+        }
+        uint8_t header[REQUEST_HEADER_SIZE];
+        put_u32(header, RENDER_PROTOCOL_VERSION);
+        put_u32(header + 4, (uint32_t)svg_size);
+        put_u32(header + 8, (uint32_t)options.png.level);
+        put_u32(header + 12, (uint32_t)options.png.filter);
+        put_u32(header + 16, (options.png.palette ? 0 : RENDER_TRUECOLOR) |
+                                 (options.streaming ? RENDER_STREAMING : 0));
+        put_u32(header + 20, (uint32_t)std::max(options.band_rows, 0));
+        put_u32(header + 24, (uint32_t)std::max(options.width, 0));
+        put_u32(header + 28, (uint32_t)std::max(options.height, 0));
+        uint64_t scale_bits;
+        std::memcpy(&scale_bits, &options.scale, sizeof(scale_bits));
+        put_u32(header + 32, (uint32_t)scale_bits);
+        put_u32(header + 36, (uint32_t)(scale_bits >> 32));
+        if (!write_all(socket_, header, sizeof(header)) || !write_all(socket_, svg_data, svg_size))
+        {
+            connection_lost();
+        }
+        png.clear();
+        uint8_t size[4];
+        while (true)
+        {
+            if (!read_all(socket_, size, sizeof(size)))
+            {
+                connection_lost();
+            }
+            size_t frame_size = get_u32(size);
+            if (frame_size == 0)
+            {
+                break;
+            }
+            size_t start = png.size();
+            png.resize(start + frame_size);
+            if (!read_all(socket_, png.data() + start, frame_size))
+            {
+                connection_lost();
+            }
+        }
+        if (!read_all(socket_, size, sizeof(size)))
+        {
+            connection_lost();
+        }
+        std::string error(get_u32(size), '\0');
+        if (!read_all(socket_, &error[0], error.size()))
+        {
+            connection_lost();
+        }
+        if (!error.empty())
+        {
+            png.clear();
+            throw std::runtime_error(error);
+        }
+    }
+}
@@ -0,0 +1,161 @@
+//! @file RenderServer.hpp
+#ifndef __svg_RenderServer_hpp__
+#define __svg_RenderServer_hpp__
+
+#include "SVGElements.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace svg
+{
+    //! Version of the render protocol, first field of each request.
+    //!
+    //! Clients send requests on a Unix domain socket connection, one at a
+    //! time, each one once the response to the previous one is received.
+    //! All integers are 32-bit little-endian.
+    //! - Request: version, SVG size, PNG level, PNG filter, flags (RenderFlags),
+    //!   band rows, output width and height (0 if unset), the output scale
+    //!   (the bits of a double, low word first), then the SVG text.
+    //! - Response: PNG data frames (size > 0, then the data), as the image is
+    //!   encoded; then 0, the size of an error message and the message, which
+    //!   is empty on success. After an error the PNG data must be discarded.
+    const uint32_t RENDER_PROTOCOL_VERSION = 2;
+
+    //! Flags of render requests.
+    enum RenderFlags
+    {
+        //! Write a truecolor image even if a palette image is possible.
+        RENDER_TRUECOLOR = 1,
+        //! Draw the elements as the document is read (ConvertOptions::streaming).
+        RENDER_STREAMING = 2
+    };
+
+    //! Maximum size of the SVG text of a request.
+    const uint32_t RENDER_MAX_SVG_SIZE = 64 << 20;
+
+    //! Maximum number of pixels of the image of a request (64 million, or
+    //! 192 MB for each rendering thread), whether the size comes from the
+    //! document or from the options of the request.
+    const size_t RENDER_MAX_PIXELS = (size_t)1 << 26;
+
+    class RenderCache;
+    struct RenderContext;
+
+    //! Daemon converting SVG text received on a Unix domain socket to PNG
+    //! images sent back on the same connection (see RENDER_PROTOCOL_VERSION).
+    //! Each connection has a thread reading its requests; requests wait in a
+    //! bounded queue for the rendering threads. When the queue is full, the
+    //! connection threads stop reading, so that clients block on their sends.
+    class RenderServer
+    {
+    public:
+        //! Constructor. Listens on the socket; a socket file left by a server
+        //! that isn't running anymore is replaced.
+        //! Throws std::runtime_error if the socket can't be created.
+        //! @param socket_path Path of the socket.
+        //! @param threads Number of rendering threads.
+        //! @param queue_size Maximum number of requests waiting to be rendered.
+        //! @param cache Cache of the rendered images, or nullptr.
+        RenderServer(const std::string &socket_path, int threads, size_t queue_size,
+                     RenderCache *cache = nullptr);
+        //! Destructor. Stops the server and removes the socket file.
+        ~RenderServer();
+        RenderServer(const RenderServer &) = delete;
+        RenderServer &operator=(const RenderServer &) = delete;
+        //! Accept connections until stop() is called.
+        void run();
+        //! Stop the server: run() returns, connections are closed and
+        //! waiting requests fail. May be called from any thread.
+        void stop();
+
+    private:
+        //! Request of a connection, waiting in the queue.
+        struct Job
+        {
+            //! Connection socket, to which the response is written.
+            int socket;
+            //! SVG text.
+            std::vector<char> svg;
+            //! Conversion options.
+            ConvertOptions options;
+            //! Set once the response is written.
+            bool done;
+            //! Set if the response couldn't be written.
+            bool broken;
+        };
+
+        //! Main loop of connection threads: read requests and wait for their responses.
+        //! @param socket Connection socket, closed on return.
+        void serve(int socket);
+        //! Main loop of rendering threads.
+        void work();
+        //! Render a request and write its response.
+        //! @param job Request.
+        //! @param frame Buffer of the response frames.
+        //! @param png Buffer of the images of the cache.
+        //! @param context Memory of the conversions of the rendering thread.
+        void render(Job &job, std::vector<uint8_t> &frame, std::vector<uint8_t> &png, RenderContext &context);
+
+        //! Path of the socket.
+        std::string socket_path_;
+        //! Listening socket.
+        int listener_;
+        //! Maximum number of requests in queue_.
+        size_t queue_size_;
+        //! Cache of the rendered images, or nullptr.
+        RenderCache *cache_;
+        //! Rendering threads.
+        std::vector<std::thread> workers_;
+        //! Protects the state below.
+        std::mutex mutex_;
+        //! Requests waiting to be rendered.
+        std::deque<Job *> queue_;
+        //! Signals requests added to the queue, or the stop.
+        std::condition_variable queued_;
+        //! Signals room in the queue, or the stop.
+        std::condition_variable dequeued_;
+        //! Signals written responses, and closed connections.
+        std::condition_variable done_;
+        //! Sockets of the open connections.
+        std::set<int> connections_;
+        //! Set by stop().
+        bool stopping_;
+    };
+
+    //! Client of a RenderServer, sending requests on one connection.
+    class RenderClient
+    {
+    public:
+        //! Constructor. Connects to the server.
+        //! Throws std::runtime_error if the connection fails.
+        //! @param socket_path Path of the server socket.
+        explicit RenderClient(const std::string &socket_path);
+        //! Destructor. Closes the connection.
+        ~RenderClient();
+        RenderClient(const RenderClient &) = delete;
+        RenderClient &operator=(const RenderClient &) = delete;
+        //! Convert SVG text to a PNG image, as convert does.
+        //! Throws std::runtime_error with the message of the server if the
+        //! conversion fails, or if the connection fails.
+        //! The number of threads of the options is ignored.
+        //! @param svg_data SVG text.
+        //! @param svg_size Size of the text.
+        //! @param options Conversion options.
+        //! @param png Set to the PNG file.
+        void render(const char *svg_data, size_t svg_size, const ConvertOptions &options,
+                    std::vector<uint8_t> &png);
+
+    private:
+        //! Connection socket.
+        int socket_;
+    };
+}
+#endif
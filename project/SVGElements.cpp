@@ -1,6 +1,34 @@
 #include "SVGElements.hpp"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <utility>
 namespace svg
 {   
+    /**
+     * @brief Get the bounding box of a sequence of points, after a transform
+     * 
+     * @param points array of points
+     * @param count number of points
+     * @param transform transform applied to the points
+     * @param min top-left corner of the bounding box
+     * @param max bottom-right corner of the bounding box (inclusive)
+     */
+    static void get_points_bounds(const Point *points, size_t count, const Transform &transform,
+                                  Point &min, Point &max)
+    {
+        min = {INT_MAX, INT_MAX};
+        max = {INT_MIN, INT_MIN};
+        for (size_t i = 0; i < count; i++)
+        {
+            Point p = transform.apply(points[i]);
+            min.x = std::min(min.x, p.x);
+            min.y = std::min(min.y, p.y);
+            max.x = std::max(max.x, p.x);
+            max.y = std::max(max.y, p.y);
+        }
+    }
+
     // SVGElement
     SVGElement::SVGElement(): fill(Color{0,0,0}), id("undefined") {}
 
@@ -8,37 +36,69 @@ namespace svg
 
     SVGElement::~SVGElement() {}
 
-    Ellipse::Ellipse(const Point &center, const Point &radius,
-                     const Color &fill, const std::string &id)
-                : SVGElement(fill, id), center(center), radius(radius)
+    void SVGElement::draw(PNGImage &img) const
     {
+        DisplayList list;
+        compile(list, Transform());
+        list.draw(img);
     }
 
-    Ellipse* Ellipse::clone(const std::string &id) const
+    bool SVGElement::is_visible(const PNGImage &img) const
     {
-        Ellipse* new_ellipse = new Ellipse(this->center, this->radius, this->fill, id);
-        return new_ellipse;
+        Point min, max;
+        get_bounds(min, max);
+        return img.is_visible(min, max);
+    }
+
+    void SVGElement::add_transform(const Transform &t)
+    {
+        transform = t * transform;
+    }
+
+    void SVGElement::translate(const Point &dir)
+    {
+        add_transform(Transform::translation(dir.x, dir.y));
+    }
+
+    void SVGElement::rotate(const Point &origin, int degrees)
+    {
+        add_transform(Transform::rotation(origin, degrees));
     }
 
-    void Ellipse::draw(PNGImage &img) const
+    void SVGElement::scale(const Point &origin, int factor)
     {
-        img.draw_ellipse(center, radius, fill);
+        add_transform(Transform::scaling(origin, factor, factor));
     }
 
-    void Ellipse::translate(const Point &dir)
+    Ellipse::Ellipse(const Point &center, const Point &radius,
+                     const Color &fill, const std::string &id)
+                : SVGElement(fill, id), center(center), radius(radius)
+    {
+    }
+
+    Ellipse* Ellipse::clone(const std::string &id) const
     {
-        center = center.translate(dir);
+        Ellipse* new_ellipse = new Ellipse(this->center, this->radius, this->fill, id);
+        new_ellipse->transform = transform;
+        return new_ellipse;
     }
 
-    void Ellipse::rotate(const Point &origin, int degrees)
+    void Ellipse::compile(DisplayList &list, const Transform &parent) const
     {
-        center = center.rotate(origin, degrees);
+        Transform t = parent * transform;
+        Point points[] = {t.apply(center),
+                          {t.apply_x_length(radius.x), t.apply_y_length(radius.y)}};
+        list.add(DRAW_ELLIPSE, points, 2, fill);
     }
 
-    void Ellipse::scale(const Point &origin, int factor)
+    void Ellipse::get_bounds(Point &min, Point &max) const
     {
-        center = center.scale(origin, factor);
-        radius = radius.scale(Point{0,0}, factor);
+        Point c = transform.apply(center);
+        // The bounds are clamped to the int range, like the coordinates.
+        double extent_x = std::fabs((double)transform.apply_x_length(radius.x));
+        double extent_y = std::fabs((double)transform.apply_y_length(radius.y));
+        min = {to_coordinate(c.x - extent_x), to_coordinate(c.y - extent_y)};
+        max = {to_coordinate(c.x + extent_x), to_coordinate(c.y + extent_y)};
     }
 
     // Circle
@@ -50,107 +110,66 @@ namespace svg
     {
     }
 
-    Polyline::Polyline(const std::vector<Point> &points,
+    Polyline::Polyline(PointVector points,
                        const Color &stroke,
                        const std::string &id )
-                    :  SVGElement(stroke, id), points(points)
+                    :  SVGElement(stroke, id), points(std::move(points))
     {
     }
 
     Polyline* Polyline::clone(const std::string &id) const 
     {
         Polyline* new_polyline = new Polyline(this->points, this->fill, id);
+        new_polyline->transform = transform;
         return new_polyline;
     }
 
-    void Polyline::draw(PNGImage &img) const
+    void Polyline::compile(DisplayList &list, const Transform &parent) const
     {   
         if (points.size() >= 2)
         {
-            const Point * initial_point = &points[0];
-            for (size_t i = 1; i < points.size(); i++)
-            {
-                const Point * const next_point = &points[i];
-                img.draw_line(*initial_point, *next_point, fill);
-                initial_point = next_point;
-            }
-        }
-    }
-
-    void Polyline::translate(const Point &dir)
-    {
-        for (Point &p:points)
-        {
-            p=p.translate(dir);
-        }
-    }
-
-    void Polyline::rotate(const Point &origin, int degrees)
-    {
-        for (Point &p:points)
-        {
-            p=p.rotate(origin, degrees);
+            list.add(DRAW_POLYLINE, points.data(), points.size(), fill, parent * transform);
         }
     }
 
-    void Polyline::scale(const Point &origin, int factor)
+    void Polyline::get_bounds(Point &min, Point &max) const
     {
-        for (Point &p:points)
-        {
-            p=p.scale(origin, factor);
-        }
+        get_points_bounds(points.data(), points.size(), transform, min, max);
     }
 
     // Line
     Line::Line(const Point &start,
                const Point &end,
                const Color &stroke,
-               const std::string &id)
-             : Polyline({start, end}, stroke, id)
+               const std::string &id,
+               const ArenaAllocator<Point> &allocator)
+             : Polyline(PointVector({start, end}, allocator), stroke, id)
     {
     }
 
     // Polygon
-    Polygon::Polygon(const std::vector<Point> &points, 
+    Polygon::Polygon(PointVector points, 
                      const Color &fill,
                      const std::string &id)
-        : SVGElement(fill, id), points(points)
+        : SVGElement(fill, id), points(std::move(points))
     {
     }
 
     Polygon* Polygon::clone(const std::string &id) const
     {
         Polygon* new_polygon = new Polygon(this->points, this->fill, id);
+        new_polygon->transform = transform;
         return new_polygon;
     }
 
-    void Polygon::draw(PNGImage &img) const
-    {
-        img.draw_polygon(points,fill);
-    }
-
-    void Polygon::translate(const Point &dir)
-    {
-        for (Point &p:points)
-        {
-            p=p.translate(dir);
-        }
-    }
-
-    void Polygon::rotate(const Point &origin, int degrees)
+    void Polygon::compile(DisplayList &list, const Transform &parent) const
     {
-        for (Point &p:points)
-        {
-            p=p.rotate(origin, degrees);
-        }
+        list.add(DRAW_POLYGON, points.data(), points.size(), fill, parent * transform);
     }
 
-    void Polygon::scale(const Point &origin, int factor)
+    void Polygon::get_bounds(Point &min, Point &max) const
     {
-        for (Point &p:points)
-        {
-            p=p.scale(origin, factor);
-        }
+        get_points_bounds(points.data(), points.size(), transform, min, max);
     }
 
 
@@ -158,23 +177,30 @@ namespace svg
     Rect::Rect(const Point &left_top_corner, 
             const Point &width_and_height,
             const Color &fill_color,
-            const std::string &id)
-        : Polygon({left_top_corner, 
+            const std::string &id,
+            const ArenaAllocator<Point> &allocator)
+        : Polygon(PointVector({left_top_corner, 
                 left_top_corner.translate(Point{width_and_height.x, 0}), 
                 left_top_corner.translate(Point{width_and_height.x, width_and_height.y}), 
-                left_top_corner.translate(Point{0, width_and_height.y})}, 
+                left_top_corner.translate(Point{0, width_and_height.y})}, allocator), 
                 fill_color, id)
     {
     }
 
 
-    Group::Group(const std::vector<SVGElement*> &elements, const std::string &id)
-        : SVGElement(Color{0,0,0}, id), elements(elements)
+    Group::Group(const std::vector<SVGElement*> &elements, const std::string &id, bool owns_elements,
+                 const ArenaAllocator<SVGElement*> &allocator)
+        : SVGElement(Color{0,0,0}, id), elements(elements.begin(), elements.end(), allocator),
+          owns_elements(owns_elements)
     {
     }
 
     Group::~Group()
     {
+        if (!owns_elements)
+        {
+            return;
+        }
         for (SVGElement *element: elements)
         {
             delete element;
@@ -189,38 +215,94 @@ namespace svg
             new_elements.push_back(element->clone(element->get_id()+"_clone"));
         }
         Group* new_group = new Group(new_elements, id);
+        new_group->transform = transform;
         return new_group;
     }
 
-    void Group::draw(PNGImage &img) const {
+    void Group::compile(DisplayList &list, const Transform &parent) const {
+        Transform t = parent * transform;
         for (const SVGElement *element: elements)
         {
-            element->draw(img);
+            element->compile(list, t);
         }
     }
 
-    void Group::translate(const Point &dir) {
-        for (SVGElement *element: elements)
+    void Group::get_bounds(Point &min, Point &max) const {
+        // bounds of the corners of the bounding boxes of the elements, after the group transform
+        min = {INT_MAX, INT_MAX};
+        max = {INT_MIN, INT_MIN};
+        for (const SVGElement *element: elements)
         {
-            element->translate(dir);
+            Point element_min, element_max;
+            element->get_bounds(element_min, element_max);
+            if (element_min.x <= element_max.x && element_min.y <= element_max.y)
+            {
+                Point corners[4] = {element_min, element_max,
+                                    {element_min.x, element_max.y},
+                                    {element_max.x, element_min.y}};
+                Point corners_min, corners_max;
+                get_points_bounds(corners, 4, transform, corners_min, corners_max);
+                min.x = std::min(min.x, corners_min.x);
+                min.y = std::min(min.y, corners_min.y);
+                max.x = std::max(max.x, corners_max.x);
+                max.y = std::max(max.y, corners_max.y);
+            }
         }
     }
 
-    void Group::rotate(const Point &origin, int degrees) {
-        for (SVGElement *element: elements)
+    void Group::add_element(SVGElement *element) {
+        elements.push_back(element);
+    }
+
+    // Use
+    Use::Use(const SVGElement *element, const std::string &id)
+        : SVGElement(Color{0,0,0}, id), element(element), owned_element(nullptr)
+    {
+    }
+
+    Use::~Use()
+    {
+        delete owned_element;
+    }
+
+    Use* Use::clone(const std::string &id) const
+    {
+        Use* new_use = new Use(element, id);
+        if (owned_element != nullptr)
         {
-            element->rotate(origin, degrees);
+            // the private copy is deleted with this element, so the clone needs its own
+            new_use->owned_element = owned_element->clone(owned_element->get_id());
+            new_use->element = new_use->owned_element;
         }
+        new_use->transform = transform;
+        return new_use;
     }
 
-    void Group::scale(const Point &origin, int factor) {
-        for (SVGElement *element: elements)
+    void Use::compile(DisplayList &list, const Transform &parent) const {
+        element->compile(list, parent * transform);
+    }
+
+    void Use::get_bounds(Point &min, Point &max) const {
+        Point element_min, element_max;
+        element->get_bounds(element_min, element_max);
+        if (element_min.x > element_max.x || element_min.y > element_max.y)
         {
-            element->scale(origin, factor);
+            min = element_min;
+            max = element_max;
+            return;
         }
+        Point corners[4] = {element_min, element_max,
+                            {element_min.x, element_max.y},
+                            {element_max.x, element_min.y}};
+        get_points_bounds(corners, 4, transform, min, max);
     }
 
-    void Group::add_element(SVGElement *element) {
-        elements.push_back(element);
+    SVGElement* Use::detach() {
+        if (owned_element == nullptr)
+        {
+            owned_element = element->clone(element->get_id());
+            element = owned_element;
+        }
+        return owned_element;
     }
 }
@@ -5,11 +5,31 @@
 #include "Color.hpp"
 #include "Point.hpp"
 #include "PNGImage.hpp"
+#include "DisplayList.hpp"
+#include "Arena.hpp"
+#include "Transform.hpp"
+#include "XMLPullParser.hpp"
+#include <cstdint>
 #include <string>
 #include <iostream>
+#include <vector>
 
 namespace svg
 {
+    /**
+     * @brief Points of an element; with an arena allocator, they are stored in the arena of the document
+     * 
+     */
+    typedef std::vector<Point, ArenaAllocator<Point>> PointVector;
+
+    class SVGElement;
+
+    /**
+     * @brief Elements of a group; with an arena allocator, the list is stored in the arena of the document
+     * 
+     */
+    typedef std::vector<SVGElement *, ArenaAllocator<SVGElement *>> ElementVector;
+
     /**
      * @brief Declaration of the SVGElement class
      * 
@@ -36,7 +56,7 @@ namespace svg
          * 
          * @return string containing the id of the SVGElement
          */
-        std::string get_id() const {return id;}
+        const std::string &get_id() const {return id;}
 
         /**
          * @brief Destroy the SVGElement object
@@ -56,14 +76,53 @@ namespace svg
          * 
          * @param img destination PNG image
          */
-        virtual void draw(PNGImage &img) const = 0;
+        void draw(PNGImage &img) const;
+
+        /**
+         * @brief Append the draw commands of the SVGElement to a display list
+         * 
+         * @param list destination display list
+         * @param parent transform of the parent element, applied after the transform of the SVGElement
+         */
+        virtual void compile(DisplayList &list, const Transform &parent) const = 0;
+
+        /**
+         * @brief Get the bounding box of the SVGElement, after its transform
+         * 
+         * @param min top-left corner of the bounding box
+         * @param max bottom-right corner of the bounding box (inclusive)
+         */
+        virtual void get_bounds(Point &min, Point &max) const = 0;
+
+        /**
+         * @brief Check if the SVGElement may cover any pixel of the PNG image
+         * 
+         * @param img destination PNG image
+         * @return true if the bounding box of the SVGElement intersects the image clip rectangle
+         */
+        bool is_visible(const PNGImage &img) const;
+
+        /**
+         * @brief Get the transform of the SVGElement
+         * 
+         * @return Transform applied to the geometry of the SVGElement when it is drawn
+         */
+        const Transform &get_transform() const {return transform;}
+
+        /**
+         * @brief Transform the SVGElement; the geometry is left untouched and
+         * the transform is composed with the current one, to be applied when drawing
+         * 
+         * @param t Transform to apply after the current transform
+         */
+        void add_transform(const Transform &t);
 
         /**
          * @brief Translate the SVGElement
          * 
          * @param dir Point representing the X and Y axes units of the translation (x,y)
          */
-        virtual void translate(const Point &dir) = 0;
+        void translate(const Point &dir);
 
         /**
          * @brief Rotate the SVGElement
@@ -71,7 +130,7 @@ namespace svg
          * @param origin Point representing the origin of the rotation
          * @param degrees int representing the degrees of the rotation
          */
-        virtual void rotate(const Point &origin, int degrees) = 0;
+        void rotate(const Point &origin, int degrees);
 
         /**
          * @brief Scale the SVGElement
@@ -79,11 +138,12 @@ namespace svg
          * @param origin Point representing the origin of the scaling
          * @param factor int representing the factor of the scaling
          */
-        virtual void scale(const Point &origin, int factor) = 0;
+        void scale(const Point &origin, int factor);
 
     protected:
         Color fill;
         std::string id;
+        Transform transform;
     };
 
 
@@ -114,34 +174,20 @@ namespace svg
         Ellipse* clone(const std::string &id) const override;
 
         /**
-         * @brief Draw the ellipse on the PNG image
-         * 
-         * @param img destination PNG image
-         */
-        void draw(PNGImage &img) const override;
-
-        /**
-         * @brief Translate the ellipse
+         * @brief Get the bounding box of the ellipse
          * 
-         * @param dir Point representing the X and Y axes units of the translation (x,y)
+         * @param min top-left corner of the bounding box
+         * @param max bottom-right corner of the bounding box (inclusive)
          */
-        void translate(const Point &dir) override;
+        void get_bounds(Point &min, Point &max) const override;
 
         /**
-         * @brief Rotate the ellipse
+         * @brief Append the draw commands of the ellipse to a display list
          * 
-         * @param origin Point representing the origin of the rotation
-         * @param degrees Integer representing the degrees of the rotation
+         * @param list destination display list
+         * @param parent transform of the parent element
          */
-        void rotate(const Point &origin, int degrees) override;
-
-        /**
-         * @brief Scale the ellipse
-         * 
-         * @param origin Point representing the origin of the scaling
-         * @param factor Integer representing the factor of the scaling
-         */
-        void scale(const Point &origin, int factor) override;
+        void compile(DisplayList &list, const Transform &parent) const override;
 
     protected:
         Point center;
@@ -179,11 +225,11 @@ namespace svg
         /**
          * @brief Construct a new Polyline object
          * 
-         * @param points vector of points in the polyline
+         * @param points vector of points in the polyline, moved into the polyline
          * @param stroke color of the polyline
          * @param id string representing the id of the polyline
          */
-        Polyline(const std::vector<Point> &points, const Color &stroke, const std::string &id);
+        Polyline(PointVector points, const Color &stroke, const std::string &id);
 
         /**
          * @brief Clone the polyline
@@ -193,37 +239,23 @@ namespace svg
         Polyline* clone(const std::string &id) const override;
 
         /**
-         * @brief Draw the polyline on the PNG image
-         * 
-         * @param img destination PNG image
-         */
-        void draw(PNGImage &img) const override;
-
-        /**
-         * @brief Translate the polyline
+         * @brief Get the bounding box of the polyline
          * 
-         * @param dir Point representing the X and Y axes units of the translation (x,y)
+         * @param min top-left corner of the bounding box
+         * @param max bottom-right corner of the bounding box (inclusive)
          */
-        void translate(const Point &dir) override;
+        void get_bounds(Point &min, Point &max) const override;
 
         /**
-         * @brief Rotate the polyline
+         * @brief Append the draw commands of the polyline to a display list
          * 
-         * @param origin Point representing the origin of the rotation
-         * @param degrees Integer representing the degrees of the rotation
+         * @param list destination display list
+         * @param parent transform of the parent element
          */
-        void rotate(const Point &origin, int degrees) override;
-
-        /**
-         * @brief Scale the polyline
-         * 
-         * @param origin Point representing the origin of the scaling
-         * @param factor Integer representing the factor of the scaling
-         */
-        void scale(const Point &origin, int factor) override;
+        void compile(DisplayList &list, const Transform &parent) const override;
 
     protected:
-        std::vector<Point> points;
+        PointVector points;
     };
 
     /**
@@ -241,8 +273,10 @@ namespace svg
          * @param end ending point of the line (XY coordinates)
          * @param stroke color of the line
          * @param id string representing the id of the line
+         * @param allocator allocator of the points of the line
          */
-        Line(const Point &start, const Point &end, const Color &stroke, const std::string &id);
+        Line(const Point &start, const Point &end, const Color &stroke, const std::string &id,
+             const ArenaAllocator<Point> &allocator = ArenaAllocator<Point>());
     };
 
     /**
@@ -255,11 +289,11 @@ namespace svg
         /**
          * @brief Construct a new Polygon object   
          * 
-         * @param points vector of points in the polygon
+         * @param points vector of points in the polygon, moved into the polygon
          * @param fill_color color of the polygon
          * @param id string representing the id of the polygon
          */
-        Polygon(const std::vector<Point> &points, const Color &fill_color, const std::string &id);
+        Polygon(PointVector points, const Color &fill_color, const std::string &id);
         
         /**
          * @brief Clone the polygon
@@ -269,37 +303,23 @@ namespace svg
         Polygon* clone(const std::string &id) const override;
 
         /**
-         * @brief Draw the polygon on the PNG image
+         * @brief Get the bounding box of the polygon
          * 
-         * @param img destinatiton PNGImage 
+         * @param min top-left corner of the bounding box
+         * @param max bottom-right corner of the bounding box (inclusive)
          */
-        void draw(PNGImage &img) const override;
+        void get_bounds(Point &min, Point &max) const override;
 
         /**
-         * @brief Translate the polygon
+         * @brief Append the draw commands of the polygon to a display list
          * 
-         * @param dir Point representing the X and Y axes units of the translation (x,y)
+         * @param list destination display list
+         * @param parent transform of the parent element
          */
-        void translate(const Point &dir) override;
-
-        /**
-         * @brief Rotate the polygon
-         * 
-         * @param origin Point representing the origin of the rotation
-         * @param degrees Integer representing the degrees of the rotation
-         */
-        void rotate(const Point &origin, int degrees) override;
-
-        /**
-         * @brief Scale the polygon
-         * 
-         * @param origin Point representing the origin of the scaling
-         * @param factor Integer representing the factor of the scaling
-         */
-        void scale(const Point &origin, int factor) override;
+        void compile(DisplayList &list, const Transform &parent) const override;
 
     protected:
-        std::vector<Point> points;
+        PointVector points;
     };
 
     /**
@@ -316,8 +336,10 @@ namespace svg
          * @param width_and_height Point representing the width and height of the rectangle (width, height)
          * @param fill_color Color of the rectangle
          * @param id string representing the id of the rectangle
+         * @param allocator allocator of the points of the rectangle
          */
-        Rect(const Point &left_top_corner, const Point &width_and_height, const Color &fill_color, const std::string &id);
+        Rect(const Point &left_top_corner, const Point &width_and_height, const Color &fill_color, const std::string &id,
+             const ArenaAllocator<Point> &allocator = ArenaAllocator<Point>());
     };
 
     /**
@@ -332,11 +354,15 @@ namespace svg
              * 
              * @param elements vector og SVGElements
              * @param id string representing the id of the group
+             * @param owns_elements whether the group deletes its elements; elements
+             * created in an arena are destroyed by the arena instead
+             * @param allocator allocator of the list of elements, from the arena of the group
              */
-            Group(const std::vector<SVGElement *> &elements = {}, const std::string &id="undefined");
+            Group(const std::vector<SVGElement *> &elements = {}, const std::string &id="undefined",
+                  bool owns_elements = true, const ArenaAllocator<SVGElement *> &allocator = {});
 
             /**
-             * @brief Destroy the Group object
+             * @brief Destroy the Group object, and its elements if it owns them
              * 
              */
             ~Group();
@@ -349,57 +375,468 @@ namespace svg
             Group* clone(const std::string &id) const override;
 
             /**
-             * @brief Draw all elements in the group on the PNG image
+             * @brief Get the bounding box of all elements in the group
              * 
-             * @param img destination PNG image
+             * @param min top-left corner of the bounding box
+             * @param max bottom-right corner of the bounding box (inclusive)
              */
-            void draw(PNGImage &img) const override;
+            void get_bounds(Point &min, Point &max) const override;
 
             /**
-             * @brief Translate all elements in the group
+             * @brief Append the draw commands of all elements in the group to a display list
              * 
-             * @param dir Point representing the X and Y coordinates of the translation (x,y)
+             * @param list destination display list
+             * @param parent transform of the parent element
              */
-            void translate(const Point &dir) override;
+            void compile(DisplayList &list, const Transform &parent) const override;
 
             /**
-             * @brief Rotate all elements in the group
+             * @brief Add an element to the group
              * 
-             * @param origin Point representing the origin of the rotation
-             * @param degrees Integer representing the degrees of the rotation
+             * @param element SVGElement to be added to the group
              */
-            void rotate(const Point &origin, int degrees) override;
+            void add_element(SVGElement *element);
 
             /**
-             * @brief Scale all elements in the group
+             * @brief Get the elements of the group
              * 
-             * @param origin Point representing the origin of the scaling
-             * @param factor Integer representing the factor of the scaling
+             * @return ElementVector containing the elements of the group
              */
-            void scale(const Point &origin, int factor) override;
+            ElementVector& get_elements() {return elements;}
+        private:
+            ElementVector elements;
+            bool owns_elements;
+    };
 
+    /**
+     * @brief Declaration of the Use class: an instance of another element,
+     * drawn with its own transform; the geometry of the referenced element
+     * is shared, not copied, until the instance is mutated
+     * 
+     */
+    class Use : public SVGElement
+    {
+        public :
             /**
-             * @brief Add an element to the group
+             * @brief Construct a new Use object
              * 
-             * @param element SVGElement to be added to the group
+             * @param element referenced element; it isn't owned by the Use object
+             * and must outlive it, unless the Use object is detached
+             * @param id string representing the id of the use element
              */
-            void add_element(SVGElement *element);
+            Use(const SVGElement *element, const std::string &id);
 
             /**
-             * @brief Get the elements of the group
+             * @brief Destroy the Use object
              * 
-             * @return std::vector<SVGElement *> containing the elements of the group
              */
-            std::vector<SVGElement *>& get_elements() {return elements;}
+            ~Use();
+
+            /**
+             * @brief Clone the use element; the clone references the same element,
+             * or has its own copy of the private copy of a detached use element
+             * 
+             * @return Use* 
+             */
+            Use* clone(const std::string &id) const override;
+
+            /**
+             * @brief Get the bounding box of the referenced element, after the transform of the use element
+             * 
+             * @param min top-left corner of the bounding box
+             * @param max bottom-right corner of the bounding box (inclusive)
+             */
+            void get_bounds(Point &min, Point &max) const override;
+
+            /**
+             * @brief Append the draw commands of the referenced element to a display list
+             * 
+             * @param list destination display list
+             * @param parent transform of the parent element
+             */
+            void compile(DisplayList &list, const Transform &parent) const override;
+
+            /**
+             * @brief Get the referenced element, which must not be modified
+             * 
+             * @return const SVGElement* 
+             */
+            const SVGElement* get_element() const {return element;}
+
+            /**
+             * @brief Get a private copy of the referenced element, to be modified;
+             * the copy is made on the first call (copy-on-write)
+             * 
+             * @return SVGElement* owned by the use element
+             */
+            SVGElement* detach();
         private:
-            std::vector<SVGElement *> elements;
+            const SVGElement *element;
+            SVGElement *owned_element;
     };
 
     void readSVG(const std::string &svg_file,
                  Point &dimensions,
                  std::vector<svg::SVGElement *> &svg_elements);
 
+    /**
+     * @brief Read a SVG file, creating its elements in an arena; the elements
+     * must not be deleted, they are all destroyed with the arena
+     * 
+     * @param svg_file name of the SVG file
+     * @param dimensions width and height of the image
+     * @param svg_elements top-level elements of the document
+     * @param arena arena owning the elements and their points
+     */
+    void readSVG(const std::string &svg_file,
+                 Point &dimensions,
+                 std::vector<svg::SVGElement *> &svg_elements,
+                 Arena &arena);
+
+    /**
+     * @brief Read SVG text from a buffer, creating its elements in an arena;
+     * the elements must not be deleted, they are all destroyed with the arena
+     * 
+     * @param data SVG text, which doesn't need to end with '\0'
+     * @param size size of the text in bytes
+     * @param dimensions width and height of the image
+     * @param svg_elements top-level elements of the document
+     * @param arena arena owning the elements and their points
+     */
+    void readSVG(const char *data,
+                 size_t size,
+                 Point &dimensions,
+                 std::vector<svg::SVGElement *> &svg_elements,
+                 Arena &arena);
+
+    /**
+     * @brief Receives the elements of a SVG file read by streamSVG
+     * 
+     */
+    class SVGStreamHandler
+    {
+    public:
+        virtual ~SVGStreamHandler() {}
+
+        /**
+         * @brief Called once, before any element
+         * 
+         * @param dimensions width and height of the image
+         */
+        virtual void begin(const Point &dimensions) = 0;
+
+        /**
+         * @brief Called for each element to draw, in document order
+         * 
+         * @param element element, valid only during the call
+         * @param parent transform of the groups containing the element
+         */
+        virtual void element(const SVGElement &element, const Transform &parent) = 0;
+    };
+
+    /**
+     * @brief Read a SVG file without building its element tree: each element
+     * is passed to the handler as soon as it is read, then discarded;
+     * only elements with an id referenced by a <use> are kept, with their content;
+     * the file is memory-mapped and parsed in place
+     * 
+     * @param svg_file name of the SVG file
+     * @param handler receives the elements
+     */
+    void streamSVG(const std::string &svg_file, SVGStreamHandler &handler);
+
+    /**
+     * @brief Read SVG text from a buffer without building its element tree,
+     * as streamSVG does for a file; the text is parsed in place, without copies
+     * 
+     * @param data SVG text, which doesn't need to end with '\0'
+     * @param size size of the text in bytes
+     * @param handler receives the elements
+     */
+    void streamSVG(const char *data, size_t size, SVGStreamHandler &handler);
+
+    /**
+     * @brief Ids referenced by href attributes, sorted, with the element kept
+     * for each; the strings are reused from one document to the next, so that
+     * indexing the references of documents of similar size doesn't allocate
+     * 
+     */
+    class ReferencedElements
+    {
+    public:
+        ReferencedElements() : count_(0) {}
+
+        /**
+         * @brief remove the ids, keeping their memory
+         * 
+         */
+        void clear() { count_ = 0; }
+
+        /**
+         * @brief add an id; ids are found once sort is called
+         * 
+         * @param id first character of the id
+         * @param length length of the id
+         */
+        void add(const char *id, size_t length);
+
+        /**
+         * @brief sort the ids, remove the duplicates and forget the elements
+         * 
+         */
+        void sort();
+
+        /**
+         * @brief check if an id is referenced
+         * 
+         * @param id the id
+         * @return true if the id was added
+         */
+        bool contains(const std::string &id) const { return find(id.c_str()) != count_; }
+
+        /**
+         * @brief keep the element of a referenced id, unless one is kept for it;
+         * elements of ids that aren't referenced are ignored
+         * 
+         * @param id id of the element
+         * @param element the element
+         */
+        void set_element(const std::string &id, SVGElement *element);
+
+        /**
+         * @brief get the element kept for an id
+         * 
+         * @param id the id
+         * @return the element, or nullptr if none was kept
+         */
+        SVGElement *get_element(const char *id) const;
+
+    private:
+        /**
+         * @brief position of an id among the sorted ids
+         * 
+         * @param id the id
+         * @return the position, or the number of ids if the id isn't referenced
+         */
+        size_t find(const char *id) const;
+
+        std::vector<std::string> ids_;
+        std::vector<SVGElement *> elements_;
+        size_t count_;
+    };
+
+    /**
+     * @brief Memory of streamSVG reused from one document to the next, so that
+     * streaming documents of similar size doesn't allocate; only ids too long
+     * for short strings may allocate then
+     * 
+     */
+    struct SVGStreamBuffers
+    {
+        /**
+         * @brief arena of the elements kept because they may be referenced
+         * 
+         */
+        Arena document;
+
+        /**
+         * @brief arena of the elements that are drawn and discarded
+         * 
+         */
+        Arena scratch;
+
+        /**
+         * @brief parser of the document
+         * 
+         */
+        XMLPullParser parser;
+
+        /**
+         * @brief ids referenced by href attributes, and the elements kept for them
+         * 
+         */
+        ReferencedElements referenced;
+
+        /**
+         * @brief transforms of the open groups
+         * 
+         */
+        std::vector<Transform> transforms;
+
+        /**
+         * @brief id of the current element
+         * 
+         */
+        std::string id;
+    };
+
+    /**
+     * @brief Read SVG text from a buffer without building its element tree,
+     * as streamSVG does, reusing the memory of the previous documents
+     * 
+     * @param data SVG text, which doesn't need to end with '\0'
+     * @param size size of the text in bytes
+     * @param handler receives the elements
+     * @param buffers memory reused from one document to the next
+     */
+    void streamSVG(const char *data, size_t size, SVGStreamHandler &handler, SVGStreamBuffers &buffers);
+
+    /**
+     * @brief Default maximum number of pixels of a converted image (256 million,
+     * or 768 MB of pixels drawn at once)
+     * 
+     */
+    const size_t MAX_IMAGE_PIXELS = (size_t)1 << 28;
+
+    /**
+     * @brief Options for the conversion of SVG files
+     * 
+     */
+    struct ConvertOptions
+    {
+        /**
+         * @brief Number of threads drawing and encoding the image; with more
+         * than one, the image is split in tiles that are drawn concurrently,
+         * and in row bands that are compressed concurrently
+         * 
+         */
+        int threads;
+
+        /**
+         * @brief Draw elements as the file is read, instead of reading the
+         * whole document first; uses less memory for large documents
+         * 
+         */
+        bool streaming;
+
+        /**
+         * @brief PNG encoding options (compression level and row filter)
+         * 
+         */
+        PNGOptions png;
+
+        /**
+         * @brief Number of rows drawn at a time, or 0 to draw the whole image
+         * at once; with bands, only one band of pixels is kept in memory, and
+         * each band is written to the PNG file as soon as it is drawn
+         * 
+         */
+        int band_rows;
+
+        /**
+         * @brief Width of the image, or 0 to keep the width of the document;
+         * the document is scaled to the image before it is drawn, so that
+         * small images of large documents are cheap to draw; with a width
+         * only, the height keeps the proportions of the document
+         * 
+         */
+        int width;
+
+        /**
+         * @brief Height of the image, or 0 to keep the height of the document;
+         * with a height only, the width keeps the proportions of the document
+         * 
+         */
+        int height;
+
+        /**
+         * @brief Scale factor of the image, such as 0.25 for a quarter of the
+         * document size, used when neither width nor height is given
+         * 
+         */
+        double scale;
+
+        /**
+         * @brief Maximum number of pixels of the image; larger images are
+         * rejected before any pixel is allocated
+         * 
+         */
+        size_t max_pixels;
+
+        ConvertOptions()
+            : threads(1), streaming(false), band_rows(0), width(0), height(0), scale(1),
+              max_pixels(MAX_IMAGE_PIXELS)
+        {
+        }
+    };
+
+    /**
+     * @brief Convert a SVG file to a PNG file; the input may also be
+     * a compiled SVG file written by compileSVG, drawn without parsing
+     * 
+     * @param svg_file name of the SVG or compiled SVG file
+     * @param png_file name of the PNG file
+     * @param options conversion options
+     */
     void convert(const std::string &svg_file,
-                 const std::string &png_file);
+                 const std::string &png_file,
+                 const ConvertOptions &options = ConvertOptions());
+
+    /**
+     * @brief Input and output files of one conversion of a batch
+     * 
+     */
+    struct ConvertJob
+    {
+        /**
+         * @brief name of the SVG or compiled SVG file
+         * 
+         */
+        std::string svg_file;
+
+        /**
+         * @brief name of the PNG file
+         * 
+         */
+        std::string png_file;
+    };
+
+    /**
+     * @brief Convert a batch of files, as convert does for one file; the files
+     * are converted concurrently by options.threads workers, each drawing one
+     * file at a time and reusing its memory from one file to the next
+     * 
+     * @param jobs files to convert
+     * @param options conversion options
+     * @return error message of each job, empty for the jobs that succeeded;
+     * a failed job doesn't stop the others
+     */
+    std::vector<std::string> convertBatch(const std::vector<ConvertJob> &jobs,
+                                          const ConvertOptions &options = ConvertOptions());
+
+    /**
+     * @brief Convert SVG text in memory to a PNG image written to a sink,
+     * without files; the text is parsed in place
+     * 
+     * @param svg_data SVG text
+     * @param svg_size size of the text
+     * @param sink function receiving the bytes of the PNG image, in order
+     * @param options conversion options
+     */
+    void convert(const char *svg_data,
+                 size_t svg_size,
+                 const PNGWriter::Sink &sink,
+                 const ConvertOptions &options = ConvertOptions());
+
+    /**
+     * @brief Convert SVG text in memory to a PNG image in memory
+     * 
+     * @param svg_data SVG text
+     * @param svg_size size of the text
+     * @param options conversion options
+     * @return std::vector<uint8_t> bytes of the PNG image
+     */
+    std::vector<uint8_t> convert(const char *svg_data,
+                                 size_t svg_size,
+                                 const ConvertOptions &options = ConvertOptions());
+
+    /**
+     * @brief Save the display list of a SVG file in a compiled SVG file
+     * (see CompiledSVG), which convert draws without reading the SVG file again
+     * 
+     * @param svg_file name of the SVG file
+     * @param compiled_file name of the compiled SVG file
+     */
+    void compileSVG(const std::string &svg_file, const std::string &compiled_file);
 }
 #endif
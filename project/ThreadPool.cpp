@@ -0,0 +1,99 @@
+#include "ThreadPool.hpp"
+
+namespace svg
+{
+    ThreadPool::ThreadPool(int threads)
+        : task_(nullptr), count_(0), next_(0), busy_(0), batch_(0), stop_(false)
+    {
+        for (int i = 1; i < threads; i++)
+        {
+            threads_.push_back(std::thread(&ThreadPool::work, this, i));
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        for (std::thread &t : threads_)
+        {
+            t.join();
+        }
+    }
+
+    int ThreadPool::size() const
+    {
+        return (int)threads_.size() + 1;
+    }
+
+    void ThreadPool::run(size_t count, const Task &task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            count_ = count;
+            next_ = 0;
+            busy_ = (int)threads_.size();
+            error_ = nullptr;
+            batch_++;
+        }
+        start_.notify_all();
+        run_tasks(0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]
+                   { return busy_ == 0; });
+        task_ = nullptr;
+        if (error_)
+        {
+            std::exception_ptr error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    void ThreadPool::work(int worker)
+    {
+        unsigned long last_batch = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [this, last_batch]
+                            { return stop_ || batch_ != last_batch; });
+                if (stop_)
+                {
+                    return;
+                }
+                last_batch = batch_;
+            }
+            run_tasks(worker);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                busy_--;
+            }
+            done_.notify_one();
+        }
+    }
+
+    void ThreadPool::run_tasks(int worker)
+    {
+        for (size_t i = next_++; i < count_; i = next_++)
+        {
+            try
+            {
+                (*task_)(i, worker);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_)
+                {
+                    error_ = std::current_exception();
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+//! @file ThreadPool.hpp
+#ifndef __svg_ThreadPool_hpp__
+#define __svg_ThreadPool_hpp__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace svg
+{
+    //! Fixed-size pool of worker threads running batches of indexed tasks.
+    class ThreadPool
+    {
+    public:
+        //! Task function, called with the task index and the worker number.
+        typedef std::function<void(size_t task, int worker)> Task;
+
+        //! Constructor.
+        //! @param threads Number of workers, including the thread calling run().
+        explicit ThreadPool(int threads);
+        //! Destructor. Waits for the worker threads to finish.
+        ~ThreadPool();
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+        //! Get the number of workers.
+        //! @return Number of workers, numbered from 0 to size() - 1.
+        int size() const;
+        //! Run tasks 0 to count - 1 and wait for all of them to complete.
+        //! The calling thread runs tasks as worker 0.
+        //! If a task throws, the first exception is rethrown once all
+        //! tasks have completed.
+        //! @param count Number of tasks.
+        //! @param task Task function.
+        void run(size_t count, const Task &task);
+
+    private:
+        //! Main loop of worker threads.
+        //! @param worker Worker number.
+        void work(int worker);
+        //! Run tasks of the current batch until none is left.
+        //! @param worker Worker number.
+        void run_tasks(int worker);
+
+        //! Worker threads (workers 1 to size() - 1).
+        std::vector<std::thread> threads_;
+        //! Protects the batch state below.
+        std::mutex mutex_;
+        //! Signals a new batch or shutdown to worker threads.
+        std::condition_variable start_;
+        //! Signals the end of the current batch to run().
+        std::condition_variable done_;
+        //! Task function of the current batch.
+        const Task *task_;
+        //! Number of tasks in the current batch.
+        size_t count_;
+        //! Index of the next task to run.
+        std::atomic<size_t> next_;
+        //! Number of worker threads still running the current batch.
+        int busy_;
+        //! Batch counter, used to wake worker threads.
+        unsigned long batch_;
+        //! Set when the pool is being destroyed.
+        bool stop_;
+        //! First exception thrown by a task of the current batch.
+        std::exception_ptr error_;
+    };
+}
+#endif
@@ -0,0 +1,74 @@
+//! @file Transform.cpp
+#include <climits>
+#include <cmath>
+#include "Transform.hpp"
+
+namespace svg
+{
+    int to_coordinate(double value)
+    {
+        if (!(value > INT_MIN) || !(value < INT_MAX))
+        {
+            return value > 0 ? INT_MAX : INT_MIN;
+        }
+        return (int)::lround(value);
+    }
+
+    Transform::Transform() : a(1), b(0), c(0), d(1), e(0), f(0) {}
+
+    Transform::Transform(double a, double b, double c, double d, double e, double f)
+        : a(a), b(b), c(c), d(d), e(e), f(f) {}
+
+    Transform Transform::translation(double tx, double ty)
+    {
+        return Transform(1, 0, 0, 1, tx, ty);
+    }
+
+    Transform Transform::rotation(const Point &origin, double degrees)
+    {
+        double angle = M_PI * degrees / 180.0;
+        double s = ::sin(angle);
+        double c = ::cos(angle);
+        return Transform(c, s, -s, c,
+                         origin.x - c * origin.x + s * origin.y,
+                         origin.y - s * origin.x - c * origin.y);
+    }
+
+    Transform Transform::scaling(const Point &origin, double sx, double sy)
+    {
+        return Transform(sx, 0, 0, sy,
+                         origin.x - sx * origin.x,
+                         origin.y - sy * origin.y);
+    }
+
+    Transform Transform::operator*(const Transform &t) const
+    {
+        return Transform(a * t.a + c * t.b,
+                         b * t.a + d * t.b,
+                         a * t.c + c * t.d,
+                         b * t.c + d * t.d,
+                         a * t.e + c * t.f + e,
+                         b * t.e + d * t.f + f);
+    }
+
+    Point Transform::apply(const Point &p) const
+    {
+        return {to_coordinate(a * p.x + c * p.y + e),
+                to_coordinate(b * p.x + d * p.y + f)};
+    }
+
+    int Transform::apply_x_length(int length) const
+    {
+        return to_coordinate(length * ::hypot(a, b));
+    }
+
+    int Transform::apply_y_length(int length) const
+    {
+        return to_coordinate(length * ::hypot(c, d));
+    }
+
+    bool Transform::is_identity() const
+    {
+        return a == 1 && b == 0 && c == 0 && d == 1 && e == 0 && f == 0;
+    }
+}
@@ -0,0 +1,70 @@
+//! @file Transform.hpp
+#ifndef __svg_Transform_hpp__
+#define __svg_Transform_hpp__
+
+#include "Point.hpp"
+
+namespace svg
+{
+    //! Round a number to an integer coordinate, clamped to the int range
+    //! (NaN gives INT_MIN), so that values out of range don't overflow.
+    //! @param value Number.
+    //! @return Rounded coordinate.
+    int to_coordinate(double value);
+
+    //! 2D affine transform, stored as the matrix of SVG's matrix(a b c d e f):
+    //! x' = a * x + c * y + e, y' = b * x + d * y + f.
+    struct Transform
+    {
+        double a;
+        double b;
+        double c;
+        double d;
+        double e;
+        double f;
+
+        //! Constructor of the identity transform.
+        Transform();
+        //! Constructor from matrix coefficients.
+        Transform(double a, double b, double c, double d, double e, double f);
+
+        //! Translation.
+        //! @param tx Translation along the X axis.
+        //! @param ty Translation along the Y axis.
+        //! @return Translation transform.
+        static Transform translation(double tx, double ty);
+        //! Rotation.
+        //! @param origin Rotation origin.
+        //! @param degrees Degrees of rotation.
+        //! @return Rotation transform.
+        static Transform rotation(const Point &origin, double degrees);
+        //! Scaling.
+        //! @param origin Scaling origin.
+        //! @param sx Scale along the X axis.
+        //! @param sy Scale along the Y axis.
+        //! @return Scaling transform.
+        static Transform scaling(const Point &origin, double sx, double sy);
+
+        //! Compose transforms.
+        //! @param t Transform to apply first.
+        //! @return Transform applying t, then this transform.
+        Transform operator*(const Transform &t) const;
+        //! Transform a point, rounding the result to the nearest integer coordinates
+        //! with to_coordinate.
+        //! @param p Point.
+        //! @return Transformed point.
+        Point apply(const Point &p) const;
+        //! Transform a length measured along the X axis.
+        //! @param length Length.
+        //! @return Length after the transform, rounded with to_coordinate.
+        int apply_x_length(int length) const;
+        //! Transform a length measured along the Y axis.
+        //! @param length Length.
+        //! @return Length after the transform, rounded with to_coordinate.
+        int apply_y_length(int length) const;
+        //! Check if this is the identity transform.
+        //! @return true if points are left unchanged.
+        bool is_identity() const;
+    };
+}
+#endif
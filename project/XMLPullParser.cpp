@@ -0,0 +1,354 @@
+#include "XMLPullParser.hpp"
+#include "external/tinyxml2/tinyxml2.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace svg
+{
+    //! Check for XML whitespace.
+    static bool is_space(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    //! Append a character code to a string, encoded in UTF-8.
+    static void append_utf8(std::string &s, unsigned long code)
+    {
+        if (code < 0x80)
+        {
+            s += (char)code;
+        }
+        else if (code < 0x800)
+        {
+            s += (char)(0xC0 | (code >> 6));
+            s += (char)(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000)
+        {
+            s += (char)(0xE0 | (code >> 12));
+            s += (char)(0x80 | ((code >> 6) & 0x3F));
+            s += (char)(0x80 | (code & 0x3F));
+        }
+        else
+        {
+            s += (char)(0xF0 | (code >> 18));
+            s += (char)(0x80 | ((code >> 12) & 0x3F));
+            s += (char)(0x80 | ((code >> 6) & 0x3F));
+            s += (char)(0x80 | (code & 0x3F));
+        }
+    }
+
+    XMLPullParser::XMLPullParser() : XMLPullParser("", 0)
+    {
+    }
+
+    XMLPullParser::XMLPullParser(const char *data, size_t size)
+    {
+        reset(data, size);
+    }
+
+    void XMLPullParser::reset(const char *data, size_t size)
+    {
+        // Empty buffers may have no data; the scans need a valid pointer.
+        if (size == 0)
+        {
+            data = "";
+        }
+        pos_ = data;
+        end_ = data + size;
+        event_ = END_ELEMENT;
+        empty_element_ = false;
+        root_read_ = false;
+        depth_ = 0;
+        attribute_count_ = 0;
+        // Byte order mark.
+        if (size >= 3 && std::memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+        {
+            pos_ += 3;
+        }
+    }
+
+    void XMLPullParser::error(const char *message) const
+    {
+        throw std::runtime_error(std::string("XML error: ") + message);
+    }
+
+    void XMLPullParser::skip_past(const char *end)
+    {
+        size_t length = std::strlen(end);
+        while (true)
+        {
+            const char *p = (const char *)std::memchr(pos_, end[0], end_ - pos_);
+            if (p == nullptr || (size_t)(end_ - p) < length)
+            {
+                error("unterminated markup");
+            }
+            pos_ = p + 1;
+            if (std::memcmp(p, end, length) == 0)
+            {
+                pos_ = p + length;
+                return;
+            }
+        }
+    }
+
+    void XMLPullParser::skip_space()
+    {
+        while (pos_ < end_ && is_space(*pos_))
+        {
+            pos_++;
+        }
+    }
+
+    void XMLPullParser::read_name(std::string &name)
+    {
+        const char *start = pos_;
+        while (pos_ < end_ && !is_space(*pos_) && *pos_ != '/' && *pos_ != '>' && *pos_ != '=')
+        {
+            pos_++;
+        }
+        if (pos_ == start)
+        {
+            error("expected a name");
+        }
+        name.assign(start, pos_);
+    }
+
+    void XMLPullParser::read_value(std::string &value)
+    {
+        if (pos_ == end_ || (*pos_ != '"' && *pos_ != '\''))
+        {
+            error("expected a quoted attribute value");
+        }
+        char quote = *pos_++;
+        const char *close = (const char *)std::memchr(pos_, quote, end_ - pos_);
+        if (close == nullptr)
+        {
+            error("unterminated attribute value");
+        }
+        const char *amp = (const char *)std::memchr(pos_, '&', close - pos_);
+        if (amp == nullptr)
+        {
+            value.assign(pos_, close);
+            pos_ = close + 1;
+            return;
+        }
+        value.assign(pos_, amp);
+        for (const char *p = amp; p < close;)
+        {
+            if (*p != '&')
+            {
+                value += *p++;
+                continue;
+            }
+            const char *semicolon = (const char *)std::memchr(p, ';', close - p);
+            size_t length = semicolon == nullptr ? 0 : semicolon - p + 1;
+            if (length > 3 && p[1] == '#')
+            {
+                bool hex = p[2] == 'x';
+                unsigned long code = std::strtoul(p + (hex ? 3 : 2), nullptr, hex ? 16 : 10);
+                append_utf8(value, code);
+            }
+            else if (length == 4 && std::memcmp(p, "&lt;", 4) == 0)
+            {
+                value += '<';
+            }
+            else if (length == 4 && std::memcmp(p, "&gt;", 4) == 0)
+            {
+                value += '>';
+            }
+            else if (length == 5 && std::memcmp(p, "&amp;", 5) == 0)
+            {
+                value += '&';
+            }
+            else if (length == 6 && std::memcmp(p, "&quot;", 6) == 0)
+            {
+                value += '"';
+            }
+            else if (length == 6 && std::memcmp(p, "&apos;", 6) == 0)
+            {
+                value += '\'';
+            }
+            else
+            {
+                // Unknown entities are kept as they are.
+                value += *p++;
+                continue;
+            }
+            p += length;
+        }
+        pos_ = close + 1;
+    }
+
+    void XMLPullParser::read_start_tag()
+    {
+        attribute_count_ = 0;
+        while (true)
+        {
+            skip_space();
+            if (pos_ == end_)
+            {
+                error("unterminated start tag");
+            }
+            if (*pos_ == '>')
+            {
+                pos_++;
+                empty_element_ = false;
+                return;
+            }
+            if (*pos_ == '/')
+            {
+                if (pos_ + 1 == end_ || pos_[1] != '>')
+                {
+                    error("expected '>' after '/'");
+                }
+                pos_ += 2;
+                empty_element_ = true;
+                return;
+            }
+            if (attribute_count_ == attributes_.size())
+            {
+                attributes_.push_back(Attribute());
+            }
+            Attribute &attribute = attributes_[attribute_count_++];
+            read_name(attribute.name);
+            skip_space();
+            if (pos_ == end_ || *pos_ != '=')
+            {
+                error("expected '=' after an attribute name");
+            }
+            pos_++;
+            skip_space();
+            read_value(attribute.value);
+        }
+    }
+
+    XMLPullParser::Event XMLPullParser::next()
+    {
+        if (event_ == START_ELEMENT && empty_element_)
+        {
+            depth_--;
+            event_ = END_ELEMENT;
+            return event_;
+        }
+        while (true)
+        {
+            const char *lt = (const char *)std::memchr(pos_, '<', end_ - pos_);
+            if (lt == nullptr)
+            {
+                if (depth_ > 0 || !root_read_)
+                {
+                    error("unexpected end of document");
+                }
+                pos_ = end_;
+                event_ = END_DOCUMENT;
+                return event_;
+            }
+            pos_ = lt + 1;
+            size_t left = end_ - pos_;
+            if (left >= 1 && *pos_ == '?')
+            {
+                skip_past("?>");
+            }
+            else if (left >= 3 && std::memcmp(pos_, "!--", 3) == 0)
+            {
+                skip_past("-->");
+            }
+            else if (left >= 8 && std::memcmp(pos_, "![CDATA[", 8) == 0)
+            {
+                skip_past("]]>");
+            }
+            else if (left >= 1 && *pos_ == '!')
+            {
+                // Document type declaration, possibly with an internal subset.
+                int brackets = 0;
+                for (; pos_ < end_ && (*pos_ != '>' || brackets > 0); pos_++)
+                {
+                    brackets += (*pos_ == '[') - (*pos_ == ']');
+                }
+                if (pos_ == end_)
+                {
+                    error("unterminated declaration");
+                }
+                pos_++;
+            }
+            else if (left >= 1 && *pos_ == '/')
+            {
+                pos_++;
+                if (depth_ == 0)
+                {
+                    error("unexpected end tag");
+                }
+                const char *start = pos_;
+                while (pos_ < end_ && !is_space(*pos_) && *pos_ != '>')
+                {
+                    pos_++;
+                }
+                const std::string &open = names_[depth_ - 1];
+                if (open.size() != (size_t)(pos_ - start) || open.compare(0, open.size(), start, pos_ - start) != 0)
+                {
+                    error("mismatched end tag");
+                }
+                skip_space();
+                if (pos_ == end_ || *pos_ != '>')
+                {
+                    error("expected '>' in end tag");
+                }
+                pos_++;
+                depth_--;
+                attribute_count_ = 0;
+                event_ = END_ELEMENT;
+                return event_;
+            }
+            else
+            {
+                if (depth_ == 0 && root_read_)
+                {
+                    error("more than one root element");
+                }
+                if ((size_t)depth_ == names_.size())
+                {
+                    names_.push_back(std::string());
+                }
+                read_name(names_[depth_]);
+                read_start_tag();
+                depth_++;
+                root_read_ = true;
+                event_ = START_ELEMENT;
+                return event_;
+            }
+        }
+    }
+
+    const char *XMLPullParser::attribute(const char *name) const
+    {
+        for (size_t i = 0; i < attribute_count_; i++)
+        {
+            if (attributes_[i].name == name)
+            {
+                return attributes_[i].value.c_str();
+            }
+        }
+        return nullptr;
+    }
+
+    int XMLPullParser::int_attribute(const char *name) const
+    {
+        int value = 0;
+        const char *s = attribute(name);
+        if (s != nullptr)
+        {
+            tinyxml2::XMLUtil::ToInt(s, &value);
+        }
+        return value;
+    }
+
+    void XMLPullParser::skip_element()
+    {
+        int depth = depth_;
+        while (next() != END_ELEMENT || depth_ >= depth)
+        {
+        }
+    }
+}
@@ -0,0 +1,104 @@
+//! @file XMLPullParser.hpp
+#ifndef __svg_XMLPullParser_hpp__
+#define __svg_XMLPullParser_hpp__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace svg
+{
+    //! Pull parser reading the elements of an XML document one at a time,
+    //! without building a tree. Text, comments, CDATA sections, processing
+    //! instructions and the document type declaration are skipped.
+    //! Malformed documents make next() throw std::runtime_error.
+    class XMLPullParser
+    {
+    public:
+        //! Parser events.
+        enum Event
+        {
+            //! Start tag; name() and the attributes are those of the element.
+            START_ELEMENT,
+            //! End tag, also reported after an empty-element tag such as <rect/>.
+            END_ELEMENT,
+            //! End of the document, after the end of the root element.
+            END_DOCUMENT
+        };
+
+        //! Constructor.
+        //! @param data Document text; it must stay valid while the parser is used.
+        //! @param size Size of the text in bytes.
+        XMLPullParser(const char *data, size_t size);
+        //! Constructor of a parser without a document, to be given one by reset().
+        XMLPullParser();
+        //! Start reading another document, reusing the buffers of the previous ones.
+        //! @param data Document text; it must stay valid while the parser is used.
+        //! @param size Size of the text in bytes.
+        void reset(const char *data, size_t size);
+        //! Read the next event.
+        //! @return The event.
+        Event next();
+        //! Get the name of the current element.
+        //! @return Name of the element of the last START_ELEMENT or END_ELEMENT event.
+        const std::string &name() const { return names_[depth_ - (event_ == START_ELEMENT)]; }
+        //! Get the number of open elements.
+        //! @return Depth of the current element, 1 for the root element.
+        int depth() const { return event_ == START_ELEMENT ? depth_ : depth_ + 1; }
+        //! Get an attribute of the current element, with entities replaced.
+        //! @param name Attribute name.
+        //! @return The value, valid until the next event, or nullptr if the attribute is absent.
+        const char *attribute(const char *name) const;
+        //! Get an integer attribute of the current element, converted as tinyxml2 does.
+        //! @param name Attribute name.
+        //! @return The value, or 0 if the attribute is absent or not an integer.
+        int int_attribute(const char *name) const;
+        //! Skip the content of the current element, up to and including its end tag.
+        //! Must be called right after a START_ELEMENT event.
+        void skip_element();
+
+    private:
+        //! Attribute of the current element.
+        struct Attribute
+        {
+            std::string name;
+            std::string value;
+        };
+        //! Throw an error about the document.
+        //! @param message Description of the error.
+        [[noreturn]] void error(const char *message) const;
+        //! Skip text up to a string.
+        //! @param end String ending the skipped text, which is skipped too.
+        void skip_past(const char *end);
+        //! Skip whitespace.
+        void skip_space();
+        //! Read a name.
+        //! @param name Destination.
+        void read_name(std::string &name);
+        //! Read an attribute value, replacing entities.
+        //! @param value Destination.
+        void read_value(std::string &value);
+        //! Read the attributes of a start tag, up to and including its '>'.
+        void read_start_tag();
+
+        //! Current position.
+        const char *pos_;
+        //! End of the text.
+        const char *end_;
+        //! Last event.
+        Event event_;
+        //! Set when the last start tag was an empty-element tag.
+        bool empty_element_;
+        //! Set once the root element has been read.
+        bool root_read_;
+        //! Number of open elements, after the last event.
+        int depth_;
+        //! Names of the open elements; entries are reused to avoid allocations.
+        std::vector<std::string> names_;
+        //! Attributes of the current element; entries are reused to avoid allocations.
+        std::vector<Attribute> attributes_;
+        //! Number of attributes of the current element.
+        size_t attribute_count_;
+    };
+}
+#endif
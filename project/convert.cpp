@@ -1,23 +1,489 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
+#include "CompiledSVG.hpp"
+#include "MappedFile.hpp"
+#include "RenderContext.hpp"
 #include "SVGElements.hpp"
 
 namespace svg
 {
-    void convert(const std::string &svg_file, const std::string &png_file)
+    //! Number of points, or of commands, after which StreamRenderer draws its batch.
+    const size_t STREAM_BATCH_SIZE = 1 << 16;
+
+    //! Background color of new images.
+    const Color BACKGROUND = {255, 255, 255};
+
+    //! Get the colors of a new image once commands are drawn on it.
+    //! @param drawn Colors of the commands.
+    //! @return The background color, then the colors of the commands.
+    static Palette image_palette(const Palette &drawn)
+    {
+        Palette palette;
+        palette.add(BACKGROUND);
+        palette.add(drawn);
+        return palette;
+    }
+
+    //! Get the size of the image of a document, and the transform scaling the
+    //! document to it, from the output size of the conversion options.
+    //! Throws std::invalid_argument if the output size is invalid, or larger
+    //! than the maximum number of pixels of the options.
+    //! @param options Conversion options.
+    //! @param dimensions Width and height of the document, set to those of the image.
+    //! @return Transform mapping the document to the image, the identity at the document size.
+    static Transform output_transform(const ConvertOptions &options, Point &dimensions)
+    {
+        if (options.width < 0 || options.height < 0 || !(options.scale > 0))
+        {
+            throw std::invalid_argument("Invalid output size");
+        }
+        if (dimensions.x <= 0 || dimensions.y <= 0)
+        {
+            throw std::runtime_error("Invalid image size");
+        }
+        double sx = options.scale, sy = options.scale;
+        if (options.width > 0)
+        {
+            sx = (double)options.width / dimensions.x;
+            sy = options.height > 0 ? (double)options.height / dimensions.y : sx;
+        }
+        else if (options.height > 0)
+        {
+            sx = sy = (double)options.height / dimensions.y;
+        }
+        double width = std::max(1.0, std::round(dimensions.x * sx));
+        double height = std::max(1.0, std::round(dimensions.y * sy));
+        // Checked before the image is allocated, in doubles that don't overflow.
+        if (width >= INT_MAX || height >= INT_MAX || width * height > (double)options.max_pixels)
+        {
+            throw std::invalid_argument("Image too large");
+        }
+        if (sx == 1 && sy == 1)
+        {
+            return Transform();
+        }
+        dimensions = {(int)width, (int)height};
+        return Transform::scaling({0, 0}, sx, sy);
+    }
+
+    //! Add commands to a display list, mapped by a transform.
+    //! @param commands Commands.
+    //! @param count Number of commands.
+    //! @param points Point pool.
+    //! @param t Transform, without rotation.
+    //! @param list Destination display list.
+    static void transform_commands(const DrawCommand *commands, size_t count, const Point *points,
+                                   const Transform &t, DisplayList &list)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const DrawCommand &cmd = commands[i];
+            const Point *p = points + cmd.first;
+            if (cmd.type == DRAW_ELLIPSE)
+            {
+                // The second point is the radius: lengths, as Ellipse::compile maps them.
+                Point ellipse[] = {t.apply(p[0]), {t.apply_x_length(p[1].x), t.apply_y_length(p[1].y)}};
+                list.add(DRAW_ELLIPSE, ellipse, 2, cmd.color);
+            }
+            else
+            {
+                list.add((DrawCommandType)cmd.type, p, cmd.count, cmd.color, t);
+            }
+        }
+    }
+
+    //! Draws the elements of a streamed document in batches, as they are read.
+    class StreamRenderer : public SVGStreamHandler
+    {
+    public:
+        //! Constructor.
+        //! @param img Image drawn on, reset to the image dimensions.
+        //! @param list Display list holding each batch.
+        //! @param pool Threads drawing the batches in tiles, or nullptr to draw them serially.
+        //! @param options Conversion options, giving the image size.
+        StreamRenderer(PNGImage &img, DisplayList &list, ThreadPool *pool, const ConvertOptions &options)
+            : img_(img), list_(list), pool_(pool), options_(options)
+        {
+        }
+
+        void begin(const Point &dimensions) override
+        {
+            Point size = dimensions;
+            output_ = output_transform(options_, size);
+            img_.reset(size.x, size.y);
+            palette_.add(BACKGROUND);
+        }
+
+        void element(const SVGElement &element, const Transform &parent) override
+        {
+            element.compile(list_, output_ * parent);
+            if (list_.points().size() >= STREAM_BATCH_SIZE || list_.commands().size() >= STREAM_BATCH_SIZE)
+            {
+                flush();
+            }
+        }
+
+        //! Draw the elements received since the last batch.
+        void flush()
+        {
+            if (pool_ != nullptr)
+            {
+                list_.draw(img_, *pool_);
+            }
+            else
+            {
+                list_.draw(img_);
+            }
+            palette_.add(list_.palette());
+            list_.clear();
+        }
+
+        //! Get the image.
+        //! @return Image drawn so far.
+        PNGImage &image() { return img_; }
+
+        //! Get the colors of the image.
+        //! @return Colors of the image drawn so far.
+        const Palette &palette() const { return palette_; }
+
+    private:
+        PNGImage &img_;
+        DisplayList &list_;
+        ThreadPool *pool_;
+        const ConvertOptions &options_;
+        //! Transform scaling the document to the image.
+        Transform output_;
+        Palette palette_;
+    };
+
+    //! Compiles the elements of a streamed document into a display list.
+    class StreamCompiler : public SVGStreamHandler
+    {
+    public:
+        //! Constructor.
+        //! @param dimensions Set to the image width and height.
+        //! @param list Destination display list.
+        //! @param options Conversion options, giving the image size.
+        StreamCompiler(Point &dimensions, DisplayList &list, const ConvertOptions &options)
+            : dimensions_(dimensions), list_(list), options_(options)
+        {
+        }
+
+        void begin(const Point &dimensions) override
+        {
+            dimensions_ = dimensions;
+            output_ = output_transform(options_, dimensions_);
+        }
+
+        void element(const SVGElement &element, const Transform &parent) override
+        {
+            element.compile(list_, output_ * parent);
+        }
+
+    private:
+        Point &dimensions_;
+        DisplayList &list_;
+        const ConvertOptions &options_;
+        //! Transform scaling the document to the image.
+        Transform output_;
+    };
+
+    //! SVG document to convert: a file, or text in memory.
+    struct SVGSource
+    {
+        //! Name of the file, or nullptr for text in memory.
+        const std::string *file;
+        //! Text in memory.
+        const char *data;
+        //! Size of the text.
+        size_t size;
+
+        //! Read the document.
+        //! @param dimensions Image width and height.
+        //! @param elements Destination elements.
+        //! @param arena Arena holding the elements.
+        void read(Point &dimensions, std::vector<SVGElement *> &elements, Arena &arena) const
+        {
+            if (file != nullptr)
+            {
+                readSVG(*file, dimensions, elements, arena);
+            }
+            else
+            {
+                readSVG(data, size, dimensions, elements, arena);
+            }
+        }
+
+        //! Stream the document to a handler.
+        //! @param handler Handler.
+        //! @param buffers Memory of the parser.
+        void stream(SVGStreamHandler &handler, SVGStreamBuffers &buffers) const
+        {
+            if (file != nullptr)
+            {
+                // The text is parsed directly from the mapping.
+                MappedFile mapped(*file);
+                streamSVG(mapped.data(), mapped.size(), handler, buffers);
+            }
+            else
+            {
+                streamSVG(data, size, handler, buffers);
+            }
+        }
+    };
+
+    //! Destination of the PNG image of a conversion: a file, or a sink.
+    struct ImageOutput
+    {
+        //! Name of the PNG file, or nullptr to write to the sink.
+        const std::string *file;
+        //! Destination of the PNG image, without file.
+        const PNGWriter::Sink *sink;
+        //! Encoding options.
+        const PNGOptions &options;
+        //! Threads encoding the image, or nullptr.
+        ThreadPool *pool;
+
+        //! Write the image.
+        //! @param dimensions Image width and height.
+        //! @param palette Colors of the image.
+        //! @param write_rows Function writing all rows of the image to the writer.
+        //! @param context Context of the conversion, whose writer writes to the sink.
+        void write(const Point &dimensions, const Palette &palette,
+                   const std::function<void(PNGWriter &)> &write_rows, RenderContext &context) const
+        {
+            if (file != nullptr)
+            {
+                write_png_file(*file, dimensions.x, dimensions.y, options, pool, &palette, write_rows);
+                return;
+            }
+            context.writer.start(*sink, dimensions.x, dimensions.y, options, pool, &palette);
+            write_rows(context.writer);
+            context.writer.finish();
+        }
+    };
+
+    //! Read a SVG document into the display list of a context.
+    //! @param source SVG document.
+    //! @param options Conversion options, giving the image size.
+    //! @param dimensions Image width and height.
+    //! @param context Context, holding the display list on return.
+    static void compile_document(const SVGSource &source, const ConvertOptions &options, Point &dimensions,
+                                 RenderContext &context)
+    {
+        source.read(dimensions, context.elements, context.arena);
+        Transform output = output_transform(options, dimensions);
+        for (SVGElement* e : context.elements)
+        {
+            e->compile(context.list, output);
+        }
+        // The document is only needed to fill the display list.
+        context.elements.clear();
+        context.arena.reset();
+    }
+
+    //! Draw commands and write the image, whole or band by band.
+    //! @param dimensions Image width and height.
+    //! @param commands Commands.
+    //! @param count Number of commands.
+    //! @param points Point pool.
+    //! @param drawn Colors of the commands.
+    //! @param options Conversion options.
+    //! @param pool Threads, or nullptr.
+    //! @param context Context, whose image is drawn on unless drawing in bands.
+    //! @param output Destination of the image.
+    static void render_commands(const Point &dimensions, const DrawCommand *commands, size_t count,
+                                const Point *points, const Palette &drawn, const ConvertOptions &options,
+                                ThreadPool *pool, RenderContext &context, const ImageOutput &output)
+    {
+        Palette palette = image_palette(drawn);
+        if (options.band_rows > 0)
+        {
+            output.write(dimensions, palette, [&](PNGWriter &writer) {
+                draw_commands_banded(dimensions, options.band_rows, commands, count, points, pool,
+                                     [&](const PNGImage &band) { band.write(writer); });
+            }, context);
+            return;
+        }
+        PNGImage &img = context.image;
+        img.reset(dimensions.x, dimensions.y);
+        if (pool != nullptr)
+        {
+            draw_commands_tiled(img, commands, count, points, *pool);
+        }
+        else
+        {
+            draw_commands(img, commands, count, points);
+        }
+        output.write(dimensions, palette, [&img](PNGWriter &writer) { img.write(writer); }, context);
+    }
+
+    //! Convert a SVG document.
+    //! @param source SVG document.
+    //! @param options Conversion options.
+    //! @param pool Threads, or nullptr.
+    //! @param context Context of the conversion.
+    //! @param output Destination of the image.
+    static void convert_document(const SVGSource &source, const ConvertOptions &options, ThreadPool *pool,
+                                 RenderContext &context, const ImageOutput &output)
     {
         Point dimensions;
-        std::vector<SVGElement *> svg_elements;
-        readSVG(svg_file, dimensions, svg_elements);
-        PNGImage img(dimensions.x, dimensions.y);
-        for (SVGElement* e : svg_elements)
+        DisplayList &list = context.list;
+        context.clear();
+        if (options.streaming)
         {
-            e->draw(img);
+            if (options.band_rows <= 0)
+            {
+                StreamRenderer renderer(context.image, list, pool, options);
+                source.stream(renderer, context.stream);
+                renderer.flush();
+                const PNGImage &img = renderer.image();
+                output.write({img.width(), img.height()}, renderer.palette(),
+                             [&img](PNGWriter &writer) { img.write(writer); }, context);
+                return;
+            }
+            // Bands need all elements before the first band is drawn:
+            // keep their display list only, without the document.
+            StreamCompiler compiler(dimensions, list, options);
+            source.stream(compiler, context.stream);
         }
-        img.save(png_file);
-        for (SVGElement* e  : svg_elements)
+        else
         {
-            delete e;
+            compile_document(source, options, dimensions, context);
         }
+        render_commands(dimensions, list.commands().data(), list.commands().size(), list.points().data(),
+                        list.palette(), options, pool, context, output);
+    }
+
+    //! Create the thread pool of a conversion.
+    //! @param options Conversion options.
+    //! @return Thread pool, or nullptr for conversions in the calling thread.
+    static std::unique_ptr<ThreadPool> create_pool(const ConvertOptions &options)
+    {
+        std::unique_ptr<ThreadPool> pool;
+        if (options.threads > 1)
+        {
+            pool.reset(new ThreadPool(options.threads));
+        }
+        return pool;
+    }
+
+    //! Convert a SVG or compiled SVG file to a PNG file.
+    //! @param svg_file Name of the SVG or compiled SVG file.
+    //! @param png_file Name of the PNG file.
+    //! @param options Conversion options.
+    //! @param pool Threads, or nullptr.
+    //! @param context Context of the conversion.
+    static void convert_file(const std::string &svg_file, const std::string &png_file,
+                             const ConvertOptions &options, ThreadPool *pool, RenderContext &context)
+    {
+        ImageOutput output = {&png_file, nullptr, options.png, pool};
+        if (CompiledSVG::is_compiled(svg_file))
+        {
+            CompiledSVG compiled(svg_file);
+            Point dimensions = compiled.dimensions();
+            Transform scaling = output_transform(options, dimensions);
+            if (scaling.is_identity())
+            {
+                render_commands(dimensions, compiled.commands(), compiled.command_count(),
+                                compiled.points(), compiled.palette(), options, pool, context, output);
+                return;
+            }
+            // The commands are scaled from their coordinates, already rounded.
+            DisplayList &list = context.list;
+            context.clear();
+            transform_commands(compiled.commands(), compiled.command_count(), compiled.points(), scaling, list);
+            render_commands(dimensions, list.commands().data(), list.commands().size(), list.points().data(),
+                            list.palette(), options, pool, context, output);
+            return;
+        }
+        convert_document({&svg_file, nullptr, 0}, options, pool, context, output);
+    }
+
+    void compileSVG(const std::string &svg_file, const std::string &compiled_file)
+    {
+        Point dimensions;
+        RenderContext context;
+        compile_document({&svg_file, nullptr, 0}, ConvertOptions(), dimensions, context);
+        CompiledSVG::save(compiled_file, dimensions, context.list);
+    }
+
+    void convert(const std::string &svg_file, const std::string &png_file,
+                 const ConvertOptions &options)
+    {
+        std::unique_ptr<ThreadPool> pool = create_pool(options);
+        RenderContext context;
+        convert_file(svg_file, png_file, options, pool.get(), context);
+    }
+
+    std::vector<std::string> convertBatch(const std::vector<ConvertJob> &jobs, const ConvertOptions &options)
+    {
+        std::vector<std::string> errors(jobs.size());
+        // Files are converted concurrently, each one in a single thread:
+        // with small files, splitting each file between threads costs more than it saves.
+        ConvertOptions file_options = options;
+        file_options.threads = 1;
+        ThreadPool pool(std::max(1, options.threads));
+        std::vector<std::unique_ptr<RenderContext>> contexts(pool.size());
+        pool.run(jobs.size(), [&](size_t job, int worker) {
+            if (contexts[worker] == nullptr)
+            {
+                contexts[worker].reset(new RenderContext());
+            }
+            try
+            {
+                convert_file(jobs[job].svg_file, jobs[job].png_file, file_options, nullptr, *contexts[worker]);
+            }
+            catch (const std::exception &e)
+            {
+                errors[job] = e.what();
+                if (errors[job].empty())
+                {
+                    errors[job] = "conversion failed";
+                }
+            }
+        });
+        return errors;
+    }
+
+    void convert(const char *svg_data, size_t svg_size, const PNGWriter::Sink &sink,
+                 const ConvertOptions &options)
+    {
+        RenderContext context;
+        convert(svg_data, svg_size, sink, options, context);
+    }
+
+    void convert(const char *svg_data, size_t svg_size, const PNGWriter::Sink &sink,
+                 const ConvertOptions &options, RenderContext &context)
+    {
+        // The threads are kept with the context, unless their number changes.
+        ThreadPool *pool = nullptr;
+        if (options.threads > 1)
+        {
+            if (context.pool == nullptr || context.pool->size() != options.threads)
+            {
+                context.pool = create_pool(options);
+            }
+            pool = context.pool.get();
+        }
+        convert_document({nullptr, svg_data, svg_size}, options, pool, context,
+                         {nullptr, &sink, options.png, pool});
+    }
+
+    std::vector<uint8_t> convert(const char *svg_data, size_t svg_size, const ConvertOptions &options)
+    {
+        std::vector<uint8_t> png;
+        convert(svg_data, svg_size, [&png](const uint8_t *data, size_t size) {
+            png.insert(png.end(), data, data + size);
+        }, options);
+        return png;
     }
-}
\ No newline at end of file
+}
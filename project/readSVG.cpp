@@ -1,8 +1,13 @@
 
 #include <iostream>
-#include <sstream>
 #include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
 #include "SVGElements.hpp"
+#include "MappedFile.hpp"
+#include "XMLPullParser.hpp"
 #include "external/tinyxml2/tinyxml2.h"
 
 using namespace std;
@@ -10,86 +15,606 @@ using namespace tinyxml2;
 
 namespace svg
 {   
-    /* global variable to store all the elements*/
-    std::vector<SVGElement*> full_svg_elements;
+    /**
+     * @brief state of the reading of one document; there is no global state,
+     * so documents can be read concurrently
+     * 
+     */
+    struct ParseContext
+    {
+        /* arena where the elements are created, or nullptr to create them with new */
+        Arena* arena;
+        /* elements read so far, by their id, when all of them are indexed (documents read whole);
+           when several elements have the same id, the first one read is kept (children are read
+           before the group that contains them) */
+        unordered_map<string, SVGElement*>* elements_by_id;
+        /* elements of the referenced ids, when only those are indexed (streamed documents),
+           with the same rule */
+        ReferencedElements* referenced;
+        /* id of the element being created; the string is reused for each element */
+        string& id;
+
+        ParseContext(Arena* arena, unordered_map<string, SVGElement*>& elements_by_id, string& id)
+            : arena(arena), elements_by_id(&elements_by_id), referenced(nullptr), id(id) {}
+        ParseContext(Arena* arena, ReferencedElements& referenced, string& id)
+            : arena(arena), elements_by_id(nullptr), referenced(&referenced), id(id) {}
+    };
 
     /** 
-     * @brief get the type of the element by its id
+     * @brief get the element with the given id, among the elements read so far
+     * @param context state of the reading of the document
      * @param id the id of the element
+     * @return the first element read with the id, or nullptr if there is none
     */
-    SVGElement * get_element_by_id(const string& id)
+    SVGElement * get_element_by_id(const ParseContext& context, const char* id)
+    {
+        if (context.referenced != nullptr)
+        {
+            return context.referenced->get_element(id);
+        }
+        unordered_map<string, SVGElement*>::const_iterator it = context.elements_by_id->find(string(id));
+        if (it == context.elements_by_id->end())
+        {
+            return nullptr;
+        }
+        return it->second;
+    }
+
+    /**
+     * @brief index an element read, so that use elements read after it can reference it
+     * @param context state of the reading of the document
+     * @param svg_element the element
+     */
+    void add_element_id(ParseContext& context, SVGElement* svg_element)
+    {
+        if (context.referenced != nullptr)
+        {
+            context.referenced->set_element(svg_element->get_id(), svg_element);
+        }
+        else
+        {
+            context.elements_by_id->emplace(svg_element->get_id(), svg_element);
+        }
+    }
+
+    /**
+     * @brief skip whitespace and commas, the separators of SVG number lists
+     * 
+     * @param s position in the string, moved past the separators
+     */
+    void skip_separators(const char*& s)
+    {
+        while (*s == ' ' || *s == ',' || *s == '\t' || *s == '\n' || *s == '\r' || *s == '\f')
+        {
+            s++;
+        }
+    }
+
+    /**
+     * @brief read a number in the SVG grammar (sign, integer part, fraction, exponent),
+     * such as "-12", "3.", ".5" or "1.5e-3"; "1.5.5" is read as the numbers 1.5 and .5
+     * 
+     * @param s position in the string, moved past the number if there is one
+     * @param value number read
+     * @return true if a number was read
+     */
+    bool scan_number(const char*& s, double& value)
     {
-        for (SVGElement * element : full_svg_elements)
+        static const double POWERS_OF_10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                              1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+                                              1e21, 1e22};
+        const char* p = s;
+        bool negative = false;
+        if (*p == '+' || *p == '-')
         {
-            if (element->get_id() == id)
+            negative = *p == '-';
+            p++;
+        }
+        /* up to 19 significant digits are kept in an integer; the others only scale the value */
+        unsigned long long mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool any_digit = false;
+        for (; *p >= '0' && *p <= '9'; p++)
+        {
+            any_digit = true;
+            if (digits < 19)
             {
-                return element;
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+            }
+            else
+            {
+                exponent++;
             }
         }
-        return nullptr;
+        if (*p == '.')
+        {
+            p++;
+            for (; *p >= '0' && *p <= '9'; p++)
+            {
+                any_digit = true;
+                if (digits < 19)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    digits += mantissa != 0;
+                    exponent--;
+                }
+            }
+        }
+        if (!any_digit)
+        {
+            return false;
+        }
+        if (*p == 'e' || *p == 'E')
+        {
+            /* the exponent is only part of the number if it has digits */
+            const char* q = p + 1;
+            bool negative_exponent = false;
+            if (*q == '+' || *q == '-')
+            {
+                negative_exponent = *q == '-';
+                q++;
+            }
+            if (*q >= '0' && *q <= '9')
+            {
+                int e = 0;
+                for (; *q >= '0' && *q <= '9'; q++)
+                {
+                    if (e < 10000)
+                    {
+                        e = e * 10 + (*q - '0');
+                    }
+                }
+                exponent += negative_exponent ? -e : e;
+                p = q;
+            }
+        }
+        value = (double)mantissa;
+        if (mantissa != 0 && exponent != 0)
+        {
+            if (exponent > 0 && exponent <= 22)
+            {
+                value *= POWERS_OF_10[exponent];
+            }
+            else if (exponent < 0 && exponent >= -22)
+            {
+                value /= POWERS_OF_10[-exponent];
+            }
+            else
+            {
+                value *= pow(10.0, exponent);
+            }
+        }
+        if (negative)
+        {
+            value = -value;
+        }
+        s = p;
+        return true;
     }
+
     /**
-     * @brief get a vector of points from a string
+     * @brief get a vector of points from a list of numbers, such as "10,20 30,40";
+     * reading stops at the first invalid number; a last unpaired number is ignored
      * used in ProcessElement (polygon, polyline)
      * 
-     * @param points_str 
-     * @return vector<Point> 
+     * @param points_str attribute value, or NULL for no points
+     * @param allocator allocator of the points
+     * @return PointVector 
      */
-    vector<Point> string_to_vector_of_points(string points_str)
+    PointVector string_to_vector_of_points(const char* points_str, const ArenaAllocator<Point>& allocator)
     {
-        replace(points_str.begin(), points_str.end(), ',', ' ');
-        istringstream iss(points_str);
-        vector<Point> points;
-        Point p;
-        while (iss >> p.x >> p.y)
+        PointVector points(allocator);
+        if (points_str == NULL)
+        {
+            return points;
+        }
+        /* count the numbers separated by whitespace or commas, to allocate the points once */
+        size_t numbers = 0;
+        bool in_number = false;
+        for (const char* p = points_str; *p != '\0'; p++)
         {
-            points.push_back(p);
+            bool separator = *p == ' ' || *p == ',' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\f';
+            numbers += !separator && !in_number;
+            in_number = !separator;
+        }
+        points.reserve(numbers / 2);
+        const char* s = points_str;
+        while (true)
+        {
+            double x, y;
+            skip_separators(s);
+            if (!scan_number(s, x))
+            {
+                break;
+            }
+            skip_separators(s);
+            if (!scan_number(s, y))
+            {
+                break;
+            }
+            points.push_back({to_coordinate(x), to_coordinate(y)});
         }
         return points;
     }
 
     /**
-     * @brief get a point from a string
-     * used in ProcessElement (translate, rotate, scale)
+     * @brief get a point from a string with two numbers, optionally between brackets
+     * used in ProcessElement (transform-origin)
      * 
      * @param point_str 
      * @return Point 
      */
-    Point string_to_point(string point_str)
+    Point string_to_point(const char* point_str)
     {
-        size_t start = point_str.find("(") + 1;
-        size_t end = point_str.find(")");
-        string values_str = point_str.substr(start, end - start);
-        replace(values_str.begin(), values_str.end(), ',', ' ');
-        istringstream iss(values_str);
-        Point translation;
-        iss >> translation.x >> translation.y;
-        return translation;
+        const char* s = point_str;
+        const char* bracket = strchr(s, '(');
+        if (bracket != NULL)
+        {
+            s = bracket + 1;
+        }
+        Point point = {0, 0};
+        double value;
+        skip_separators(s);
+        if (scan_number(s, value))
+        {
+            point.x = to_coordinate(value);
+            skip_separators(s);
+            if (scan_number(s, value))
+            {
+                point.y = to_coordinate(value);
+            }
+        }
+        return point;
     }
 
     /**
-     * @brief convert a string with brackets to an integer
-     * used in ProcessElement (rotate, scale)
+     * @brief get a transform from a transform list, such as "translate(10 10) rotate(45)";
+     * the transforms of the list are applied from right to left;
+     * supports matrix, translate, scale, rotate, skewX and skewY;
+     * an invalid list gives the identity transform
+     * used in ProcessElement (transform)
      * 
-     * @param int_str 
-     * @return int 
+     * @param transform_str attribute value
+     * @return Transform 
      */
-    int string_to_int(string int_str)
+    Transform string_to_transform(const char* transform_str)
     {
-        size_t start = int_str.find("(") + 1;
-        size_t end = int_str.find(")");
-        string angle_str = int_str.substr(start, end - start);
-        int value = stoi(angle_str);
-        return value;
+        Transform result;
+        const char* s = transform_str;
+        while (true)
+        {
+            skip_separators(s);
+            if (*s == '\0')
+            {
+                return result;
+            }
+            const char* name = s;
+            while (isalpha((unsigned char)*s))
+            {
+                s++;
+            }
+            string op(name, s - name);
+            while (isspace((unsigned char)*s))
+            {
+                s++;
+            }
+            if (*s != '(')
+            {
+                return Transform();
+            }
+            s++;
+            double v[6];
+            int n = 0;
+            while (true)
+            {
+                skip_separators(s);
+                if (*s == ')')
+                {
+                    s++;
+                    break;
+                }
+                double value;
+                if (n == 6 || !scan_number(s, value))
+                {
+                    return Transform();
+                }
+                v[n++] = value;
+            }
+            Transform t;
+            if (op == "matrix" && n == 6)
+            {
+                t = Transform(v[0], v[1], v[2], v[3], v[4], v[5]);
+            }
+            else if (op == "translate" && (n == 1 || n == 2))
+            {
+                t = Transform::translation(v[0], n == 2 ? v[1] : 0);
+            }
+            else if (op == "scale" && (n == 1 || n == 2))
+            {
+                t = Transform::scaling({0, 0}, v[0], n == 2 ? v[1] : v[0]);
+            }
+            else if (op == "rotate" && (n == 1 || n == 3))
+            {
+                Point origin = {0, 0};
+                if (n == 3)
+                {
+                    origin = {to_coordinate(v[1]), to_coordinate(v[2])};
+                }
+                t = Transform::rotation(origin, v[0]);
+            }
+            else if (op == "skewX" && n == 1)
+            {
+                t = Transform(1, 0, tan(v[0] * M_PI / 180.0), 1, 0, 0);
+            }
+            else if (op == "skewY" && n == 1)
+            {
+                t = Transform(1, tan(v[0] * M_PI / 180.0), 0, 1, 0, 0);
+            }
+            else
+            {
+                return Transform();
+            }
+            result = result * t;
+        }
     }
 
-    void process_element(XMLElement* element, vector<SVGElement *>& svg_elements)
+    /**
+     * @brief create an element, in the arena if there is one
+     * 
+     * @param arena arena of the document, or nullptr to create the element with new
+     * @param args arguments of the constructor
+     * @return T* 
+     */
+    template <typename T, typename... Args>
+    T* new_element(Arena* arena, Args&&... args)
     {
-        string element_name = element->Name();
+        if (arena != nullptr)
+        {
+            return arena->create<T>(std::forward<Args>(args)...);
+        }
+        return new T(std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief attributes of an element of a tinyxml2 document, with the
+     * interface of XMLPullParser used by create_element
+     * 
+     */
+    struct DOMAttributes
+    {
+        const XMLElement* element;
+
+        const char* attribute(const char* name) const { return element->Attribute(name); }
+        int int_attribute(const char* name) const { return element->IntAttribute(name); }
+    };
+
+    /**
+     * @brief get the transform of an element, from its transform and transform-origin attributes
+     * 
+     * @param attributes attributes of the element (DOMAttributes or XMLPullParser)
+     * @param transform the transform, or the identity if the element has no transform attribute
+     * @return true if the element has a transform attribute
+     */
+    template <typename Attributes>
+    bool get_element_transform(const Attributes& attributes, Transform& transform)
+    {
+        const char* transform_char = attributes.attribute("transform");
+        if (transform_char == NULL)
+        {
+            transform = Transform();
+            return false;
+        }
+        transform = string_to_transform(transform_char);
+        const char* origin_char = attributes.attribute("transform-origin");
+        if (origin_char != NULL)
+        {
+            /* the transform is applied around the origin */
+            Point origin = string_to_point(origin_char);
+            transform = Transform::translation(origin.x, origin.y)
+                      * transform
+                      * Transform::translation(-origin.x, -origin.y);
+        }
+        return true;
+    }
+
+    /**
+     * @brief get the alignment named by a part of a preserveAspectRatio value
+     * 
+     * @param s "Min", "Mid" or "Max", followed by other characters
+     * @return 0 for min, 1 for mid, 2 for max, -1 for other text
+     */
+    int get_alignment(const char* s)
+    {
+        static const char* const ALIGNMENTS[] = {"Min", "Mid", "Max"};
+        for (int i = 0; i < 3; i++)
+        {
+            if (strncmp(s, ALIGNMENTS[i], 3) == 0)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * @brief read a preserveAspectRatio value: an optional "defer" (which only applies
+     * to images, and is skipped), then "none" or x{Min|Mid|Max}Y{Min|Mid|Max}, then an
+     * optional "meet" or "slice", separated by whitespace; an invalid value is ignored,
+     * as if it was missing (xMidYMid meet)
+     * 
+     * @param value attribute value, or NULL
+     * @param align_x alignment of the viewBox in x: 0 for min, 1 for mid, 2 for max, -1 for none
+     * @param align_y alignment of the viewBox in y
+     * @param slice set to true if the viewBox covers the viewport, false if it fits in it
+     */
+    void get_aspect_ratio(const char* value, int& align_x, int& align_y, bool& slice)
+    {
+        align_x = align_y = 1;
+        slice = false;
+        /* split the value in up to 3 tokens */
+        const char* tokens[3];
+        size_t lengths[3];
+        int count = 0;
+        for (const char* s = value; s != NULL; )
+        {
+            while (isspace((unsigned char)*s))
+            {
+                s++;
+            }
+            if (*s == '\0')
+            {
+                break;
+            }
+            if (count == 3)
+            {
+                return;
+            }
+            tokens[count] = s;
+            while (*s != '\0' && !isspace((unsigned char)*s))
+            {
+                s++;
+            }
+            lengths[count] = s - tokens[count];
+            count++;
+        }
+        auto is = [&](int i, const char* keyword) {
+            return lengths[i] == strlen(keyword) && strncmp(tokens[i], keyword, lengths[i]) == 0;
+        };
+        int i = 0;
+        if (i < count && is(i, "defer"))
+        {
+            i++;
+        }
+        if (i == count)
+        {
+            return;
+        }
+        int x = -1, y = -1;
+        if (!is(i, "none"))
+        {
+            if (lengths[i] != 8 || tokens[i][0] != 'x' || tokens[i][4] != 'Y')
+            {
+                return;
+            }
+            x = get_alignment(tokens[i] + 1);
+            y = get_alignment(tokens[i] + 5);
+            if (x < 0 || y < 0)
+            {
+                return;
+            }
+        }
+        i++;
+        bool covers = false;
+        if (i < count)
+        {
+            covers = is(i, "slice");
+            if (!covers && !is(i, "meet"))
+            {
+                return;
+            }
+            i++;
+        }
+        if (i != count)
+        {
+            return;
+        }
+        align_x = x;
+        align_y = y;
+        slice = covers;
+    }
+
+    /**
+     * @brief get the size of the image of a document, and the transform mapping the
+     * user coordinates of its elements to the image, from the attributes of the root
+     * element: the viewBox rectangle is mapped to the width and height as
+     * preserveAspectRatio says (xMidYMid meet by default); a missing width or height
+     * is taken from the viewBox
+     * 
+     * @param attributes attributes of the root element (DOMAttributes or XMLPullParser)
+     * @param dimensions width and height of the image
+     * @return the transform, the identity without a valid viewBox
+     */
+    template <typename Attributes>
+    Transform get_root_viewport(const Attributes& attributes, Point& dimensions)
+    {
+        dimensions = {attributes.int_attribute("width"), attributes.int_attribute("height")};
+        const char* view_box_char = attributes.attribute("viewBox");
+        double view_box[4];
+        int count = 0;
+        for (const char* s = view_box_char; s != NULL && count < 4; count++)
+        {
+            skip_separators(s);
+            if (!scan_number(s, view_box[count]))
+            {
+                break;
+            }
+        }
+        /* a viewBox without 4 numbers, or with a negative or zero size, is ignored */
+        if (count < 4 || !(view_box[2] > 0) || !(view_box[3] > 0))
+        {
+            return Transform();
+        }
+        double x = view_box[0], y = view_box[1], w = view_box[2], h = view_box[3];
+        if (dimensions.x <= 0 && dimensions.y <= 0)
+        {
+            dimensions = {to_coordinate(w), to_coordinate(h)};
+        }
+        else if (dimensions.x <= 0)
+        {
+            dimensions.x = to_coordinate(dimensions.y * w / h);
+        }
+        else if (dimensions.y <= 0)
+        {
+            dimensions.y = to_coordinate(dimensions.x * h / w);
+        }
+        double sx = dimensions.x / w, sy = dimensions.y / h;
+        int align_x, align_y;
+        bool slice;
+        get_aspect_ratio(attributes.attribute("preserveAspectRatio"), align_x, align_y, slice);
+        if (align_x < 0)
+        {
+            return Transform(sx, 0, 0, sy, -x * sx, -y * sy);
+        }
+        double scale = slice ? std::max(sx, sy) : std::min(sx, sy);
+        double tx = -x * scale + (dimensions.x - w * scale) * align_x / 2;
+        double ty = -y * scale + (dimensions.y - h * scale) * align_y / 2;
+        return Transform(scale, 0, 0, scale, tx, ty);
+    }
+
+    /**
+     * @brief check the size of the image of a document, which can't be drawn without one;
+     * throws std::runtime_error if the width or height is missing, zero or negative
+     * 
+     * @param dimensions width and height of the image
+     */
+    void check_dimensions(const Point& dimensions)
+    {
+        if (dimensions.x <= 0 || dimensions.y <= 0)
+        {
+            throw runtime_error("SVG document without a valid width and height");
+        }
+    }
+
+    /**
+     * @brief create the element described by a tag and its attributes;
+     * a group is created empty, its elements are added by the caller
+     * 
+     * @param element_name name of the tag
+     * @param attributes attributes of the element (DOMAttributes or XMLPullParser)
+     * @param arena arena where the element is created, or nullptr to create it with new
+     * @param context state of the reading of the document, to resolve references
+     * @return the element, or nullptr for unknown elements and unresolved references
+     */
+    template <typename Attributes>
+    SVGElement* create_element(const string& element_name, const Attributes& attributes, Arena* arena, ParseContext& context)
+    {
+        ArenaAllocator<Point> allocator(arena);
         /* pointer to the element to be created; creating the element outside the if statements saves some lines */
         SVGElement* svg_element = nullptr;
-        const char* id_char = element->Attribute("id");    
-        string id;
+        const char* id_char = attributes.attribute("id");    
+        string& id = context.id;
         /* If the element doesn't have an id, id_char will be NULL */
         if (id_char!=NULL)
         {
@@ -100,143 +625,393 @@ namespace svg
         }
         if (element_name == "polygon")
         {
-            string points_str = element->Attribute("points");
-            vector<Point> points=string_to_vector_of_points(points_str);
-            Color fill_color=parse_color(element->Attribute("fill"));
-            svg_element = new Polygon(points,fill_color,id);
+            PointVector points=string_to_vector_of_points(attributes.attribute("points"), allocator);
+            Color fill_color=parse_color(attributes.attribute("fill"));
+            svg_element = new_element<Polygon>(arena, std::move(points),fill_color,id);
         }
         else if (element_name == "rect")
         {
             Point top_left;
-            top_left.x = element->IntAttribute("x");
-            top_left.y = element->IntAttribute("y");
-            int width = element->IntAttribute("width");
-            int height = element->IntAttribute("height");
+            top_left.x = attributes.int_attribute("x");
+            top_left.y = attributes.int_attribute("y");
+            int width = attributes.int_attribute("width");
+            int height = attributes.int_attribute("height");
             Point width_and_height={width-1,height-1};      /* -1 because the width and height begin in 0 */
-            Color fill_color=parse_color(element->Attribute("fill"));
-            svg_element = new Rect(top_left, width_and_height, fill_color,id);
+            Color fill_color=parse_color(attributes.attribute("fill"));
+            svg_element = new_element<Rect>(arena, top_left, width_and_height, fill_color, id, allocator);
         }
         else if (element_name == "ellipse")
         {
             Point center;
-            center.x = element->IntAttribute("cx");
-            center.y = element->IntAttribute("cy");
+            center.x = attributes.int_attribute("cx");
+            center.y = attributes.int_attribute("cy");
             Point radius;
-            radius.x = element->IntAttribute("rx");
-            radius.y = element->IntAttribute("ry");
-            Color fill_color=parse_color(element->Attribute("fill"));
-            svg_element = new Ellipse(center, radius, fill_color, id);
+            radius.x = attributes.int_attribute("rx");
+            radius.y = attributes.int_attribute("ry");
+            Color fill_color=parse_color(attributes.attribute("fill"));
+            svg_element = new_element<Ellipse>(arena, center, radius, fill_color, id);
         }
         else if (element_name == "circle")
         {
             Point center;
-            center.x = element->IntAttribute("cx");
-            center.y = element->IntAttribute("cy");
-            int radius = element->IntAttribute("r");
-            Color fill_color=parse_color(element->Attribute("fill"));
-            svg_element = new Circle(center, radius,fill_color,id);
+            center.x = attributes.int_attribute("cx");
+            center.y = attributes.int_attribute("cy");
+            int radius = attributes.int_attribute("r");
+            Color fill_color=parse_color(attributes.attribute("fill"));
+            svg_element = new_element<Circle>(arena, center, radius,fill_color,id);
         }
         else if (element_name == "polyline")
         {
-            string points_str = element->Attribute("points");
-            vector<Point> points=string_to_vector_of_points(points_str);
-            Color fill_color=parse_color(element->Attribute("stroke"));
-            svg_element = new Polyline(points,fill_color,id);
+            PointVector points=string_to_vector_of_points(attributes.attribute("points"), allocator);
+            Color fill_color=parse_color(attributes.attribute("stroke"));
+            svg_element = new_element<Polyline>(arena, std::move(points),fill_color,id);
         }
         else if (element_name == "line")
         {
             Point start;
-            start.x = element->IntAttribute("x1");
-            start.y = element->IntAttribute("y1");
+            start.x = attributes.int_attribute("x1");
+            start.y = attributes.int_attribute("y1");
             Point end;
-            end.x = element->IntAttribute("x2");
-            end.y = element->IntAttribute("y2");
-            Color fill_color=parse_color(element->Attribute("stroke"));
-            svg_element = new Line(start, end,fill_color,id);
+            end.x = attributes.int_attribute("x2");
+            end.y = attributes.int_attribute("y2");
+            Color fill_color=parse_color(attributes.attribute("stroke"));
+            svg_element = new_element<Line>(arena, start, end,fill_color,id, allocator);
         }
         else if (element_name == "g") /* group element */
         {
-            Group* group_element = new Group({},id);
-            svg_element = group_element;
-            for (XMLElement* child = element->FirstChildElement(); child != NULL; child = child->NextSiblingElement())
-            {
-                process_element(child, group_element->get_elements()); /* recursive call in case of nested groups  */
-            }
+            /* elements created in the arena are destroyed by the arena, not by the group */
+            svg_element = new_element<Group>(arena, vector<SVGElement*>(), id, arena == nullptr, allocator);
         }
         else if (element_name == "use") 
         {
-            string href = element->Attribute("href");
-            string old_id = href.substr(1);
-            SVGElement* referenced_element = get_element_by_id(old_id);
-            if (referenced_element != nullptr)
+            const char* href = attributes.attribute("href");
+            if (href != NULL && href[0] == '#')
             {
-                svg_element = referenced_element->clone(id);
+                SVGElement* referenced_element = get_element_by_id(context, href + 1);
+                if (referenced_element != nullptr)
+                {
+                    /* the geometry is shared with the referenced element */
+                    svg_element = new_element<Use>(arena, referenced_element, id);
+                }
             }
         }
 
-        if (svg_element != nullptr)
+        Transform transform;
+        if (svg_element != nullptr && get_element_transform(attributes, transform))
         {
-            const char* transform_char = element->Attribute("transform");
-            if (transform_char != NULL)
+            svg_element->add_transform(transform);
+        }
+        return svg_element;
+    }
+
+    template <typename Elements>
+    void process_element(XMLElement* element, Elements& svg_elements, ParseContext& context)
+    {
+        string element_name = element->Name();
+        SVGElement* svg_element = create_element(element_name, DOMAttributes{element}, context.arena, context);
+        /* unknown elements and unresolved references are skipped */
+        if (svg_element == nullptr)
+        {
+            return;
+        }
+        if (element_name == "g")
+        {
+            Group* group_element = static_cast<Group*>(svg_element);
+            for (XMLElement* child = element->FirstChildElement(); child != NULL; child = child->NextSiblingElement())
             {
-                string transform_str = transform_char;
-                if (transform_str.find("translate") != string::npos)
-                {
-                    Point translation = string_to_point(transform_str);
-                    svg_element->translate(translation);
-                }
-                else if (transform_str.find("rotate") != string::npos)
-                {
-                    int angle = string_to_int(transform_str);
-                    const char* origin_char = element->Attribute("transform-origin");
-                    Point origin;
-                    if (origin_char != NULL)
-                    {
-                        string origin_str = origin_char;
-                        origin = string_to_point(origin_str);
-                    }else {
-                        origin.x = 0;
-                        origin.y = 0;
-                    }
-                    svg_element->rotate(origin, angle);
-                }
-                else if (transform_str.find("scale") != string::npos)
-                {
-                    int scale=string_to_int(transform_str);
-                    const char* origin_char = element->Attribute("transform-origin");
-                    Point origin;
-                    if (origin_char != NULL)
-                    {
-                        string origin_str = origin_char;
-                        origin = string_to_point(origin_str);
-                    }else {
-                        origin.x = 0;
-                        origin.y = 0;
-                    }
-                    svg_element->scale(origin, scale);
-                }
-            }    
+                process_element(child, group_element->get_elements(), context); /* recursive call in case of nested groups  */
+            }
         }
-        full_svg_elements.push_back(svg_element);       
-        svg_elements.push_back(svg_element); 
+        add_element_id(context, svg_element);
+        svg_elements.push_back(svg_element);
     }
 
-    void readSVG(const string& svg_file, Point& dimensions, vector<SVGElement *>& svg_elements)
+    /**
+     * @brief read the elements of a parsed SVG document
+     * 
+     * @param doc 
+     * @param dimensions 
+     * @param svg_elements 
+     * @param arena arena where the elements are created, or nullptr to create them with new
+     */
+    void read_document(XMLDocument& doc, Point& dimensions, vector<SVGElement *>& svg_elements, Arena* arena)
+    {
+        unordered_map<string, SVGElement*> elements_by_id;
+        string id;
+        ParseContext context(arena, elements_by_id, id);
+        XMLElement *xml_elem = doc.RootElement();
+
+        Transform root = get_root_viewport(DOMAttributes{xml_elem}, dimensions);
+        check_dimensions(dimensions);
+        size_t first = svg_elements.size();
+        
+        for (XMLElement* child = xml_elem->FirstChildElement(); child != NULL; child = child->NextSiblingElement())
+        {
+            process_element(child, svg_elements, context);
+        }
+        if (!root.is_identity())
+        {
+            /* the elements are drawn in the group of the viewBox transform */
+            vector<SVGElement*> elements(svg_elements.begin() + first, svg_elements.end());
+            svg_elements.resize(first);
+            Group* group = new_element<Group>(arena, elements, "undefined", arena == nullptr);
+            group->add_transform(root);
+            svg_elements.push_back(group);
+        }
+    }
+
+    /**
+     * @brief load a SVG file in a tinyxml2 document
+     * 
+     * @param svg_file 
+     * @param doc 
+     */
+    void load_document(const string& svg_file, XMLDocument& doc)
     {
-        XMLDocument doc;
         XMLError r = doc.LoadFile(svg_file.c_str());
         if (r != XML_SUCCESS)
         {
             throw runtime_error("Unable to load " + svg_file);
         }
-        XMLElement *xml_elem = doc.RootElement();
+    }
 
-        dimensions.x = xml_elem->IntAttribute("width");
-        dimensions.y = xml_elem->IntAttribute("height");
-        
-        for (XMLElement* child = xml_elem->FirstChildElement(); child != NULL; child = child->NextSiblingElement())
+    /**
+     * @brief parse SVG text in a tinyxml2 document; tinyxml2 parses a copy of the text
+     * 
+     * @param data 
+     * @param size 
+     * @param doc 
+     */
+    void parse_document(const char* data, size_t size, XMLDocument& doc)
+    {
+        XMLError r = doc.Parse(data, size);
+        if (r != XML_SUCCESS)
         {
-            process_element(child, svg_elements);
+            throw runtime_error("Unable to parse SVG data");
+        }
+    }
+
+    void readSVG(const string& svg_file, Point& dimensions, vector<SVGElement *>& svg_elements)
+    {
+        XMLDocument doc;
+        load_document(svg_file, doc);
+        read_document(doc, dimensions, svg_elements, nullptr);
+    }
+
+    void readSVG(const string& svg_file, Point& dimensions, vector<SVGElement *>& svg_elements, Arena& arena)
+    {
+        XMLDocument doc;
+        load_document(svg_file, doc);
+        read_document(doc, dimensions, svg_elements, &arena);
+    }
+
+    void readSVG(const char* data, size_t size, Point& dimensions, vector<SVGElement *>& svg_elements, Arena& arena)
+    {
+        XMLDocument doc;
+        parse_document(data, size, doc);
+        read_document(doc, dimensions, svg_elements, &arena);
+    }
+
+    void ReferencedElements::add(const char* id, size_t length)
+    {
+        if (count_ == ids_.size())
+        {
+            ids_.emplace_back();
+        }
+        /* the string keeps its capacity from the previous documents */
+        ids_[count_++].assign(id, length);
+    }
+
+    void ReferencedElements::sort()
+    {
+        /* strings are moved, not copied, so sorting doesn't allocate */
+        std::sort(ids_.begin(), ids_.begin() + count_);
+        count_ = std::unique(ids_.begin(), ids_.begin() + count_) - ids_.begin();
+        elements_.assign(count_, nullptr);
+    }
+
+    size_t ReferencedElements::find(const char* id) const
+    {
+        vector<string>::const_iterator end = ids_.begin() + count_;
+        vector<string>::const_iterator it = std::lower_bound(ids_.begin(), end, id,
+            [](const string& a, const char* b) { return a.compare(b) < 0; });
+        return it != end && it->compare(id) == 0 ? it - ids_.begin() : count_;
+    }
+
+    void ReferencedElements::set_element(const string& id, SVGElement* element)
+    {
+        size_t i = find(id.c_str());
+        if (i != count_ && elements_[i] == nullptr)
+        {
+            elements_[i] = element;
+        }
+    }
+
+    SVGElement* ReferencedElements::get_element(const char* id) const
+    {
+        size_t i = find(id);
+        return i != count_ ? elements_[i] : nullptr;
+    }
+
+    /**
+     * @brief get the ids referenced by href attributes, found by scanning the text
+     * of the document; text that only looks like an href can add ids, which is harmless
+     * 
+     * @param data text of the document
+     * @param size size of the text
+     * @param ids set to the ids, sorted
+     */
+    void get_referenced_ids(const char* data, size_t size, ReferencedElements& ids)
+    {
+        ids.clear();
+        if (size == 0)
+        {
+            return; /* data may be null */
+        }
+        const char* end = data + size;
+        for (const char* p = data; (p = (const char*)memchr(p, 'h', end - p)) != NULL; p++)
+        {
+            if (end - p < 4 || memcmp(p, "href", 4) != 0)
+            {
+                continue;
+            }
+            const char* q = p + 4;
+            while (q < end && isspace((unsigned char)*q))
+            {
+                q++;
+            }
+            if (q == end || *q != '=')
+            {
+                continue;
+            }
+            q++;
+            while (q < end && isspace((unsigned char)*q))
+            {
+                q++;
+            }
+            if (end - q < 2 || (*q != '"' && *q != '\'') || q[1] != '#')
+            {
+                continue;
+            }
+            const char* close = (const char*)memchr(q + 2, *q, end - q - 2);
+            if (close != NULL)
+            {
+                ids.add(q + 2, close - q - 2);
+            }
+        }
+        ids.sort();
+    }
+
+    /**
+     * @brief create an element and its content from the parser, which is at the start
+     * of the element, and read up to the end of the element
+     * 
+     * @param parser 
+     * @param context state of the reading of the document; the element is created in its arena
+     * @return the element, or nullptr for unknown elements and unresolved references
+     */
+    SVGElement* build_element(XMLPullParser& parser, ParseContext& context)
+    {
+        bool is_group = parser.name() == "g";
+        SVGElement* svg_element = create_element(parser.name(), parser, context.arena, context);
+        if (svg_element != nullptr && is_group)
+        {
+            Group* group_element = static_cast<Group*>(svg_element);
+            while (parser.next() == XMLPullParser::START_ELEMENT)
+            {
+                SVGElement* child = build_element(parser, context);
+                if (child != nullptr)
+                {
+                    group_element->add_element(child);
+                }
+            }
+        }
+        else
+        {
+            parser.skip_element();
+        }
+        if (svg_element != nullptr)
+        {
+            add_element_id(context, svg_element);
+        }
+        return svg_element;
+    }
+
+    void streamSVG(const string& svg_file, SVGStreamHandler& handler)
+    {
+        /* the text is parsed directly from the mapping */
+        MappedFile file(svg_file);
+        streamSVG(file.data(), file.size(), handler);
+    }
+
+    void streamSVG(const char* data, size_t size, SVGStreamHandler& handler)
+    {
+        SVGStreamBuffers buffers;
+        streamSVG(data, size, handler, buffers);
+    }
+
+    void streamSVG(const char* data, size_t size, SVGStreamHandler& handler, SVGStreamBuffers& buffers)
+    {
+        /* only elements that may be referenced are kept after they are drawn */
+        ReferencedElements& referenced = buffers.referenced;
+        /* the elements of the previous document are forgotten before their arena is reused */
+        get_referenced_ids(data, size, referenced);
+        buffers.document.reset();
+        ParseContext context(&buffers.document, referenced, buffers.id);
+        /* arena of the elements that are drawn and discarded */
+        Arena& scratch = buffers.scratch;
+
+        XMLPullParser& parser = buffers.parser;
+        parser.reset(data, size);
+        parser.next();
+        Point dimensions;
+        Transform root = get_root_viewport(parser, dimensions);
+        check_dimensions(dimensions);
+        handler.begin(dimensions);
+        /* transforms of the open groups, composed with the transforms of their parents,
+           starting with the viewBox transform */
+        vector<Transform>& transforms = buffers.transforms;
+        transforms.assign(1, root);
+        string& id = buffers.id;
+        while (true)
+        {
+            if (parser.next() == XMLPullParser::END_ELEMENT)
+            {
+                if (parser.depth() == 1)
+                {
+                    break;
+                }
+                transforms.pop_back();
+                continue;
+            }
+            const char* id_char = parser.attribute("id");
+            id = id_char != NULL ? id_char : "undefined";
+            if (referenced.contains(id))
+            {
+                SVGElement* svg_element = build_element(parser, context);
+                if (svg_element != nullptr)
+                {
+                    handler.element(*svg_element, transforms.back());
+                }
+            }
+            else if (parser.name() == "g")
+            {
+                /* the elements of the group are streamed like those of the root */
+                Transform transform;
+                get_element_transform(parser, transform);
+                transforms.push_back(transforms.back() * transform);
+            }
+            else
+            {
+                SVGElement* svg_element = create_element(parser.name(), parser, &scratch, context);
+                parser.skip_element();
+                if (svg_element != nullptr)
+                {
+                    handler.element(*svg_element, transforms.back());
+                }
+                /* the blocks are kept: large elements don't allocate them again and again */
+                scratch.reset();
+            }
         }
     }
 
@@ -0,0 +1,156 @@
+#include "RenderServer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+//! Connect to a render server, waiting for it to start for up to 5 seconds.
+//! @param socket_path Path of the server socket.
+//! @return Client, or nullptr.
+static svg::RenderClient *connect_client(const std::string &socket_path)
+{
+    Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+    while (true)
+    {
+        try
+        {
+            return new svg::RenderClient(socket_path);
+        }
+        catch (const std::runtime_error &)
+        {
+            if (Clock::now() > deadline)
+            {
+                return nullptr;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+}
+
+//! Get a percentile of sorted latencies.
+//! @param sorted Latencies in seconds, in increasing order.
+//! @param p Percentile, from 0 to 100.
+//! @return Latency in milliseconds.
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    size_t i = std::min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()));
+    return sorted[i] * 1e3;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> files;
+    int connections = 4;
+    int requests = 1000;
+    svg::ConvertOptions options;
+    bool valid = true;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--connections" && i + 1 < argc)
+        {
+            connections = std::atoi(argv[++i]);
+            valid = valid && connections >= 1;
+        }
+        else if (arg == "--requests" && i + 1 < argc)
+        {
+            requests = std::atoi(argv[++i]);
+            valid = valid && requests >= 1;
+        }
+        else if (arg == "--fast")
+        {
+            options.png = svg::PNGOptions::fast();
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            valid = false;
+        }
+        else
+        {
+            files.push_back(arg);
+        }
+    }
+    if (!valid || files.size() != 2)
+    {
+        std::cout << "Usage: svgload SOCKET in_file.svg [--connections N] [--requests N] [--fast]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::ifstream in(files[1], std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "Unable to read " << files[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string svg_text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    // Each connection sends its requests one after the other.
+    std::vector<double> latencies;
+    size_t failures = 0;
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+    Clock::time_point start = Clock::now();
+    for (int c = 0; c < connections; c++)
+    {
+        int count = requests / connections + (c < requests % connections ? 1 : 0);
+        threads.emplace_back([&, count] {
+            std::vector<double> times;
+            size_t failed = 0;
+            std::unique_ptr<svg::RenderClient> client(connect_client(files[0]));
+            std::vector<uint8_t> png;
+            for (int r = 0; r < count; r++)
+            {
+                Clock::time_point sent = Clock::now();
+                try
+                {
+                    if (client == nullptr)
+                    {
+                        client.reset(new svg::RenderClient(files[0]));
+                    }
+                    client->render(svg_text.data(), svg_text.size(), options, png);
+                    times.push_back(std::chrono::duration<double>(Clock::now() - sent).count());
+                }
+                catch (const std::exception &e)
+                {
+                    if (failed++ == 0)
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        std::cerr << "Request failed: " << e.what() << std::endl;
+                    }
+                    client.reset();
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            latencies.insert(latencies.end(), times.begin(), times.end());
+            failures += failed;
+        });
+    }
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::cout << "Requests: " << latencies.size() << " ok, " << failures << " failed, "
+              << connections << " connections" << std::endl;
+    if (latencies.empty())
+    {
+        return EXIT_FAILURE;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << std::fixed << std::setprecision(3)
+              << "Throughput: " << latencies.size() / elapsed << " requests/s" << std::endl
+              << "Latency: p50 " << percentile(latencies, 50) << " ms, p99 " << percentile(latencies, 99)
+              << " ms, max " << latencies.back() * 1e3 << " ms" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
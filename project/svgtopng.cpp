@@ -1,17 +1,300 @@
+#include "RenderCache.hpp"
+#include "RenderServer.hpp"
 #include "SVGElements.hpp"
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+
+//! Read the jobs of a manifest: one pair of input and output file names per line.
+//! @param in Manifest.
+//! @param jobs Destination jobs.
+//! @return false if a line doesn't hold two names.
+static bool read_manifest(std::istream &in, std::vector<svg::ConvertJob> &jobs)
+{
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        svg::ConvertJob job;
+        if (!(fields >> job.svg_file))
+        {
+            continue;
+        }
+        std::string extra;
+        if (!(fields >> job.png_file) || (fields >> extra))
+        {
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+//! Convert a batch of files, reporting the files that failed.
+//! @param jobs Files to convert.
+//! @param options Conversion options.
+//! @return Exit status.
+static int convert_batch(const std::vector<svg::ConvertJob> &jobs, const svg::ConvertOptions &options)
+{
+    std::vector<std::string> errors = svg::convertBatch(jobs, options);
+    size_t failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        if (!errors[i].empty())
+        {
+            std::cerr << jobs[i].svg_file << ": " << errors[i] << std::endl;
+            failed++;
+        }
+    }
+    std::cout << "Converted " << jobs.size() - failed << " of " << jobs.size() << " files" << std::endl;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//! Serve render requests on a socket until SIGINT or SIGTERM.
+//! @param socket_path Path of the socket.
+//! @param threads Number of rendering threads.
+//! @param queue_size Maximum number of requests waiting to be rendered.
+//! @param cache Cache of the rendered images, or nullptr.
+//! @return Exit status.
+static int serve(const std::string &socket_path, int threads, size_t queue_size, svg::RenderCache *cache)
+{
+    // The signals are blocked in all threads but one waiting for them,
+    // which stops the server.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    svg::RenderServer server(socket_path, threads, queue_size, cache);
+    std::thread stopper([&] {
+        int signal;
+        sigwait(&signals, &signal);
+        server.stop();
+    });
+    std::cout << "Serving on " << socket_path << std::endl;
+    try
+    {
+        server.run();
+    }
+    catch (...)
+    {
+        pthread_kill(stopper.native_handle(), SIGTERM);
+        stopper.join();
+        throw;
+    }
+    stopper.join();
+    if (cache != nullptr)
+    {
+        svg::RenderCacheStats stats = cache->stats();
+        std::cout << "Cache: " << stats.memory_hits << " memory hits, " << stats.disk_hits << " disk hits, "
+                  << stats.misses << " misses, " << stats.memory_evictions + stats.disk_evictions << " evictions"
+                  << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
 
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    svg::ConvertOptions options;
+    std::vector<std::string> files;
+    bool valid = true;
+    bool compile = false;
+    bool batch = false;
+    std::string manifest;
+    std::string socket_path;
+    int queue_size = 64;
+    std::string cache_directory;
+    bool cache = false;
+    size_t cache_memory = 256;
+    size_t cache_disk = 1024;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            options.threads = std::atoi(argv[++i]);
+            valid = valid && options.threads >= 1;
+        }
+        else if (arg == "--bands" && i + 1 < argc)
+        {
+            options.band_rows = std::atoi(argv[++i]);
+            valid = valid && options.band_rows >= 1;
+        }
+        else if (arg == "--width" && i + 1 < argc)
+        {
+            options.width = std::atoi(argv[++i]);
+            valid = valid && options.width >= 1;
+        }
+        else if (arg == "--height" && i + 1 < argc)
+        {
+            options.height = std::atoi(argv[++i]);
+            valid = valid && options.height >= 1;
+        }
+        else if (arg == "--scale" && i + 1 < argc)
+        {
+            options.scale = std::atof(argv[++i]);
+            valid = valid && options.scale > 0;
+        }
+        else if (arg == "--level" && i + 1 < argc)
+        {
+            options.png.level = std::atoi(argv[++i]);
+            valid = valid && options.png.level >= 0 && options.png.level <= 9;
+        }
+        else if (arg == "--filter" && i + 1 < argc)
+        {
+            std::string filter = argv[++i];
+            if (filter == "none")
+            {
+                options.png.filter = svg::PNG_FILTER_NONE;
+            }
+            else if (filter == "sub")
+            {
+                options.png.filter = svg::PNG_FILTER_SUB;
+            }
+            else if (filter == "up")
+            {
+                options.png.filter = svg::PNG_FILTER_UP;
+            }
+            else if (filter == "adaptive")
+            {
+                options.png.filter = svg::PNG_FILTER_ADAPTIVE;
+            }
+            else
+            {
+                valid = false;
+            }
+        }
+        else if (arg == "--truecolor")
+        {
+            options.png.palette = false;
+        }
+        else if (arg == "--fast")
+        {
+            options.png = svg::PNGOptions::fast();
+        }
+        else if (arg == "--small")
+        {
+            options.png = svg::PNGOptions::small();
+        }
+        else if (arg == "--compile")
+        {
+            compile = true;
+        }
+        else if (arg == "--batch")
+        {
+            batch = true;
+        }
+        else if (arg == "--manifest" && i + 1 < argc)
+        {
+            batch = true;
+            manifest = argv[++i];
+        }
+        else if (arg == "--serve" && i + 1 < argc)
+        {
+            socket_path = argv[++i];
+        }
+        else if (arg == "--queue" && i + 1 < argc)
+        {
+            queue_size = std::atoi(argv[++i]);
+            valid = valid && queue_size >= 1;
+        }
+        else if (arg == "--cache" && i + 1 < argc)
+        {
+            cache = true;
+            cache_directory = argv[++i];
+        }
+        else if (arg == "--cache-memory" && i + 1 < argc)
+        {
+            cache = true;
+            cache_memory = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--cache-disk" && i + 1 < argc)
+        {
+            cache = true;
+            cache_disk = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--stream")
+        {
+            options.streaming = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            valid = false;
+        }
+        else
+        {
+            files.push_back(arg);
+        }
+    }
+    // The cache is only used by the server.
+    valid = valid && (!cache || !socket_path.empty());
+    // Images larger than the limit are rejected before they are drawn; so is their request.
+    valid = valid && (double)options.width * options.height <= (double)options.max_pixels;
+    std::vector<svg::ConvertJob> jobs;
+    if (batch && valid && !compile)
     {
-        std::cout << "Usage: svgtopng in_file.svg out_file.png" << std::endl;
+        // Pairs of names from the command line, then from the manifest.
+        valid = files.size() % 2 == 0;
+        for (size_t i = 0; valid && i < files.size(); i += 2)
+        {
+            jobs.push_back({files[i], files[i + 1]});
+        }
+        if (valid && manifest == "-")
+        {
+            valid = read_manifest(std::cin, jobs);
+        }
+        else if (valid && !manifest.empty())
+        {
+            std::ifstream in(manifest);
+            if (!in)
+            {
+                std::cerr << "Unable to read " << manifest << std::endl;
+                return EXIT_FAILURE;
+            }
+            valid = read_manifest(in, jobs);
+        }
+    }
+    if (valid && !socket_path.empty() && files.empty() && !batch && !compile)
+    {
+        std::unique_ptr<svg::RenderCache> render_cache;
+        if (cache)
+        {
+            render_cache.reset(new svg::RenderCache(cache_directory, cache_memory << 20, cache_disk << 20));
+        }
+        return serve(socket_path, options.threads, queue_size, render_cache.get());
+    }
+    if (!valid || (!batch && files.size() != 2) || (batch && compile) || !socket_path.empty())
+    {
+        std::cout << "Usage: svgtopng [--threads N] [--stream] [--bands ROWS] [--fast|--small] [--level 0-9]" << std::endl;
+        std::cout << "                [--width N] [--height N] [--scale F]" << std::endl;
+        std::cout << "                [--filter none|sub|up|adaptive] [--truecolor] in_file.svg|in_file.svgc out_file.png" << std::endl;
+        std::cout << "       svgtopng --batch [options] [in_file out_file]... [--manifest FILE|-]" << std::endl;
+        std::cout << "       svgtopng --compile in_file.svg out_file.svgc" << std::endl;
+        std::cout << "       svgtopng --serve SOCKET [--threads N] [--queue REQUESTS]" << std::endl;
+        std::cout << "                [--cache DIR] [--cache-memory MB] [--cache-disk MB]" << std::endl;
+    }
+    else if (batch)
+    {
+        return convert_batch(jobs, options);
+    }
+    else if (compile)
+    {
+        std::cout << "Compiling ... " << files[0] << " --> " << files[1] << std::endl;
+        svg::compileSVG(files[0], files[1]);
+        std::cout << "Done!" << std::endl;
     }
     else
     {
-        std::cout << "Performing conversion ... " << argv[1] << " --> " << argv[2] << std::endl;
-        svg::convert(argv[1], argv[2]);
+        std::cout << "Performing conversion ... " << files[0] << " --> " << files[1] << std::endl;
+        svg::convert(files[0], files[1], options);
         std::cout << "Done!" << std::endl;
     }
     return 0;
-}
\ No newline at end of file
+}
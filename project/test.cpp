@@ -1,17 +1,30 @@
 
 // Project file headers
 #include "SVGElements.hpp"
+#include "CompiledSVG.hpp"
+#include "RenderCache.hpp"
+#include "RenderContext.hpp"
+#include "RenderServer.hpp"
+#include "ThreadPool.hpp"
+#include "external/stb/stb_image.h"
 
 // C++ library headers
 #include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
 #include <cstdlib>
 #include <cassert>
+#include <cctype>
 #include <iostream>
 #include <iomanip>
 #include <string>
 #include <vector>
 #include <iterator>
 #include <fstream>
+#include <new>
+#include <stdexcept>
+#include <thread>
 using namespace std;
 
 // POSIX headers
@@ -20,6 +33,31 @@ using namespace std;
 #include <sys/wait.h>
 #include <dirent.h>
 
+// Heap allocations, counted to check conversions that must not allocate.
+static atomic<size_t> heap_allocations(0);
+
+void *operator new(size_t size)
+{
+    heap_allocations++;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+// Undefined behavior fails the test reporting it, as memory errors do.
+extern "C" const char *__ubsan_default_options()
+{
+    return "halt_on_error=1:print_stacktrace=1";
+}
+
 namespace svg
 {
     const string LOG_FILE_NAME = "test_log.txt";
@@ -33,12 +71,155 @@ namespace svg
         int failed_tests = 0;
         FILE *log_stream;
 
-        bool run_conversion_test(const string &id)
+        //! Load a 32-bit big-endian integer of a PNG file.
+        static uint32_t get_u32_be(const uint8_t *p)
         {
-            string svg_file = root_path + "/input/" + id + ".svg";
-            string exp_file = root_path + "/expected/" + id + ".png";
-            string out_file = root_path + "/output/" + id + ".png";
-            convert(svg_file, out_file);
+            return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+        }
+
+        //! CRC-32 of PNG chunks, computed bit by bit, independently of the encoder.
+        static uint32_t crc32(const uint8_t *data, size_t size)
+        {
+            uint32_t crc = 0xFFFFFFFF;
+            for (size_t i = 0; i < size; i++)
+            {
+                crc ^= data[i];
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+                }
+            }
+            return crc ^ 0xFFFFFFFF;
+        }
+
+        //! Adler-32 of zlib streams, computed independently of the encoder.
+        static uint32_t adler32(const uint8_t *data, size_t size)
+        {
+            uint32_t a = 1, b = 0;
+            for (size_t i = 0; i < size; i++)
+            {
+                a = (a + data[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+            return b << 16 | a;
+        }
+
+        //! Count the id attributes of an SVG text too long to be stored
+        //! in a string without allocating.
+        static size_t long_ids(const string &text)
+        {
+            size_t count = 0;
+            for (size_t pos = text.find(" id=\""); pos != string::npos; pos = text.find(" id=\"", pos + 1))
+            {
+                size_t end = text.find('"', pos + 5);
+                if (end != string::npos && end - pos - 5 > string().capacity())
+                {
+                    count++;
+                }
+            }
+            return count;
+        }
+
+        // Check the framing and checksums of a PNG file, which stb_image
+        // doesn't check: the chunks and their CRC, the header, the zlib
+        // stream of the IDAT chunks and its Adler-32, and the rows it holds.
+        bool verify_png(const string &file)
+        {
+            ifstream in(file, ios::binary);
+            vector<uint8_t> png((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+            static const uint8_t SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+            if (png.size() < 8 || !equal(SIGNATURE, SIGNATURE + 8, png.begin()))
+            {
+                cout << file << ": no PNG signature" << endl;
+                return false;
+            }
+            vector<uint8_t> idat;
+            uint32_t width = 0, height = 0;
+            int bit_depth = 0, color_type = 0;
+            bool end = false;
+            for (size_t pos = 8; !end; )
+            {
+                if (png.size() - pos < 12 || png.size() - pos - 12 < get_u32_be(&png[pos]))
+                {
+                    cout << file << ": truncated chunk at " << pos << endl;
+                    return false;
+                }
+                uint32_t length = get_u32_be(&png[pos]);
+                string type(png.begin() + pos + 4, png.begin() + pos + 8);
+                const uint8_t *data = &png[pos + 8];
+                if (crc32(&png[pos + 4], length + 4) != get_u32_be(data + length))
+                {
+                    cout << file << ": bad CRC of " << type << " chunk" << endl;
+                    return false;
+                }
+                if ((pos == 8) != (type == "IHDR"))
+                {
+                    cout << file << ": IHDR isn't the first chunk" << endl;
+                    return false;
+                }
+                if (type == "IHDR")
+                {
+                    // 8-bit RGB, or palette images, without interlacing.
+                    width = get_u32_be(data);
+                    height = get_u32_be(data + 4);
+                    bit_depth = data[8];
+                    color_type = data[9];
+                    if (length != 13 || width == 0 || height == 0 || data[10] != 0 || data[11] != 0 ||
+                        data[12] != 0 || (color_type == 2 ? bit_depth != 8 : color_type != 3 ||
+                                          (bit_depth != 1 && bit_depth != 2 && bit_depth != 4 && bit_depth != 8)))
+                    {
+                        cout << file << ": invalid header" << endl;
+                        return false;
+                    }
+                }
+                else if (type == "IDAT")
+                {
+                    idat.insert(idat.end(), data, data + length);
+                }
+                end = type == "IEND";
+                pos += 12 + length;
+                if (end && pos != png.size())
+                {
+                    cout << file << ": data after IEND" << endl;
+                    return false;
+                }
+            }
+            // zlib header: deflate with a 32 KiB window, without a dictionary.
+            if (idat.size() < 6 || (idat[0] & 0x0F) != 8 || (idat[0] >> 4) > 7 || (idat[1] & 0x20) != 0 ||
+                (idat[0] << 8 | idat[1]) % 31 != 0)
+            {
+                cout << file << ": invalid zlib header" << endl;
+                return false;
+            }
+            int size = 0;
+            uint8_t *rows = (uint8_t *)stbi_zlib_decode_noheader_malloc((const char *)idat.data() + 2,
+                                                                        (int)idat.size() - 6, &size);
+            if (rows == nullptr)
+            {
+                cout << file << ": invalid deflate stream" << endl;
+                return false;
+            }
+            size_t row_size = 1 + ((size_t)width * (color_type == 2 ? 3 : 1) * bit_depth + 7) / 8;
+            bool valid = (size_t)size == row_size * height &&
+                         adler32(rows, size) == get_u32_be(&idat[idat.size() - 4]);
+            for (uint32_t y = 0; valid && y < height; y++)
+            {
+                valid = rows[y * row_size] <= 4;
+            }
+            free(rows);
+            if (!valid)
+            {
+                cout << file << ": bad Adler-32, size or row filters of the image data" << endl;
+            }
+            return valid;
+        }
+
+        bool compare_images(const string &exp_file, const string &out_file)
+        {
+            if (!verify_png(out_file))
+            {
+                return false;
+            }
             PNGImage img1(exp_file), img2(out_file);
             int w1 = img1.width(), h1 = img1.height(),
                 w2 = img2.width(), h2 = img2.height();
@@ -67,6 +248,987 @@ namespace svg
             return true;
         }
 
+        bool run_conversion_test(const string &id)
+        {
+            string exp_file = root_path + "/expected/" + id + ".png";
+            string out_file = root_path + "/output/" + id + ".png";
+            convert(svg_path(id), out_file);
+            return compare_images(exp_file, out_file);
+        }
+
+        //! Names of the documents of the corpus, without their extension, in order.
+        vector<string> corpus_ids()
+        {
+            vector<string> ids;
+            string dir_path = root_path + "/input";
+            ::DIR *directory = ::opendir(dir_path.c_str());
+            if (directory == nullptr)
+            {
+                cerr << "Unable to open input directory " << dir_path << endl;
+                return ids;
+            }
+            ::dirent *entry;
+            while ((entry = readdir(directory)) != nullptr)
+            {
+                if (entry->d_type == DT_REG)
+                {
+                    string fname = entry->d_name;
+                    ids.push_back(fname.substr(0, fname.find_last_of('.')));
+                }
+            }
+            ::closedir(directory);
+            sort(ids.begin(), ids.end());
+            return ids;
+        }
+
+        string svg_path(const string &id)
+        {
+            return root_path + "/input/" + id + ".svg";
+        }
+
+        string read_svg(const string &id)
+        {
+            ifstream svg_in(svg_path(id), ios::binary);
+            return string((istreambuf_iterator<char>(svg_in)), istreambuf_iterator<char>());
+        }
+
+        //! Compile a document of the corpus to a display list file.
+        //! @return Name of the display list file.
+        string compile_svg(const string &id)
+        {
+            string compiled_file = root_path + "/output/" + id + ".svgc";
+            compileSVG(svg_path(id), compiled_file);
+            return compiled_file;
+        }
+
+        //! A way of converting a document of the corpus: draws it to a PNG
+        //! file, and checks what the mode adds to the conversion (reused
+        //! memory, errors, cache statistics); false if these checks fail.
+        typedef bool (TestDriver::*Render)(const string &id, const string &out_file);
+
+        //! Convert a document of the corpus with a mode, and compare the
+        //! image to the expected one.
+        bool render_and_compare(const string &mode, Render render, const string &id)
+        {
+            string exp_file = root_path + "/expected/" + id + ".png";
+            string out_file = root_path + "/output/" + id + "_" + mode + ".png";
+            if (!(this->*render)(id, out_file) || !compare_images(exp_file, out_file))
+            {
+                cout << "(" << id << ", " << mode << ")" << endl;
+                return false;
+            }
+            return true;
+        }
+
+        //! Convert all the documents of the corpus with a mode.
+        bool check_corpus(const string &mode, Render render)
+        {
+            bool success = true;
+            for (const string &id : corpus_ids())
+            {
+                success = render_and_compare(mode, render, id) && success;
+            }
+            return success;
+        }
+
+        // Tiled rendering.
+        bool render_tiled(const string &id, const string &out_file)
+        {
+            ConvertOptions tiled;
+            tiled.threads = 4;
+            convert(svg_path(id), out_file, tiled);
+            return true;
+        }
+
+        // Drawing elements as they are read (encoded with the fast PNG preset).
+        bool render_streaming(const string &id, const string &out_file)
+        {
+            ConvertOptions streaming;
+            streaming.streaming = true;
+            streaming.png = PNGOptions::fast();
+            convert(svg_path(id), out_file, streaming);
+            return true;
+        }
+
+        // Drawing bands of rows, one at a time, from the elements read as a
+        // stream (with tiles in each band).
+        bool render_banded(const string &id, const string &out_file)
+        {
+            ConvertOptions banded;
+            banded.streaming = true;
+            banded.band_rows = 50;
+            banded.threads = 4;
+            convert(svg_path(id), out_file, banded);
+            return true;
+        }
+
+        // Converting the text in memory to PNG bytes in memory.
+        bool render_memory(const string &id, const string &out_file)
+        {
+            string svg_text = read_svg(id);
+            vector<uint8_t> png = convert(svg_text.data(), svg_text.size());
+            ofstream(out_file, ios::binary).write((const char *)png.data(), png.size());
+            return true;
+        }
+
+        // With a render context, streaming the document again reuses the
+        // framebuffer and only allocates the elements' ids too long for
+        // short strings.
+        bool render_context(const string &id, const string &out_file)
+        {
+            string svg_text = read_svg(id);
+            ConvertOptions reused;
+            reused.streaming = true;
+            RenderContext context;
+            vector<uint8_t> png;
+            PNGWriter::Sink sink = [&png](const uint8_t *data, size_t size) {
+                png.insert(png.end(), data, data + size);
+            };
+            convert(svg_text.data(), svg_text.size(), sink, reused, context);
+            const Color *framebuffer = &context.image.at(0, 0);
+            png.clear();
+            size_t allocations = heap_allocations;
+            convert(svg_text.data(), svg_text.size(), sink, reused, context);
+            allocations = heap_allocations - allocations;
+            ofstream(out_file, ios::binary).write((const char *)png.data(), png.size());
+            if (allocations != long_ids(svg_text) || &context.image.at(0, 0) != framebuffer)
+            {
+                cout << "(" << allocations << " allocations)" << endl;
+                return false;
+            }
+            return true;
+        }
+
+        // Reading the document whole allocates its XML tree each time, but
+        // the framebuffer and the encoder are still reused, so the second
+        // conversion with a render context allocates less than the first.
+        bool render_context_whole(const string &id, const string &out_file)
+        {
+            string svg_text = read_svg(id);
+            RenderContext context;
+            vector<uint8_t> png;
+            PNGWriter::Sink sink = [&png](const uint8_t *data, size_t size) {
+                png.insert(png.end(), data, data + size);
+            };
+            size_t first_allocations = heap_allocations;
+            convert(svg_text.data(), svg_text.size(), sink, ConvertOptions(), context);
+            first_allocations = heap_allocations - first_allocations;
+            const Color *framebuffer = &context.image.at(0, 0);
+            png.clear();
+            size_t allocations = heap_allocations;
+            convert(svg_text.data(), svg_text.size(), sink, ConvertOptions(), context);
+            allocations = heap_allocations - allocations;
+            ofstream(out_file, ios::binary).write((const char *)png.data(), png.size());
+            if (allocations >= first_allocations || &context.image.at(0, 0) != framebuffer)
+            {
+                cout << "(" << first_allocations << " then " << allocations << " allocations)" << endl;
+                return false;
+            }
+            return true;
+        }
+
+        // Drawing the saved display list (encoded with the small PNG preset).
+        bool render_compiled(const string &id, const string &out_file)
+        {
+            ConvertOptions compiled;
+            compiled.png = PNGOptions::small();
+            convert(compile_svg(id), out_file, compiled);
+            return true;
+        }
+
+        // Batch conversions, with workers reusing their memory between
+        // files; the missing file must fail alone.
+        bool render_batch(const string &id, const string &out_file)
+        {
+            return render_batch_file(id, svg_path(id), out_file);
+        }
+
+        // The same, from the display list.
+        bool render_batch_compiled(const string &id, const string &out_file)
+        {
+            return render_batch_file(id, compile_svg(id), out_file);
+        }
+
+        bool render_batch_file(const string &id, const string &in_file, const string &out_file)
+        {
+            ConvertOptions batch;
+            batch.threads = 2;
+            vector<ConvertJob> jobs = {{root_path + "/input/" + id + "_missing.svg", out_file + ".missing"},
+                                       {in_file, out_file}};
+            vector<string> errors = convertBatch(jobs, batch);
+            return !errors[0].empty() && errors[1].empty();
+        }
+
+        // Rendering on a server, through a socket; a failed request must
+        // leave the connection usable.
+        bool render_served(const string &id, const string &out_file)
+        {
+            string svg_text = read_svg(id);
+            string socket_path = root_path + "/output/" + id + ".sock";
+            RenderServer server(socket_path, 2, 1);
+            thread server_thread([&server] { server.run(); });
+            bool served = true;
+            vector<uint8_t> png;
+            {
+                RenderClient client(socket_path);
+                try
+                {
+                    client.render("<svg", 4, ConvertOptions(), png);
+                    served = false;
+                }
+                catch (const runtime_error &)
+                {
+                }
+                client.render(svg_text.data(), svg_text.size(), ConvertOptions(), png);
+            }
+            server.stop();
+            server_thread.join();
+            ofstream(out_file, ios::binary).write((const char *)png.data(), png.size());
+            return served;
+        }
+
+        // Converting through a cache: the first conversion draws the image,
+        // the second one is found in memory, and a new cache on the same
+        // directory finds the file (the directory of a previous run is
+        // removed first, so that its files don't hide the drawing).
+        bool render_cached(const string &id, const string &out_file)
+        {
+            string svg_text = read_svg(id);
+            string cache_dir = root_path + "/output/cache_" + id;
+            remove_directory(cache_dir);
+            vector<uint8_t> png, cached;
+            {
+                RenderCache cache(cache_dir, 1 << 20, 16 << 20);
+                cache.convert(svg_text.data(), svg_text.size(), ConvertOptions(), png);
+                cache.convert(svg_text.data(), svg_text.size(), ConvertOptions(), cached);
+                RenderCacheStats stats = cache.stats();
+                if (stats.misses != 1 || stats.memory_hits != 1 || stats.disk_hits != 0 || cached != png)
+                {
+                    cout << "(cache in memory)" << endl;
+                    return false;
+                }
+            }
+            RenderCache cache(cache_dir, 1 << 20, 16 << 20);
+            cache.convert(svg_text.data(), svg_text.size(), ConvertOptions(), cached);
+            ofstream(out_file, ios::binary).write((const char *)cached.data(), cached.size());
+            if (cache.stats().disk_hits != 1 || cached != png)
+            {
+                cout << "(cache directory)" << endl;
+                return false;
+            }
+            return true;
+        }
+
+        bool check_corpus_banded() { return check_corpus("banded", &TestDriver::render_banded); }
+        bool check_corpus_batch() { return check_corpus("batch", &TestDriver::render_batch); }
+        bool check_corpus_batch_compiled() { return check_corpus("batch_compiled", &TestDriver::render_batch_compiled); }
+        bool check_corpus_cached() { return check_corpus("cached", &TestDriver::render_cached); }
+        bool check_corpus_compiled() { return check_corpus("compiled", &TestDriver::render_compiled); }
+        bool check_corpus_context() { return check_corpus("context", &TestDriver::render_context); }
+        bool check_corpus_context_whole() { return check_corpus("context_whole", &TestDriver::render_context_whole); }
+        bool check_corpus_memory() { return check_corpus("memory", &TestDriver::render_memory); }
+        bool check_corpus_served() { return check_corpus("served", &TestDriver::render_served); }
+        bool check_corpus_streaming() { return check_corpus("streaming", &TestDriver::render_streaming); }
+        bool check_corpus_tiled() { return check_corpus("tiled", &TestDriver::render_tiled); }
+
+        // Output sizes: half the size, then a width with the height keeping
+        // the aspect ratio, from the document and from the display list.
+        // The pixels at other sizes are checked by check_output_size.
+        bool check_corpus_sizes()
+        {
+            bool success = true;
+            for (const string &id : corpus_ids())
+            {
+                PNGImage exp_img(root_path + "/expected/" + id + ".png");
+                int w = exp_img.width(), h = exp_img.height();
+                ConvertOptions half;
+                half.scale = 0.5;
+                string half_file = root_path + "/output/" + id + "_half.png";
+                convert(svg_path(id), half_file, half);
+                PNGImage half_img(half_file);
+                ConvertOptions sized;
+                sized.width = 64;
+                sized.streaming = true;
+                string sized_file = root_path + "/output/" + id + "_sized.png";
+                convert(compile_svg(id), sized_file, sized);
+                PNGImage sized_img(sized_file);
+                int sized_height = max(1, (int)lround(64.0 * h / w));
+                if (half_img.width() != max(1, (int)lround(w * 0.5)) ||
+                    half_img.height() != max(1, (int)lround(h * 0.5)) ||
+                    sized_img.width() != 64 || sized_img.height() != sized_height)
+                {
+                    cout << "(" << id << ", output size)" << endl;
+                    success = false;
+                }
+            }
+            return success;
+        }
+
+        //! A test that doesn't depend on the input corpus.
+        typedef bool (TestDriver::*Check)();
+
+        //! Get the tests that don't depend on the input corpus, named "check_...".
+        static const vector<pair<string, Check>> &checks()
+        {
+            static const vector<pair<string, Check>> all = {
+                {"check_aspect_ratio", &TestDriver::check_aspect_ratio},
+                {"check_batch_errors", &TestDriver::check_batch_errors},
+                {"check_cache_eviction", &TestDriver::check_cache_eviction},
+                {"check_color_names", &TestDriver::check_color_names},
+                {"check_compiled_header", &TestDriver::check_compiled_header},
+                {"check_corpus_banded", &TestDriver::check_corpus_banded},
+                {"check_corpus_batch", &TestDriver::check_corpus_batch},
+                {"check_corpus_batch_compiled", &TestDriver::check_corpus_batch_compiled},
+                {"check_corpus_cached", &TestDriver::check_corpus_cached},
+                {"check_corpus_compiled", &TestDriver::check_corpus_compiled},
+                {"check_corpus_context", &TestDriver::check_corpus_context},
+                {"check_corpus_context_whole", &TestDriver::check_corpus_context_whole},
+                {"check_corpus_memory", &TestDriver::check_corpus_memory},
+                {"check_corpus_served", &TestDriver::check_corpus_served},
+                {"check_corpus_sizes", &TestDriver::check_corpus_sizes},
+                {"check_corpus_streaming", &TestDriver::check_corpus_streaming},
+                {"check_corpus_tiled", &TestDriver::check_corpus_tiled},
+                {"check_empty_document", &TestDriver::check_empty_document},
+                {"check_image_limit", &TestDriver::check_image_limit},
+                {"check_large_circle", &TestDriver::check_large_circle},
+                {"check_large_coordinates", &TestDriver::check_large_coordinates},
+                {"check_large_ellipse", &TestDriver::check_large_ellipse},
+                {"check_output_size", &TestDriver::check_output_size},
+                {"check_png_encoding", &TestDriver::check_png_encoding},
+                {"check_server_errors", &TestDriver::check_server_errors},
+                {"check_transform_range", &TestDriver::check_transform_range},
+                {"check_use_clone", &TestDriver::check_use_clone},
+            };
+            return all;
+        }
+
+        //! Remove a directory of files, if it exists.
+        void remove_directory(const string &directory)
+        {
+            ::DIR *dir = ::opendir(directory.c_str());
+            if (dir == nullptr)
+            {
+                return;
+            }
+            while (::dirent *entry = ::readdir(dir))
+            {
+                string name = entry->d_name;
+                if (name != "." && name != "..")
+                {
+                    ::unlink((directory + "/" + name).c_str());
+                }
+            }
+            ::closedir(dir);
+            ::rmdir(directory.c_str());
+        }
+
+        //! Write a file for a test.
+        void write_file(const string &file, const string &text)
+        {
+            ofstream(file, ios::binary).write(text.data(), text.size());
+        }
+
+        // preserveAspectRatio values are read as tokens; invalid ones are ignored.
+        bool check_aspect_ratio()
+        {
+            auto render = [](const string &aspect) {
+                string text = "<svg width=\"40\" height=\"20\" viewBox=\"0 0 10 10\"" +
+                              (aspect.empty() ? string() : " preserveAspectRatio=\"" + aspect + "\"") +
+                              "><rect x=\"0\" y=\"0\" width=\"10\" height=\"10\" fill=\"red\"/></svg>";
+                return convert(text.data(), text.size());
+            };
+            vector<uint8_t> centered = render(""), right = render("xMaxYMax");
+            vector<pair<string, const vector<uint8_t> *>> values = {
+                {"xMidYMid meet", &centered}, {" defer  xMaxYMax\tmeet ", &right}, {"defer xMaxYMax", &right},
+                {"xMaxYMax bogus", &centered}, {"xMaxYMax meet slice", &centered}, {"xmaxymax", &centered},
+                {"defer", &centered}, {"xMaxYMaxx", &centered}, {"yMaxxMax", &centered}};
+            for (const pair<string, const vector<uint8_t> *> &value : values)
+            {
+                if (render(value.first) != *value.second)
+                {
+                    cout << "(preserveAspectRatio=\"" << value.first << "\")" << endl;
+                    return false;
+                }
+            }
+            return centered != right && render("none") != centered;
+        }
+
+        // Invalid documents in a batch fail alone, read at once or as a stream.
+        bool check_batch_errors()
+        {
+            string prefix = root_path + "/output/check_batch_";
+            string circle = "<circle cx=\"5\" cy=\"5\" r=\"4\" fill=\"red\"/>";
+            write_file(prefix + "valid.svg", "<svg width=\"20\" height=\"10\">" + circle + "</svg>");
+            write_file(prefix + "no_size.svg", "<svg></svg>");
+            write_file(prefix + "zero_width.svg", "<svg width=\"0\" height=\"10\">" + circle + "</svg>");
+            ConvertOptions streaming;
+            streaming.streaming = true;
+            for (ConvertOptions options : {ConvertOptions(), streaming})
+            {
+                options.threads = 2;
+                vector<ConvertJob> jobs = {{prefix + "valid.svg", prefix + "valid_1.png"},
+                                           {prefix + "no_size.svg", prefix + "no_size.png"},
+                                           {prefix + "zero_width.svg", prefix + "zero_width.png"},
+                                           {prefix + "missing.svg", prefix + "missing.png"},
+                                           {prefix + "valid.svg", prefix + "valid_2.png"}};
+                vector<string> errors = convertBatch(jobs, options);
+                if (errors.size() != jobs.size() || !errors[0].empty() || errors[1].empty() ||
+                    errors[2].empty() || errors[3].empty() || !errors[4].empty() ||
+                    !compare_images(prefix + "valid_1.png", prefix + "valid_2.png"))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Caches holding two images evict the least recently used one, in
+        // memory and on disk, where its file is removed.
+        bool check_cache_eviction()
+        {
+            // Images of the same size, with different colors.
+            vector<string> documents;
+            for (const char *color : {"red", "green", "blue"})
+            {
+                documents.push_back(string("<svg width=\"20\" height=\"10\">") +
+                                    "<circle cx=\"5\" cy=\"5\" r=\"4\" fill=\"" + color + "\"/></svg>");
+            }
+            size_t size = convert(documents[0].data(), documents[0].size()).size();
+            string cache_dir = root_path + "/output/check_cache";
+            remove_directory(cache_dir);
+            RenderCache cache(cache_dir, size * 5 / 2, size * 5 / 2);
+            vector<uint8_t> png;
+            auto render = [&](int document) {
+                cache.convert(documents[document].data(), documents[document].size(), ConvertOptions(), png);
+                return png == convert(documents[document].data(), documents[document].size());
+            };
+            auto files = [&cache_dir] {
+                int count = 0;
+                ::DIR *dir = ::opendir(cache_dir.c_str());
+                while (::dirent *entry = ::readdir(dir))
+                {
+                    count += entry->d_name[0] != '.';
+                }
+                ::closedir(dir);
+                return count;
+            };
+            // Red is evicted by blue.
+            if (!render(0) || !render(1) || !render(2))
+            {
+                return false;
+            }
+            RenderCacheStats stats = cache.stats();
+            if (stats.misses != 3 || stats.memory_evictions != 1 || stats.disk_evictions != 1 || files() != 2 ||
+                stats.memory_bytes != 2 * size || stats.disk_bytes != 2 * size)
+            {
+                cout << "(first eviction)" << endl;
+                return false;
+            }
+            // Green is found in memory, then red evicts blue from memory and
+            // green from the disk, and blue is found on the disk.
+            if (!render(1) || !render(0) || !render(2))
+            {
+                return false;
+            }
+            stats = cache.stats();
+            if (stats.memory_hits != 1 || stats.misses != 4 || stats.disk_hits != 1 ||
+                stats.memory_evictions != 3 || stats.disk_evictions != 2 || files() != 2)
+            {
+                cout << "(least recently used)" << endl;
+                return false;
+            }
+            return true;
+        }
+
+        // Every color keyword resolves to its color, in any case; other
+        // colors are read as '#rrggbb', '#rgb' or 'rgb()', and the rest is rejected.
+        bool check_color_names()
+        {
+            // The SVG color keywords; "green" is {0, 255, 0} in this library.
+            static const pair<const char *, Color> NAMES[] = {
+                {"aliceblue", {240, 248, 255}}, {"antiquewhite", {250, 235, 215}}, {"aqua", {0, 255, 255}},
+                {"aquamarine", {127, 255, 212}}, {"azure", {240, 255, 255}}, {"beige", {245, 245, 220}},
+                {"bisque", {255, 228, 196}}, {"black", {0, 0, 0}}, {"blanchedalmond", {255, 235, 205}},
+                {"blue", {0, 0, 255}}, {"blueviolet", {138, 43, 226}}, {"brown", {165, 42, 42}},
+                {"burlywood", {222, 184, 135}}, {"cadetblue", {95, 158, 160}}, {"chartreuse", {127, 255, 0}},
+                {"chocolate", {210, 105, 30}}, {"coral", {255, 127, 80}}, {"cornflowerblue", {100, 149, 237}},
+                {"cornsilk", {255, 248, 220}}, {"crimson", {220, 20, 60}}, {"cyan", {0, 255, 255}},
+                {"darkblue", {0, 0, 139}}, {"darkcyan", {0, 139, 139}}, {"darkgoldenrod", {184, 134, 11}},
+                {"darkgray", {169, 169, 169}}, {"darkgreen", {0, 100, 0}}, {"darkgrey", {169, 169, 169}},
+                {"darkkhaki", {189, 183, 107}}, {"darkmagenta", {139, 0, 139}},
+                {"darkolivegreen", {85, 107, 47}}, {"darkorange", {255, 140, 0}},
+                {"darkorchid", {153, 50, 204}}, {"darkred", {139, 0, 0}}, {"darksalmon", {233, 150, 122}},
+                {"darkseagreen", {143, 188, 143}}, {"darkslateblue", {72, 61, 139}},
+                {"darkslategray", {47, 79, 79}}, {"darkslategrey", {47, 79, 79}},
+                {"darkturquoise", {0, 206, 209}}, {"darkviolet", {148, 0, 211}}, {"deeppink", {255, 20, 147}},
+                {"deepskyblue", {0, 191, 255}}, {"dimgray", {105, 105, 105}}, {"dimgrey", {105, 105, 105}},
+                {"dodgerblue", {30, 144, 255}}, {"firebrick", {178, 34, 34}}, {"floralwhite", {255, 250, 240}},
+                {"forestgreen", {34, 139, 34}}, {"fuchsia", {255, 0, 255}}, {"gainsboro", {220, 220, 220}},
+                {"ghostwhite", {248, 248, 255}}, {"gold", {255, 215, 0}}, {"goldenrod", {218, 165, 32}},
+                {"gray", {128, 128, 128}}, {"green", {0, 255, 0}}, {"greenyellow", {173, 255, 47}},
+                {"grey", {128, 128, 128}}, {"honeydew", {240, 255, 240}}, {"hotpink", {255, 105, 180}},
+                {"indianred", {205, 92, 92}}, {"indigo", {75, 0, 130}}, {"ivory", {255, 255, 240}},
+                {"khaki", {240, 230, 140}}, {"lavender", {230, 230, 250}}, {"lavenderblush", {255, 240, 245}},
+                {"lawngreen", {124, 252, 0}}, {"lemonchiffon", {255, 250, 205}}, {"lightblue", {173, 216, 230}},
+                {"lightcoral", {240, 128, 128}}, {"lightcyan", {224, 255, 255}},
+                {"lightgoldenrodyellow", {250, 250, 210}}, {"lightgray", {211, 211, 211}},
+                {"lightgreen", {144, 238, 144}}, {"lightgrey", {211, 211, 211}}, {"lightpink", {255, 182, 193}},
+                {"lightsalmon", {255, 160, 122}}, {"lightseagreen", {32, 178, 170}},
+                {"lightskyblue", {135, 206, 250}}, {"lightslategray", {119, 136, 153}},
+                {"lightslategrey", {119, 136, 153}}, {"lightsteelblue", {176, 196, 222}},
+                {"lightyellow", {255, 255, 224}}, {"lime", {0, 255, 0}}, {"limegreen", {50, 205, 50}},
+                {"linen", {250, 240, 230}}, {"magenta", {255, 0, 255}}, {"maroon", {128, 0, 0}},
+                {"mediumaquamarine", {102, 205, 170}}, {"mediumblue", {0, 0, 205}},
+                {"mediumorchid", {186, 85, 211}}, {"mediumpurple", {147, 112, 219}},
+                {"mediumseagreen", {60, 179, 113}}, {"mediumslateblue", {123, 104, 238}},
+                {"mediumspringgreen", {0, 250, 154}}, {"mediumturquoise", {72, 209, 204}},
+                {"mediumvioletred", {199, 21, 133}}, {"midnightblue", {25, 25, 112}},
+                {"mintcream", {245, 255, 250}}, {"mistyrose", {255, 228, 225}}, {"moccasin", {255, 228, 181}},
+                {"navajowhite", {255, 222, 173}}, {"navy", {0, 0, 128}}, {"oldlace", {253, 245, 230}},
+                {"olive", {128, 128, 0}}, {"olivedrab", {107, 142, 35}}, {"orange", {255, 165, 0}},
+                {"orangered", {255, 69, 0}}, {"orchid", {218, 112, 214}}, {"palegoldenrod", {238, 232, 170}},
+                {"palegreen", {152, 251, 152}}, {"paleturquoise", {175, 238, 238}},
+                {"palevioletred", {219, 112, 147}}, {"papayawhip", {255, 239, 213}},
+                {"peachpuff", {255, 218, 185}}, {"peru", {205, 133, 63}}, {"pink", {255, 192, 203}},
+                {"plum", {221, 160, 221}}, {"powderblue", {176, 224, 230}}, {"purple", {128, 0, 128}},
+                {"red", {255, 0, 0}}, {"rosybrown", {188, 143, 143}}, {"royalblue", {65, 105, 225}},
+                {"saddlebrown", {139, 69, 19}}, {"salmon", {250, 128, 114}}, {"sandybrown", {244, 164, 96}},
+                {"seagreen", {46, 139, 87}}, {"seashell", {255, 245, 238}}, {"sienna", {160, 82, 45}},
+                {"silver", {192, 192, 192}}, {"skyblue", {135, 206, 235}}, {"slateblue", {106, 90, 205}},
+                {"slategray", {112, 128, 144}}, {"slategrey", {112, 128, 144}}, {"snow", {255, 250, 250}},
+                {"springgreen", {0, 255, 127}}, {"steelblue", {70, 130, 180}}, {"tan", {210, 180, 140}},
+                {"teal", {0, 128, 128}}, {"thistle", {216, 191, 216}}, {"tomato", {255, 99, 71}},
+                {"turquoise", {64, 224, 208}}, {"violet", {238, 130, 238}}, {"wheat", {245, 222, 179}},
+                {"white", {255, 255, 255}}, {"whitesmoke", {245, 245, 245}}, {"yellow", {255, 255, 0}},
+                {"yellowgreen", {154, 205, 50}}
+            };
+            static_assert(sizeof(NAMES) / sizeof(NAMES[0]) == 147, "147 color keywords");
+            auto same = [](const Color &a, const Color &b) {
+                return a.red == b.red && a.green == b.green && a.blue == b.blue;
+            };
+            for (const pair<const char *, Color> &name : NAMES)
+            {
+                string upper = name.first;
+                transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+                if (!same(parse_color(name.first), name.second) || !same(parse_color(upper), name.second))
+                {
+                    cout << "color " << name.first << endl;
+                    return false;
+                }
+            }
+            const pair<const char *, Color> VALUES[] = {
+                {"#ff8000", {255, 128, 0}}, {"#FfA", {255, 255, 170}}, {"#0c8", {0, 204, 136}},
+                {" rgb(255, 128, 0) ", {255, 128, 0}}, {"rgb(0,0,300)", {0, 0, 255}},
+                {"rgb(100%, 50%, 0%)", {255, 128, 0}}, {"rgb(-5, 12.4, 12.6)", {0, 12, 13}},
+                {" Red\t", {255, 0, 0}}
+            };
+            for (const pair<const char *, Color> &value : VALUES)
+            {
+                if (!same(parse_color(value.first), value.second))
+                {
+                    cout << "color " << value.first << endl;
+                    return false;
+                }
+            }
+            const char *INVALID[] = {"", "gren", "greenx", "green yellow", "#12", "#1234", "#ggg", "#12345g",
+                                      "rgb(1, 2)", "rgb(1, 2, 3", "rgb(1, 2, 3)x", "rgb(1 2 3)", "rgb(a, 2, 3)",
+                                      "rgb(.%, 2, 3)"};
+            for (const char *invalid : INVALID)
+            {
+                try
+                {
+                    parse_color(invalid);
+                    cout << "color " << invalid << endl;
+                    return false;
+                }
+                catch (const invalid_argument &)
+                {
+                }
+            }
+            return true;
+        }
+
+        // Compiled files without an image size are invalid.
+        bool check_compiled_header()
+        {
+            string compiled_file = root_path + "/output/check_no_size.svgc";
+            int errors = 0;
+            for (const Point &dimensions : {Point{0, 10}, Point{10, 0}, Point{-1, -1}})
+            {
+                CompiledSVG::save(compiled_file, dimensions, DisplayList());
+                try
+                {
+                    convert(compiled_file, root_path + "/output/check_no_size.png");
+                }
+                catch (const runtime_error &)
+                {
+                    errors++;
+                }
+            }
+            return errors == 3;
+        }
+
+        // Empty documents are errors, without reading their null data.
+        bool check_empty_document()
+        {
+            string empty_file = root_path + "/output/check_empty.svg";
+            write_file(empty_file, "");
+            ConvertOptions streaming;
+            streaming.streaming = true;
+            int errors = 0;
+            for (const ConvertOptions &options : {ConvertOptions(), streaming})
+            {
+                try
+                {
+                    convert(empty_file, root_path + "/output/check_empty.png", options);
+                }
+                catch (const runtime_error &)
+                {
+                    errors++;
+                }
+                try
+                {
+                    convert(nullptr, 0, options);
+                }
+                catch (const runtime_error &)
+                {
+                    errors++;
+                }
+            }
+            return errors == 4;
+        }
+
+        // Images larger than the pixel limit are rejected before they are allocated.
+        bool check_image_limit()
+        {
+            string text = "<svg width=\"100\" height=\"50\"><rect x=\"0\" y=\"0\" width=\"10\" height=\"10\" "
+                          "fill=\"red\"/></svg>";
+            ConvertOptions sized, scaled, limited;
+            sized.width = 100000;
+            sized.height = 100000;
+            scaled.scale = 1e6;
+            limited.max_pixels = 100 * 50 - 1;
+            int errors = 0;
+            for (const ConvertOptions &options : {sized, scaled, limited})
+            {
+                for (bool streaming : {false, true})
+                {
+                    ConvertOptions o = options;
+                    o.streaming = streaming;
+                    try
+                    {
+                        convert(text.data(), text.size(), o);
+                    }
+                    catch (const invalid_argument &)
+                    {
+                        errors++;
+                    }
+                }
+            }
+            limited.max_pixels++;
+            return errors == 6 && !convert(text.data(), text.size(), limited).empty();
+        }
+
+        // Lines and polygons with coordinates near the int range, whose
+        // fixed-point terms don't fit 64 bits, are drawn with their exact
+        // pixels: a diagonal line over the edge of a triangle filling the
+        // part of the image above it.
+        bool check_large_coordinates()
+        {
+            string text = "<svg width=\"100\" height=\"100\">"
+                          "<polygon points=\"-2000000000,-2000000000 2000000000,2000000000 2000000000,-2000000000\" "
+                          "fill=\"red\"/><line x1=\"-2000000000\" y1=\"-2000000000\" x2=\"2000000000\" "
+                          "y2=\"2000000000\" stroke=\"blue\"/></svg>";
+            string png_file = root_path + "/output/check_large_coordinates.png";
+            vector<uint8_t> png = convert(text.data(), text.size());
+            ofstream(png_file, ios::binary).write((const char *)png.data(), png.size());
+            PNGImage img(png_file);
+            for (int y = 0; y < 100; y++)
+            {
+                for (int x = 0; x < 100; x++)
+                {
+                    Color c = img.at(x, y);
+                    Color e = x == y ? Color{0, 0, 255} : x > y ? Color{255, 0, 0} : Color{255, 255, 255};
+                    if (c.red != e.red || c.green != e.green || c.blue != e.blue)
+                    {
+                        cout << "(" << png_file << " at " << x << "," << y << ")" << endl;
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // A circle much larger than the image is drawn in time proportional
+        // to the rows of the image, with the pixels of the exact test.
+        bool check_large_circle()
+        {
+            const long long cx = 50, cy = 200000040, r = 200000000;
+            string text = "<svg width=\"100\" height=\"100\"><circle cx=\"50\" cy=\"200000040\" r=\"200000000\" "
+                          "fill=\"red\"/></svg>";
+            string png_file = root_path + "/output/check_large_circle.png";
+            vector<uint8_t> png = convert(text.data(), text.size());
+            ofstream(png_file, ios::binary).write((const char *)png.data(), png.size());
+            PNGImage img(png_file);
+            for (int y = 0; y < 100; y++)
+            {
+                for (int x = 0; x < 100; x++)
+                {
+                    long long dx = x - cx, dy = y - cy;
+                    bool inside = dx * dx + dy * dy <= r * r;
+                    Color c = img.at(x, y);
+                    if (inside != (c.red == 255 && c.green == 0 && c.blue == 0))
+                    {
+                        cout << "(" << png_file << " at " << x << "," << y << ")" << endl;
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Ellipses with radii whose error terms don't fit 64 bits are drawn,
+        // with the pixels of the exact test, given directly or by a scale().
+        bool check_large_ellipse()
+        {
+            const long long cx = 50, cy = 40040, rx = 100000, ry = 40000;
+            string direct = "<svg width=\"100\" height=\"100\"><ellipse cx=\"50\" cy=\"40040\" rx=\"100000\" "
+                            "ry=\"40000\" fill=\"red\"/></svg>";
+            string scaled = "<svg width=\"100\" height=\"100\"><ellipse cx=\"5\" cy=\"4004\" rx=\"10000\" "
+                            "ry=\"4000\" fill=\"red\" transform=\"scale(10)\"/></svg>";
+            int variant = 0;
+            for (const string &text : {direct, scaled})
+            {
+                for (bool streaming : {false, true})
+                {
+                    ConvertOptions options;
+                    options.streaming = streaming;
+                    string png_file = root_path + "/output/check_large_ellipse_" + to_string(variant++) + ".png";
+                    vector<uint8_t> png = convert(text.data(), text.size(), options);
+                    ofstream(png_file, ios::binary).write((const char *)png.data(), png.size());
+                    PNGImage img(png_file);
+                    for (int y = 0; y < 100; y++)
+                    {
+                        for (int x = 0; x < 100; x++)
+                        {
+                            // Within 64 bits on the canvas: dy^2 * rx^2 <= rx^2 * ry^2 < 2^64.
+                            unsigned long long dx = llabs(x - cx), dy = llabs(y - cy);
+                            bool inside = dx * dx * ry * ry + dy * dy * rx * rx <= (unsigned long long)(rx * rx) * ry * ry;
+                            Color c = img.at(x, y);
+                            if (inside != (c.red == 255 && c.green == 0 && c.blue == 0))
+                            {
+                                cout << "(" << png_file << " at " << x << "," << y << ")" << endl;
+                                return false;
+                            }
+                        }
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Documents are drawn at the output size: group_3 with its coordinates
+        // doubled, drawn at half its size with a scale, a width or a height,
+        // gives the image of group_3, from the document and from its display list.
+        bool check_output_size()
+        {
+            string doubled_file = root_path + "/output/check_doubled.svg";
+            write_file(doubled_file,
+                       "<svg width=\"1060\" height=\"1060\">\n"
+                       "  <g transform=\"translate(20 20)\">\n"
+                       "    <circle cx=\"500\" cy=\"500\" r=\"500\" fill=\"red\" />\n"
+                       "    <circle cx=\"500\" cy=\"500\" r=\"400\" fill=\"white\" />\n"
+                       "    <circle cx=\"500\" cy=\"500\" r=\"300\" fill=\"red\" />\n"
+                       "    <circle cx=\"500\" cy=\"500\" r=\"200\" fill=\"blue\" />\n"
+                       "    <polygon fill=\"white\" points=\"500,300 560,418 692,438 596,530 618,660 "
+                       "500,600 384,660 406,530 310,438 442,418\" />\n"
+                       "  </g>\n"
+                       "</svg>\n");
+            string compiled_file = root_path + "/output/check_doubled.svgc";
+            compileSVG(doubled_file, compiled_file);
+            string exp_file = root_path + "/expected/group_3.png";
+            ConvertOptions scaled, sized, banded;
+            scaled.scale = 0.5;
+            sized.width = 530;
+            sized.streaming = true;
+            banded.height = 530;
+            banded.streaming = true;
+            banded.band_rows = 50;
+            banded.threads = 4;
+            int variant = 0;
+            for (const string &file : {doubled_file, compiled_file})
+            {
+                for (const ConvertOptions &options : {scaled, sized, banded})
+                {
+                    string out_file = root_path + "/output/check_doubled_" + to_string(variant++) + ".png";
+                    convert(file, out_file, options);
+                    if (!compare_images(exp_file, out_file))
+                    {
+                        cout << "(" << out_file << ")" << endl;
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // PNG files are valid with all encoding options, with rows written in
+        // uneven groups, and give back their pixels; corrupted checksums are found.
+        bool check_png_encoding()
+        {
+            const int w = 67, h = 45;
+            const string png_file = root_path + "/output/check_encoding.png";
+            vector<uint8_t> png;
+            PNGWriter::Sink sink = [&png](const uint8_t *data, size_t size) {
+                png.insert(png.end(), data, data + size);
+            };
+            ThreadPool pool(3);
+            // 1, 2, 4 and 8-bit palettes, then RGB.
+            for (int colors : {2, 4, 16, 256, 300})
+            {
+                vector<Color> pixels(w * h);
+                Palette palette;
+                for (int i = 0; i < w * h; i++)
+                {
+                    int c = (i % w / 3 + i / w * 5) % colors;
+                    pixels[i] = {(rgb_value)c, (rgb_value)(c >> 8), (rgb_value)(c * 37)};
+                    palette.add(pixels[i]);
+                }
+                for (int level = 0; level <= 9; level++)
+                {
+                    for (PNGFilter filter : {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_ADAPTIVE})
+                    {
+                        for (int variant = 0; variant < 4; variant++)
+                        {
+                            PNGOptions options;
+                            options.level = level;
+                            options.filter = filter;
+                            options.palette = variant % 2 == 0;
+                            png.clear();
+                            PNGWriter writer(sink, w, h, options, variant < 2 ? nullptr : &pool, &palette);
+                            for (int y = 0, count = 1; y < h; y += count, count = count % 7 + 1)
+                            {
+                                writer.write_rows(&pixels[y * w], min(count, h - y));
+                            }
+                            writer.finish();
+                            write_file(png_file, string(png.begin(), png.end()));
+                            if (!verify_png(png_file))
+                            {
+                                cout << "(" << colors << " colors, level " << level << ", filter " << filter
+                                     << ", variant " << variant << ")" << endl;
+                                return false;
+                            }
+                            PNGImage img(png_file);
+                            for (int i = 0; i < w * h; i++)
+                            {
+                                Color c = img.at(i % w, i / w);
+                                if (c.red != pixels[i].red || c.green != pixels[i].green || c.blue != pixels[i].blue)
+                                {
+                                    cout << "(pixels of " << colors << " colors, level " << level << ")" << endl;
+                                    return false;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            // A changed byte of image data fails the CRC of its chunk; a changed
+            // Adler-32 fails, even with the CRC updated. The Adler-32 ends the
+            // last IDAT chunk, before its CRC and the IEND chunk.
+            size_t adler = png.size() - 12 - 4 - 4;
+            size_t chunk = 8;
+            while (get_u32_be(&png[chunk]) + chunk + 8 != adler + 4)
+            {
+                chunk += 12 + get_u32_be(&png[chunk]);
+            }
+            vector<uint8_t> corrupted = png;
+            corrupted[adler - 1] ^= 1;
+            write_file(png_file, string(corrupted.begin(), corrupted.end()));
+            bool crc_found = !verify_png(png_file);
+            corrupted = png;
+            corrupted[adler + 3] ^= 1;
+            uint32_t crc = crc32(&corrupted[chunk + 4], adler + 4 - chunk - 4);
+            for (int i = 0; i < 4; i++)
+            {
+                corrupted[adler + 4 + i] = (uint8_t)(crc >> (24 - 8 * i));
+            }
+            write_file(png_file, string(corrupted.begin(), corrupted.end()));
+            bool adler_found = !verify_png(png_file);
+            return crc_found && adler_found;
+        }
+
+        // Requests that can't be drawn fail alone, without stopping the server.
+        bool check_server_errors()
+        {
+            string socket_path = root_path + "/output/check_server.sock";
+            RenderServer server(socket_path, 2, 1);
+            thread server_thread([&server] { server.run(); });
+            string circle = "<circle cx=\"5\" cy=\"5\" r=\"4\" fill=\"red\"/>";
+            string valid = "<svg width=\"20\" height=\"10\">" + circle + "</svg>";
+            string huge = "<svg width=\"100000\" height=\"100000\">" + circle + "</svg>";
+            ConvertOptions sized;
+            sized.width = 200000;
+            sized.height = 200000;
+            vector<pair<string, ConvertOptions>> requests = {{"<svg></svg>", ConvertOptions()},
+                                                             {valid, sized},
+                                                             {huge, ConvertOptions()}};
+            int errors = 0;
+            vector<uint8_t> png;
+            {
+                RenderClient client(socket_path);
+                for (const pair<string, ConvertOptions> &request : requests)
+                {
+                    try
+                    {
+                        client.render(request.first.data(), request.first.size(), request.second, png);
+                    }
+                    catch (const runtime_error &)
+                    {
+                        errors++;
+                    }
+                }
+                client.render(valid.data(), valid.size(), ConvertOptions(), png);
+            }
+            server.stop();
+            server_thread.join();
+            return errors == 3 && png == convert(valid.data(), valid.size());
+        }
+
+        // Transformed coordinates and lengths out of the int range are
+        // clamped to it, as the coordinates read by the parser are; a
+        // document scaled past the range is drawn.
+        bool check_transform_range()
+        {
+            Transform t(1e12, 0, 0, -1e12, 0, 0);
+            Point p = t.apply({5, 5});
+            Point q = Transform(1, 0, 0, 1, NAN, 0).apply({0, 0});
+            if (p.x != INT_MAX || p.y != INT_MIN || t.apply_x_length(5) != INT_MAX || t.apply_y_length(-5) != INT_MIN ||
+                q.x != INT_MIN || q.y != 0 || Transform(2, 0, 0, 2, 0.5, -0.5).apply({3, 4}).x != 7)
+            {
+                return false;
+            }
+            string text = "<svg width=\"100\" height=\"100\"><g transform=\"scale(1e9)\"><rect x=\"0\" y=\"0\" "
+                          "width=\"5\" height=\"5\" fill=\"red\"/><ellipse cx=\"1\" cy=\"1\" rx=\"3\" ry=\"2\" "
+                          "fill=\"blue\"/></g></svg>";
+            return !convert(text.data(), text.size()).empty();
+        }
+
+        // Clones of a detached use element outlive it.
+        bool check_use_clone()
+        {
+            Circle circle({5, 5}, 4, {255, 0, 0}, "circle");
+            Use *use = new Use(&circle, "use");
+            use->detach()->translate({2, 0});
+            SVGElement *clone = use->clone("clone");
+            DisplayList expected, cloned;
+            use->compile(expected, Transform());
+            delete use;
+            clone->compile(cloned, Transform());
+            delete clone;
+            return cloned.commands().size() == 1 && cloned.points().size() == expected.points().size() &&
+                   cloned.points()[0].x == expected.points()[0].x && cloned.points()[0].x == 7;
+        }
+
         void onTestBegin(const string &id)
         {
             total_tests++;
@@ -99,7 +1261,18 @@ namespace svg
             
                 ::dup2(log_fd, 1);
                 ::dup2(log_fd, 2);
-                bool success = run_conversion_test(id);
+                bool success = false;
+                for (const pair<string, Check> &check : checks())
+                {
+                    if (check.first == id)
+                    {
+                        success = (this->*check.second)();
+                    }
+                }
+                if (id.compare(0, 6, "check_") != 0)
+                {
+                    success = run_conversion_test(id);
+                }
                 ::exit(success ? 0 : 1);
             }
             else if (pid > 0)
@@ -129,27 +1302,21 @@ namespace svg
 
         void run_tests(const string &spec)
         {
-            string dir_path = root_path + "/input";
-            ::DIR *directory = ::opendir(dir_path.c_str());
-            if (directory == nullptr)
+            vector<string> scripts_to_execute;
+            for (const string &id : corpus_ids())
             {
-                cerr << "Unable to open input directory " << dir_path << endl;
-                return;
+                if (id.find(spec) == 0)
+                {
+                    scripts_to_execute.push_back(id);
+                }
             }
-            vector<string> scripts_to_execute;
-            ::dirent *entry;
-            while ((entry = readdir(directory)) != nullptr)
+            for (const pair<string, Check> &check : checks())
             {
-                if (entry->d_type == DT_REG)
+                if (check.first.find(spec) == 0)
                 {
-                    string fname = entry->d_name;
-                    if (fname.find(spec) == 0)
-                    {
-                        scripts_to_execute.push_back(fname.substr(0, fname.find_last_of('.')));
-                    }
+                    scripts_to_execute.push_back(check.first);
                 }
             }
-            ::closedir(directory);
             if (scripts_to_execute.empty())
             {
                 cout << "No scripts matched the spec: " << spec << endl;